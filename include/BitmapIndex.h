@@ -0,0 +1,46 @@
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+#include "../include/Pack.h"
+#include "../include/MappedFile.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+//reachability bitmaps of a pack, in pack-<id>.bitmap next to it: for the branch tips and every
+//SPACING-th commit of the pack, the objects reachable from the commit as one bit per object,
+//numbered in the order the pack wrote them (an object's ancestors' objects mostly sit next to
+//it, so the bitmaps compress well), EWAH-compressed
+//file (integers in host byte order): "GLBITMP1", uint32 object count, uint32 bitmap count, the
+//uint32 table index of the object at each position, then each bitmap as uint32 position of its
+//commit, uint32 byte length and the compressed words, then the CRC-32 of everything before
+class BitmapIndex{
+    MappedFile file;
+    const Pack& pack;
+    std::vector<uint32_t> order;//table index by position
+    std::vector<uint32_t> positions;//position by table index
+    std::unordered_map<uint32_t, std::string_view> bitmaps;//by commit position
+    bool valid;
+
+public:
+    static constexpr size_t SPACING = 100;
+
+    //the bitmaps of pack, read from the file next to packPath
+    BitmapIndex(const std::string& packPath, const Pack& pack);
+
+    bool is_valid() const { return valid; }
+    size_t size() const { return order.size(); }
+    const Pack& getPack() const { return pack; }
+    //position of an object, false if the pack does not hold it
+    bool position(char kind, const ObjectId& id, uint32_t& pos) const;
+    Pack::Entry entryAt(uint32_t pos) const { return pack.entry(order[pos]); }
+    //OR the bitmap of the commit at pos into words (size() bits); false if it has none
+    bool orBitmap(uint32_t pos, std::vector<uint64_t>& words) const;
+
+    static std::string pathOf(const std::string& packPath);
+    //write the bitmaps of a pack holding everything reachable from tips; the bitmaps of the
+    //first of oldPacks that has them are reused instead of walking the history below them
+    static void write(const std::string& packPath, const std::vector<std::string>& tips, const std::string& repoPath, const std::vector<std::string>& oldPacks = {});
+};
+#endif
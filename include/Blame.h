@@ -0,0 +1,36 @@
+#ifndef BLAME_H
+#define BLAME_H
+#include "../include/Manifest.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+//line origins of a file: for each line, the commit that introduced it and its line number there
+//a version of the file is blamed on its parents' versions through Diff::compare: kept lines take
+//the parent's origins (the first parent's, for a merge, then the next parent's for lines the
+//first does not have) and the rest are the commit's own. Commits that did not change the file are
+//passed over, by the commit-graph's changed-path filters without reading them where possible
+//the version blamed is saved in .gitlite/blame-cache/, keyed by the commit that introduced it and
+//the path, so a later blame only diffs the versions committed since
+class Blame{
+public:
+    struct Line{
+        ObjectId commit;
+        uint32_t line;//1-based
+    };
+    typedef std::vector<Line> Lines;
+    //work done by one blame
+    struct Stats{
+        size_t walked = 0;//commits visited
+        size_t skipped = 0;//of those, passed over by their changed-path filter
+        size_t diffed = 0;//versions blamed on their parents
+        size_t cached = 0;//versions read from the cache
+    };
+
+    //origins of the lines of path as of commit (which must have the file)
+    static std::shared_ptr<const Lines> of(const std::string& commit, const std::string& path, Stats& stats, const std::string& repoPath = ".gitlite");
+    //remove the cache, once the history it was computed on changed (see Shallow)
+    static void clearCache(const std::string& repoPath = ".gitlite");
+};
+#endif
@@ -5,8 +5,8 @@
 
 class Blob{
 public:
-    static void createBlob(const std::vector<unsigned char>& blobContent);
-    static std::vector<unsigned char> readBlobContents(const std::string& blobHash);
-    static std::string readBlobContentsAsString(const std::string& blobHash);
+    static void createBlob(const std::vector<unsigned char>& blobContent, const std::string& repoPath = ".gitlite");
+    static std::vector<unsigned char> readBlobContents(const std::string& blobHash, const std::string& repoPath = ".gitlite");
+    static std::string readBlobContentsAsString(const std::string& blobHash, const std::string& repoPath = ".gitlite");
 };
 #endif
\ No newline at end of file
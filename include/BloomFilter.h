@@ -0,0 +1,26 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//changed-path Bloom filter of one commit, as stored in commit-graph/bloom-data
+//an empty filter means "too many paths to record": every path may have changed
+class BloomFilter{
+public:
+    static const size_t BITS_PER_PATH = 10;
+    static const size_t NUM_HASHES = 7;
+    static const size_t MAX_PATHS = 512;
+
+    struct Key{
+        uint32_t h1;
+        uint32_t h2;
+    };
+    static Key keyFor(const std::string& path);
+
+    //filter bytes for a set of changed paths
+    static std::string build(const std::vector<std::string>& paths);
+    //false only if the path is certainly not in the filter
+    static bool mayContain(const char* filter, size_t size, const Key& key);
+};
+#endif
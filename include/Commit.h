@@ -1,16 +1,33 @@
 #ifndef COMMIT_H
 #define COMMIT_H
 #include <string>
+#include <string_view>
 #include <ctime>
 #include <vector>
-#include <map>
+#include <memory>
+#include "../include/Manifest.h"
 
 class Commit{
+    //raw commit file; copies of a commit share it, so views into it stay valid
+    std::shared_ptr<const std::string> buffer;
+    //storage for a message set after loading
+    std::shared_ptr<const std::string> ownedMessage;
+
     std::string hash;
-    std::string message;
+    std::string_view message;
     time_t timestamp;
     std::vector<std::string> parents;
-    std::map<std::string, std::string> files;
+    //repository the commit (and its trees) were read from
+    std::string repoPath;
+    //root directory tree; null for an empty tree and for commits from before tree objects
+    mutable ObjectId tree;
+    //"filename blobhash" lines of a commit from before tree objects, parsed into files on first use
+    std::string_view filesText;
+    mutable bool filesParsed;
+    mutable Manifest files;
+
+    //flatten the tree (or parse filesText) if not done yet
+    void ensureFiles() const;
 
     //make all content to one string
     std::string tostring();
@@ -19,27 +36,39 @@ class Commit{
     void computeHash();
 
 public:
-    Commit() : message{"initial commit"}, timestamp{0} {
+    //parsed commits kept by Commit::load
+    static const size_t CACHE_CAPACITY = 4096;
+
+    Commit() : message{"initial commit"}, timestamp{0}, repoPath{".gitlite"}, filesParsed{true} {
         computeHash();
     }
     Commit(const std::string& str, const std::string& repoPath = ".gitlite");//constructor from hash
+    //the initial commit, to be written to the repository at repoPath (its hash is the same in all)
+    static Commit initial(const std::string& repoPath);
+
+    //shared read-only commit from the per-process LRU cache (commit files never change)
+    static std::shared_ptr<const Commit> load(const std::string& hash, const std::string& repoPath = ".gitlite");
+    //forget the parsed commits, once the parents they were read with changed (see Shallow)
+    static void clearCache();
 
 
     //get
     std::string getHash() const;
-    std::string getMessage() const;
+    std::string_view getMessage() const;
     time_t getTimestamp() const;
     std::string getFirstParent() const;
-    std::vector<std::string> getParents() const;
-    std::string getBlob(const std::string& filename);
-    std::map<std::string, std::string> getFiles() const;
+    const std::vector<std::string>& getParents() const;
+    std::string getBlob(const std::string& filename) const;
+    const Manifest& getFiles() const;
+    //root tree id; commits from before tree objects get their trees written on first use
+    ObjectId getTree() const;
     //modify
     void setTime();
     void setMessage(const std::string& msg);
     void resetParent(const std::string& hash);
     void addParent(const std::string& parent);
-    void addFiles(std::map<std::string, std::string>& addtion);
-    void rmFiles(std::map<std::string, int>& removal);
+    //apply staged changes; only the directories on a changed path are rewritten
+    void updateFiles(const Manifest& addition, const PathSet& removal);
     //find
     bool in_commit(const std::string& filename) const;
 
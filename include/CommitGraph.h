@@ -0,0 +1,62 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+#include "../include/Commit.h"
+#include "../include/MappedFile.h"
+#include "../include/BloomFilter.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <ctime>
+
+//append-only commit metadata store in .gitlite/commit-graph, written under commit-graph.lock
+//and read without it: a row becomes visible when its hash is appended, after its other columns
+//each column is its own file, one row per commit, in the order commits were written:
+//  hashes            40 bytes per row
+//  timestamps        int64 per row
+//  parents           80 bytes per row (second parent zero-filled if absent)
+//  message-offsets   uint64 per row, end offset of the message in messages
+//  messages          all messages concatenated
+//  bloom-offsets     uint64 per row, end offset of the changed-path filter in bloom-data
+//  bloom-data        changed-path Bloom filters (paths that differ from the first parent)
+class CommitGraph{
+    std::string dir;
+    MappedFile hashCol, timeCol, parentCol, offsetCol, messageCol;
+    MappedFile bloomOffsetCol, bloomDataCol;
+    size_t rows;
+    bool valid;
+    bool exact;//no column holds more than the complete rows
+    bool bloomValid;
+    mutable std::unordered_map<std::string_view, size_t> rowOf;//built on first lookup
+
+public:
+    static const size_t HASH_WIDTH = 40;
+    static const size_t PARENTS_WIDTH = 2 * HASH_WIDTH;
+
+    explicit CommitGraph(const std::string& repoPath = ".gitlite");
+
+    bool is_valid() const;
+    size_t size() const;
+    std::string_view getHash(size_t row) const;
+    time_t getTimestamp(size_t row) const;
+    std::vector<std::string> getParents(size_t row) const;
+    std::string_view getMessage(size_t row) const;
+    //row of a commit, false if the commit is not in the store
+    bool findRow(const std::string& hash, size_t& row) const;
+
+    //whether changed-path filters are present for every row
+    bool hasBloom() const;
+    //false only if the commit certainly did not change the path
+    bool mayHaveChanged(size_t row, const BloomFilter::Key& key) const;
+    //paths (and their leading directories) that differ between a commit and its first parent
+    static std::vector<std::string> changedPaths(const Commit& commit, const std::string& repoPath = ".gitlite");
+
+    //load the store, rebuilding it from .gitlite/commits if it is missing or torn
+    static CommitGraph open(const std::string& repoPath = ".gitlite");
+    //add one newly written commit (no-op if the repository has no store)
+    //parents are read from sourcePath (defaults to repoPath) to compute changed paths
+    static void append(const Commit& commit, const std::string& repoPath = ".gitlite", const std::string& sourcePath = "");
+    //rewrite the whole store from the commit files
+    static void rebuild(const std::string& repoPath = ".gitlite");
+};
+#endif
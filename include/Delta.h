@@ -0,0 +1,19 @@
+#ifndef DELTA_H
+#define DELTA_H
+#include <string>
+#include <string_view>
+
+//an object described as copies from a base object and inserted bytes, for sending one whose
+//base the other side already has or has just been sent
+//format (integers in host byte order): uint32 base size, uint32 result size, then instructions:
+//'c', uint32 offset and uint32 length copy from the base; 'i', uint32 length and the bytes insert
+class Delta{
+public:
+    //blocks of the base indexed for matching; shorter matches are inserted instead
+    static constexpr size_t BLOCK = 16;
+
+    static std::string create(std::string_view base, std::string_view target);
+    //false if the delta is malformed or was made against another base
+    static bool apply(std::string_view base, std::string_view delta, std::string& result);
+};
+#endif
@@ -0,0 +1,50 @@
+#ifndef DIFF_H
+#define DIFF_H
+#include "../include/Manifest.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <iostream>
+
+//line diffs and patches. compare finds a shortest edit script between two line sequences with
+//Myers' algorithm in linear space (the middle snake, see "An O(ND) Difference Algorithm"): lines
+//are interned to integer ids first, so the kernel compares ints, and lines only one side has are
+//set aside as changed before it runs
+class Diff{
+public:
+    static const int CONTEXT = 3;//unchanged lines around each hunk
+    static const int RENAME_SCORE = 50;//least similarity (see Similarity) of a rename or copy
+    //edit cost after which compare settles for a good split instead of the best one: the square
+    //root of the number of lines, but at least this (as git's xdiff does)
+    static const long MIN_COST_LIMIT = 256;
+
+    //lines of text, each with its '\n' (the last one may have none)
+    static std::vector<std::string_view> splitLines(std::string_view text);
+    //lines of a to delete and lines of b to insert to turn a into b; the rest are kept
+    struct Script{
+        std::vector<bool> deleted;
+        std::vector<bool> inserted;
+    };
+    static Script compare(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b);
+    static bool isBinary(std::string_view content);
+
+    //one changed file: oldPath is empty for an added file and newPath for a deleted one
+    struct File{
+        std::string oldPath;
+        std::string newPath;
+        ObjectId oldId;
+        ObjectId newId;
+        int similarity = 0;//of a rename or copy
+        bool copy = false;//oldPath is kept as well
+    };
+    //content of a file of the old or new side
+    typedef std::function<std::string(const std::string& path, const ObjectId& id)> Reader;
+
+    //pair deleted and added files into renames, and added files into copies of deleted or
+    //modified ones: same blob ids first, then by content similarity
+    static void detectRenames(std::vector<File>& files, const Reader& readOld, const Reader& readNew);
+    //detect renames and print a unified patch of files (any order), or with stat a diffstat
+    static void write(std::ostream& out, std::vector<File> files, const Reader& readOld, const Reader& readNew, bool stat);
+};
+#endif
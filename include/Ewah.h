@@ -0,0 +1,22 @@
+#ifndef EWAH_H
+#define EWAH_H
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+//EWAH (enhanced word-aligned hybrid) compression of a bitmap held as 64-bit words
+//the compressed stream is a run of marker words, each followed by its literal words: a marker
+//holds the running bit (bit 0), how many words of that bit come first (bits 1-32), and how many
+//literal words follow (bits 33-63); words are stored in host byte order
+class Ewah{
+public:
+    static std::string encode(const std::vector<uint64_t>& words);
+    //OR a compressed bitmap into words; false if the stream is malformed or longer than words
+    static bool decodeOr(std::string_view data, std::vector<uint64_t>& words);
+
+    //bit helpers for plain word bitmaps
+    static void set(std::vector<uint64_t>& words, size_t bit){ words[bit >> 6] |= uint64_t(1) << (bit & 63); }
+    static bool test(const std::vector<uint64_t>& words, size_t bit){ return (words[bit >> 6] >> (bit & 63)) & 1; }
+};
+#endif
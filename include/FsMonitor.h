@@ -0,0 +1,24 @@
+#ifndef FS_MONITOR_H
+#define FS_MONITOR_H
+#include <string>
+#include <vector>
+
+//optional file system monitor: a background process watching the working directory with inotify
+//and journaling every path created, deleted, renamed or written, each under a sequence number
+//commands ask it over .gitlite/fsmonitor.sock what changed since the token they saved with their
+//caches, and only look at those paths; without an answer they scan everything as before
+class FsMonitor{
+public:
+    struct Changes{
+        std::string token;//to ask with next time
+        bool full;//the token was unknown or expired: anything may have changed
+        std::vector<std::string> paths;
+    };
+
+    //start the monitor for the working directory at root in the background
+    static void start(const std::string& root);
+    static void stop(const std::string& root);
+    //false if no monitor answered
+    static bool query(const std::string& root, const std::string& token, Changes& changes);
+};
+#endif
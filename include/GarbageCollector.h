@@ -0,0 +1,29 @@
+#ifndef GARBAGE_COLLECTOR_H
+#define GARBAGE_COLLECTOR_H
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//gc: marks every object reachable from the branches (remote-tracking ones included), the HEAD
+//and stage of every worktree, and deletes unreachable loose objects older than the expiry; with
+//repack, what is kept is written to one pack and the loose files and older packs it replaces
+//are deleted
+//a command running alongside may have written objects it does not refer to yet, so only
+//objects older than the expiry are safe to delete
+class GarbageCollector{
+public:
+    static constexpr int64_t DEFAULT_EXPIRY = 14 * 24 * 3600;
+
+    struct Result{
+        size_t reachable;
+        size_t pruned;
+        size_t packed;
+        uint64_t bytesBefore;//disk space of loose objects and packs
+        uint64_t bytesAfter;
+    };
+
+    //expiry in seconds; 0 deletes every unreachable object. Nothing is deleted if a reachable
+    //object cannot be read
+    static Result collect(int64_t expiry, bool repack, const std::string& repoPath = ".gitlite");
+};
+#endif
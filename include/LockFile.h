@@ -0,0 +1,34 @@
+#ifndef LOCK_FILE_H
+#define LOCK_FILE_H
+#include <string>
+
+//exclusive lock on a repository file: "<path>.lock", created with O_EXCL and holding "pid <n>"
+//of its owner; a lock whose owner has died (or that never got one) is stale and is broken
+//while held, the file can be replaced: the new content goes into the lock file, which is then
+//renamed over the file, so readers without the lock see either the old content or the new
+class LockFile{
+    std::string path;
+    std::string lockPath;
+    int fd;
+
+public:
+    //how long to wait for another process to release the lock
+    static constexpr int TIMEOUT_MS = 10000;
+    //a lock without an owner pid is stale after this long (its owner died before writing it)
+    static constexpr int STALE_SECONDS = 10;
+
+    //wait up to timeoutMs for the lock; GitliteException if it stays held
+    explicit LockFile(const std::string& path, int timeoutMs = TIMEOUT_MS);
+    //release the lock if still held
+    ~LockFile();
+    LockFile(const LockFile&) = delete;
+    LockFile& operator=(const LockFile&) = delete;
+
+    //replace the file with content, releasing the lock
+    void commit(const std::string& content);
+    //delete the file, releasing the lock
+    void remove();
+    //release the lock, leaving the file as it is
+    void release();
+};
+#endif
@@ -0,0 +1,28 @@
+#ifndef MAINTENANCE_H
+#define MAINTENANCE_H
+#include <string>
+#include <cstddef>
+
+//housekeeping that keeps reads fast: loose objects are packed (and the packs merged into one
+//once there are many), a stale commit-graph is rebuilt and the message index log is merged
+//once a commit, fetch or merge succeeds the command line checks the thresholds below (see
+//Repository::scheduleMaintenance), and once one is crossed starts a run in a detached process,
+//so the command never waits for it; a run holds
+//.gitlite/maintenance.lock and saves its report in .gitlite/maintenance.log
+class Maintenance{
+public:
+    static constexpr size_t LOOSE_LIMIT = 1000;//loose objects
+    static constexpr size_t PACK_LIMIT = 20;//packs, before they are merged into one
+    static constexpr size_t INDEX_LOG_LIMIT = 8192;//postings in the message index log
+
+    //why a run is due, or "" if none is; reads a few directories (up to LOOSE_LIMIT entries)
+    //and stats, nothing more
+    static std::string due(const std::string& repoPath = ".gitlite");
+    //start a run in a detached process if one is due and none is running
+    static void schedule(const std::string& repoPath = ".gitlite");
+    //run every task now and return the report; GitliteException if a run is already going on
+    static std::string run(const std::string& reason, const std::string& repoPath = ".gitlite");
+    //report of the last run, "" if there has been none
+    static std::string lastReport(const std::string& repoPath = ".gitlite");
+};
+#endif
@@ -0,0 +1,115 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <memory>
+
+//binary SHA-1 object hash (blob or commit id)
+struct ObjectId{
+    std::array<unsigned char, 20> bytes{};
+
+    static ObjectId fromHex(std::string_view hex);
+    std::string hex() const;
+    bool isNull() const;
+    bool operator==(const ObjectId& other) const { return bytes == other.bytes; }
+    bool operator!=(const ObjectId& other) const { return bytes != other.bytes; }
+};
+
+//interned path strings: equal paths interned in one generation share one address
+//once a generation holds GENERATION_SIZE paths, a new one is started; an old generation is freed
+//with the last manifest, path set or working tree scan holding paths from it, each of which
+//keeps the generations of its paths in a Refs (almost always just one)
+class PathPool{
+    struct Generation;
+
+public:
+    static const size_t GENERATION_SIZE = 1 << 18;
+
+    class Refs{
+        std::vector<std::shared_ptr<const Generation>> generations;
+        void add(const std::shared_ptr<const Generation>& generation);
+        friend class PathPool;
+
+    public:
+        void add(const Refs& other);
+        void clear() { generations.clear(); }
+    };
+
+    //the path stays valid while refs (or a copy of it) is alive
+    static const std::string* intern(std::string_view path, Refs& refs);
+};
+
+//flat file manifest (path -> blob id), entries kept sorted by path in one vector
+class Manifest{
+public:
+    struct Entry{
+        const std::string* path;
+        ObjectId id;
+        const std::string& name() const { return *path; }
+    };
+    typedef std::vector<Entry>::const_iterator const_iterator;
+
+private:
+    std::vector<Entry> entries;
+    PathPool::Refs refs;
+    size_t lowerBound(std::string_view path) const;
+
+public:
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    size_t size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+    const PathPool::Refs& pathRefs() const { return refs; }
+    void clear() { entries.clear(); refs.clear(); }
+    void reserve(size_t n) { entries.reserve(n); }
+
+    const Entry* find(std::string_view path) const;
+    bool contains(std::string_view path) const;
+    void set(std::string_view path, const ObjectId& id);
+    bool erase(std::string_view path);
+    //add a path that sorts after every path already present
+    void append(std::string_view path, const ObjectId& id);
+    //owner is the pathRefs of the manifest, set or scan internedPath comes from
+    void append(const std::string* internedPath, const ObjectId& id, const PathPool::Refs& owner);
+
+    //visit every (interned) path of a and b once, in order; the side missing the path gets nullptr
+    template <typename Visit>
+    static void mergeJoin(const Manifest& a, const Manifest& b, Visit visit){
+        auto i = a.begin(), j = b.begin();
+        while(i != a.end() || j != b.end()){
+            if(j == b.end() || (i != a.end() && i->path != j->path && *i->path < *j->path)){
+                visit(i->path, &i->id, static_cast<const ObjectId*>(nullptr));
+                ++i;
+            }else if(i == a.end() || (i->path != j->path && *j->path < *i->path)){
+                visit(j->path, static_cast<const ObjectId*>(nullptr), &j->id);
+                ++j;
+            }else{
+                visit(i->path, &i->id, &j->id);
+                ++i;
+                ++j;
+            }
+        }
+    }
+};
+
+//sorted set of interned paths
+class PathSet{
+    std::vector<const std::string*> paths;
+    PathPool::Refs refs;
+    size_t lowerBound(std::string_view path) const;
+
+public:
+    typedef std::vector<const std::string*>::const_iterator const_iterator;
+    const_iterator begin() const { return paths.begin(); }
+    const_iterator end() const { return paths.end(); }
+    size_t size() const { return paths.size(); }
+    bool empty() const { return paths.empty(); }
+    void clear() { paths.clear(); refs.clear(); }
+
+    bool contains(std::string_view path) const;
+    void insert(std::string_view path);
+    bool erase(std::string_view path);
+};
+#endif
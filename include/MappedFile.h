@@ -0,0 +1,26 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <string>
+#include <cstddef>
+
+//read-only mmap of a whole file, unmapped on destruction
+class MappedFile{
+    void* addr;
+    size_t length;
+    bool opened;
+
+public:
+    MappedFile() : addr{nullptr}, length{0}, opened{false} {}
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool is_open() const { return opened; }
+    const char* data() const { return static_cast<const char*>(addr); }
+    size_t size() const { return length; }
+};
+#endif
@@ -0,0 +1,35 @@
+#ifndef MESSAGE_INDEX_H
+#define MESSAGE_INDEX_H
+#include <string>
+#include <vector>
+#include <cstdint>
+
+//trigram inverted index over commit messages, keyed by commit-graph row
+//  commit-graph/trigram-index  (trigram, row) pairs sorted by trigram, then row
+//  commit-graph/trigram-log    (trigram, row) pairs of newer commits, in append order
+//the log is merged into the index by maintenance, or by the append that takes it past
+//COMPACT_THRESHOLD pairs
+class MessageIndex{
+public:
+    static const size_t COMPACT_THRESHOLD = 1 << 16;
+    //at most this many posting lists are intersected per query
+    static const size_t MAX_LISTS = 3;
+
+    //trigrams that every message matching the literal must contain
+    static std::vector<uint32_t> trigramsOf(const std::string& literal);
+    //literal runs that every match of the regex must contain (empty if none can be proved)
+    static std::vector<std::string> requiredLiterals(const std::string& regex);
+
+    //rows of the commit-graph that may match, or false if there is no usable index
+    static bool candidates(const std::vector<std::string>& literals, size_t rows, std::vector<uint32_t>& result, const std::string& repoPath = ".gitlite");
+
+    //index the message of a row just appended to the commit-graph (no-op without an index)
+    static void append(const std::string& message, uint32_t row, const std::string& repoPath = ".gitlite");
+    //rewrite the index for all messages of the commit-graph, in row order
+    static void rebuild(const std::vector<std::string>& messages, const std::string& repoPath = ".gitlite");
+    //postings in the log, and merging them into the index (the caller holds commit-graph.lock);
+    //compact returns how many were merged
+    static size_t logSize(const std::string& repoPath = ".gitlite");
+    static size_t compact(const std::string& repoPath = ".gitlite");
+};
+#endif
@@ -0,0 +1,34 @@
+#ifndef OBJECT_STORE_H
+#define OBJECT_STORE_H
+#include <string>
+#include <vector>
+
+//the objects of a repository: loose files in .gitlite/blobs, trees and commits, named by hash,
+//and the packs gc --repack writes to .gitlite/packs; a loose file is read before any pack
+//the repositories listed in .gitlite/alternates (one .gitlite directory per line, relative to
+//this one unless absolute) lend theirs: an object not found here is looked up in them, and in
+//their alternates in turn, but never written to them
+class ObjectStore{
+public:
+    enum Kind : char { BLOB = 'b', TREE = 't', COMMIT = 'c' };
+
+    //directory of the loose objects of a kind
+    static std::string dirOf(Kind kind, const std::string& repoPath = ".gitlite");
+    //the repositories whose objects this one reads, in lookup order
+    static std::vector<std::string> alternates(const std::string& repoPath = ".gitlite");
+    static bool contains(Kind kind, const std::string& hash, const std::string& repoPath = ".gitlite");
+    //whether the repository's own store has the object, leaving out its alternates
+    static bool containsLocally(Kind kind, const std::string& hash, const std::string& repoPath = ".gitlite");
+    //content of an object; throws std::invalid_argument if the repository does not have it
+    static std::string read(Kind kind, const std::string& hash, const std::string& repoPath = ".gitlite");
+    //write an object as a loose file unless the repository already has it; returns whether it wrote
+    static bool write(Kind kind, const std::string& hash, const std::string& content, const std::string& repoPath = ".gitlite");
+    //copy an object to another repository unless it has it already
+    static bool copy(Kind kind, const std::string& hash, const std::string& from, const std::string& to);
+    //hashes of every object of a kind, loose and packed, those of the alternates included, sorted
+    //and without duplicates
+    static std::vector<std::string> list(Kind kind, const std::string& repoPath = ".gitlite");
+    //paths of the repository's own pack files
+    static std::vector<std::string> packFiles(const std::string& repoPath = ".gitlite");
+};
+#endif
@@ -0,0 +1,62 @@
+#ifndef PACK_H
+#define PACK_H
+#include "../include/Manifest.h"
+#include "../include/MappedFile.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+//many objects in one file, written by gc --repack as .gitlite/packs/pack-<id>.pack and read
+//through a mapping: the magic, the object contents back to back, then a table of the objects
+//sorted by (id, kind), each the 20-byte id, a kind byte and the uint64 offset and size of its
+//content, then a trailer of the uint64 table offset, uint32 object count and uint32 CRC-32 of
+//the table (integers in host byte order)
+class Pack{
+public:
+    struct Entry{
+        ObjectId id;
+        char kind;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+private:
+    MappedFile file;
+    const char* table;
+    uint32_t count;
+    bool valid;
+
+public:
+    explicit Pack(const std::string& path);
+
+    bool is_valid() const { return valid; }
+    size_t size() const { return count; }
+    Entry entry(size_t i) const;
+    std::string_view content(const Entry& entry) const;
+    //table index of an object of this kind, false if the pack does not hold it
+    bool lookup(char kind, const ObjectId& id, size_t& index) const;
+    bool find(char kind, const ObjectId& id, std::string_view& content) const;
+    //table indexes in the order the objects were written (the order bitmaps number them in)
+    std::vector<uint32_t> dataOrder() const;
+
+    //streams objects into a temporary file in dir; finish names the pack after its table
+    class Writer{
+        std::string dir;
+        std::string tmpPath;
+        std::ofstream out;
+        std::vector<Entry> entries;
+        uint64_t offset;
+    public:
+        explicit Writer(const std::string& dir);
+        ~Writer();
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+        void add(char kind, const ObjectId& id, std::string_view content);
+        size_t size() const { return entries.size(); }
+        //the path of the finished pack
+        std::string finish();
+    };
+};
+#endif
@@ -6,10 +6,27 @@
 class Pointers{
 public:
     //HEAD
-    static bool is_ref();
-    static std::string get_ref();
+    static bool is_ref(const std::string& repoPath = ".gitlite");
+    static std::string get_ref(const std::string& repoPath = ".gitlite");
     static void set_ref(const std::string& branchname, const std::string& repoPath = ".gitlite");
+    //refs ("HEAD" or "branches/<name>") are changed under their lock, and only if they still hold
+    //expected ("" for a ref that must not exist yet); GitliteException if another process changed it
+    static void updateRef(const std::string& ref, const std::string& value, const std::string& expected, const std::string& repoPath = ".gitlite");
+    static void deleteRef(const std::string& ref, const std::string& expected, const std::string& repoPath = ".gitlite");
+    //one ref update of a transaction
+    struct RefUpdate{
+        std::string ref;
+        std::string value;
+        std::string expected;
+    };
+    //all the updates or none: every ref is locked (in sorted order, so transactions cannot
+    //deadlock) and checked before the first is written
+    static void updateRefs(std::vector<RefUpdate> updates, const std::string& repoPath = ".gitlite");
     //branches
-    static std::vector<std::string> getBranches();
+    //whether a branch name (from a user or a remote) is safe to use as a path under branches/:
+    //not empty, no leading '/', no empty, "." or ".." component, no ".lock" suffix (the lock
+    //file of a branch) and no control characters
+    static bool isValidName(const std::string& branchname);
+    static std::vector<std::string> getBranches(const std::string& repoPath = ".gitlite");
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef REACHABILITY_H
+#define REACHABILITY_H
+#include "../include/ObjectStore.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <functional>
+
+//which objects a set of commits reaches, answered from the reachability bitmaps of a pack (see
+//BitmapIndex) where it has them: the history below a bitmapped commit is never walked, and
+//"reachable from A but not from B" is the bitmap of A AND-NOT the bitmap of B
+//objects outside the bitmapped pack (written since the last repack) are found by walking
+class Reachability{
+public:
+    struct Object{
+        ObjectStore::Kind kind;
+        std::string hash;
+    };
+    //whether the other side of a transfer has an object (and so everything below it)
+    typedef std::function<bool(ObjectStore::Kind, const std::string&)> Known;
+
+    //objects reachable from the commits in wants but not from those in haves, leaving out known
+    //commits and trees with what they reach; walked objects come first, then packed ones in
+    //pack order
+    static std::vector<Object> missing(const std::vector<std::string>& wants, const std::vector<std::string>& haves, const std::string& repoPath = ".gitlite", const Known& known = nullptr);
+    //a fetch into a shallow history (see Shallow): the other side's boundary, and how many
+    //generations below the wants to send (0 for all); the walk fills in the commits to send
+    //without their parents, and the other side's boundary commits it sends the parents of
+    struct Limits{
+        int depth;
+        std::unordered_set<std::string> shallow;
+        std::vector<std::string> boundary;
+        std::vector<std::string> deepened;
+    };
+    static std::vector<Object> missing(const std::vector<std::string>& wants, const std::vector<std::string>& haves, const std::string& repoPath, Limits& limits);
+    //every object reachable from tips
+    static std::vector<Object> reachable(const std::vector<std::string>& tips, const std::string& repoPath = ".gitlite");
+    //whether ancestor is descendant or one of its ancestors
+    static bool isAncestor(const std::string& ancestor, const std::string& descendant, const std::string& repoPath = ".gitlite");
+    //the commits the branches (remote-tracking ones included) and detached HEADs (of linked
+    //worktrees too) point to
+    static std::vector<std::string> refTips(const std::string& repoPath = ".gitlite");
+};
+#endif
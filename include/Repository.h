@@ -5,35 +5,108 @@
 #include "../include/Stage.h"
 #include <string>
 #include <map>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <cstdint>
 
+class WorkingTree;
+class LockFile;
+
+//a repository and its working directory at root; every path a command takes is relative to root
+//commands print to out and report errors by throwing GitliteException, so one process can hold
+//many repositories, each used by one thread at a time
 class Repository{
-    static bool is_initialized();
-    static std::string getHEAD();
-    static Commit getCurrentCommit();
-    static Stage getCurrentStage();
-    static std::map<std::string, int> getUntrackedFiles();
-    static void checkoutCommit(const std::string& hash);//helper function to checkout a commit
+    std::string root;
+    std::string gitliteDir;
+    std::string worktreeDir;//HEAD, stage and scan caches: gitliteDir but in a linked worktree (see Worktree)
+    std::ostream& out;
+    //the last stage parsed, with the file content it came from
+    std::string parsedStageContent;
+    std::unique_ptr<Stage> parsedStage;
+    //the working-directory scan of the running command
+    std::unique_ptr<WorkingTree> workingTree;
+    //held from the first stage change of a command until the outermost command returns
+    std::unique_ptr<LockFile> stageLock;
+    int running;//nesting depth of the running commands
+    bool maintenancePending;//a commit or fetch succeeded since the last scheduleMaintenance
+    bool progress;//push and fetch show their progress on out
+    struct Command;
+
+    std::string workPath(const std::string& filename) const;//a working file, relative to the process
+    std::string remotePath(const std::string& remotename) const;
+    std::string getHEAD() const;
+    std::shared_ptr<const Commit> getCurrentCommit() const;
+    void lockStage();
+    Stage getCurrentStage();
+    void updateHEAD(const std::string& hash, const std::string& old);
+    WorkingTree& scanWorkingTree(const Stage& stage, const Commit& commit);
+    void dropWorkingTree();
+    PathSet getUntrackedFiles();
+    void formatOutput(const std::string& hash, const Commit& commit);
+    void outputBranch(std::string hash);
+    void checkoutCommit(const std::string& hash);//helper function to checkout a commit
+    std::string resolveCommit(const std::string& rev) const;//a branch name or (abbreviated) commit id
 public:
-    static std::string getGitliteDir();
-    static void init();
-    static void add(const std::string& filename);
-    static void rm(const std::string& filename);
-    static void commit(const std::string& message, bool is_merge = false, const std::string& mergeParent = "");
-    static void log();
-    static void globalLog();
-    static void find(const std::string& message);
-    static void checkoutFile(const std::string& filename);
-    static void checkoutFileInCommit(const std::string& hash, const std::string& filename);
-    static void checkoutBranch(const std::string& branchname);
-    static void status();
-    static void branch(const std::string& branchname);
-    static void rmBranch(const std::string& branchname);
-    static void reset(const std::string& hash);
-    static void merge(const std::string& branchname);
-    static void addRemote(const std::string& remotename, const std::string& remotepath);
-    static void rmRemote(const std::string& remotename);
-    static void push(const std::string& remotename, const std::string& branchname);
-    static void fetch(const std::string& remotename, const std::string& branchname);
-    static void pull(const std::string& remotename, const std::string& branchname);
+    //remotes fetch --all transfers from at the same time
+    static const unsigned FETCH_WORKERS = 4;
+
+    explicit Repository(const std::string& root = ".", std::ostream& out = std::cout);
+    ~Repository();
+    Repository(const Repository&) = delete;
+    Repository& operator=(const Repository&) = delete;
+
+    const std::string& getGitliteDir() const;
+    bool isInitialized() const;
+    void init();
+    void add(const std::string& filename);
+    void rm(const std::string& filename);
+    void commit(const std::string& message, bool is_merge = false, const std::string& mergeParent = "");
+    void log();
+    void logPath(const std::string& path, bool stats = false);
+    //each line of a file in HEAD with the commit that introduced it (see Blame)
+    void blame(const std::string& path, bool stats = false);
+    void globalLog();
+    void find(const std::string& message);
+    void findMatching(const std::string& pattern, bool isRegex);
+    void writeCommitGraph();
+    void gc(bool repack, int64_t expiry);
+    void maintenance(const std::string& action);
+    //start maintenance in a detached process if a commit or fetch since the last call made it due
+    //(see Maintenance); commands never do so themselves, since it forks, which a process with
+    //other threads may not survive: the command line calls it once a command has succeeded
+    void scheduleMaintenance();
+    //show the progress of push and fetch on out, as the command line does when out is a terminal
+    void showProgress(bool show);
+    bool showsProgress() const;
+    void checkoutFile(const std::string& filename);
+    void checkoutFileInCommit(const std::string& hash, const std::string& filename);
+    void checkoutBranch(const std::string& branchname);
+    void status();
+    //changes from the stage (or commit from) to the working directory, or from commit from to
+    //commit to, as a unified patch or with stat a diffstat; renames and copies are detected
+    void diff(const std::string& from = "", const std::string& to = "", bool stat = false);
+    void branch(const std::string& branchname);
+    void rmBranch(const std::string& branchname);
+    void reset(const std::string& hash);
+    void merge(const std::string& branchname);
+    void addRemote(const std::string& remotename, const std::string& remotepath);
+    void rmRemote(const std::string& remotename);
+    void push(const std::string& remotename, const std::string& branchname);
+    //with depth, fetch only that many commits down from the branch (see Shallow)
+    void fetch(const std::string& remotename, const std::string& branchname, int depth = 0);
+    //fetch every branch of every remote (or of remotename); all remote-tracking branches are
+    //updated, or none if a transfer fails
+    void fetchAll(const std::string& remotename = "");
+    //make root a new repository with source (a .gitlite directory or remote address) as its
+    //remote origin, fetch all of origin and check out origin/master; with a reference repository,
+    //that one is an alternate (see ObjectStore) and only what it lacks is fetched
+    void clone(const std::string& source, const std::string& reference = "");
+    //a linked worktree at path (see Worktree) with branch checked out
+    void worktreeAdd(const std::string& path, const std::string& branchname);
+    void pull(const std::string& remotename, const std::string& branchname);
+    void fsmonitor(const std::string& action);
+    //"list" the sparse set, "set" it to dirs, or "disable" it (see SparseCheckout)
+    void sparseCheckout(const std::string& action, const std::vector<std::string>& dirs);
 };
 #endif // REPOSITORY_H
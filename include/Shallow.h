@@ -0,0 +1,24 @@
+#ifndef SHALLOW_H
+#define SHALLOW_H
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+
+//the boundary of a history fetched with a depth limit: .gitlite/shallow lists, one hash per
+//line in sorted order, the commits whose parents were not fetched. Such a commit is read as
+//having no parents (see Commit), so log, merge and every walk stop at it
+class Shallow{
+public:
+    typedef std::unordered_set<std::string> Commits;
+
+    //the shallow commits, empty for a complete history; kept per repository until the file changes
+    static std::shared_ptr<const Commits> commits(const std::string& repoPath = ".gitlite");
+    static bool contains(const std::string& hash, const std::string& repoPath = ".gitlite");
+    //after a fetch: the commits in added become shallow and those in removed got their parents;
+    //commits already read are dropped from the commit cache and the commit-graph is rebuilt with
+    //the new boundary, and once a boundary moves down, the reachability bitmaps and the blame
+    //cache (which stop at it) are removed
+    static void update(const std::vector<std::string>& added, const std::vector<std::string>& removed, const std::string& repoPath = ".gitlite");
+};
+#endif
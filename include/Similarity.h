@@ -0,0 +1,31 @@
+#ifndef SIMILARITY_H
+#define SIMILARITY_H
+#include <string_view>
+#include <vector>
+#include <array>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+//content sketches for rename and copy detection: the hashes of a file's lines, and a MinHash
+//signature over the distinct ones (for each of HASHES hash functions, the least value it gives
+//any line). Two files agree on a signature row with a probability equal to the Jaccard index of
+//their line sets, so files agreeing on every row of some band of rows (locality-sensitive
+//hashing) are the likely similar pairs; only those get their score computed, which keeps
+//matching n deleted files against m added ones near n + m instead of n * m
+class Similarity{
+public:
+    static const int HASHES = 64;
+    static const int BANDS = 32;//of HASHES / BANDS rows each
+
+    struct Sketch{
+        std::vector<uint64_t> lines;//hash of every line, sorted
+        std::array<uint64_t, HASHES> signature;
+    };
+    static Sketch sketch(std::string_view content);
+    //percentage of the lines of the longer file that the other one has as well
+    static int score(const Sketch& a, const Sketch& b);
+    //(source, target) index pairs whose signatures agree on a whole band, each pair once
+    static std::vector<std::pair<size_t, size_t>> candidates(const std::vector<const Sketch*>& sources, const std::vector<const Sketch*>& targets);
+};
+#endif
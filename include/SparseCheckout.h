@@ -0,0 +1,29 @@
+#ifndef SPARSE_CHECKOUT_H
+#define SPARSE_CHECKOUT_H
+#include <string>
+#include <vector>
+
+//the paths a working tree materializes, from .gitlite/sparse-checkout: one directory per line,
+//relative to the root ("#" starts a comment); the sparse set is the files at the root and the
+//files under a listed directory. Files outside it stay in commits and the stage but are not
+//written to the working directory, and scans neither enter their directories nor report them
+//without the file every path is in the set
+class SparseCheckout{
+    std::vector<std::string> dirs;//"dir/", sorted, none inside another
+    bool all;
+
+public:
+    //the sparse set of a working tree, from its .gitlite directory
+    static SparseCheckout load(const std::string& dir);
+    explicit SparseCheckout(const std::string& text);
+    SparseCheckout() : all(true) {}
+
+    bool full() const { return all; }
+    //the directories, one per line, as the file is written
+    std::string text() const;
+    //whether a file is in the set
+    bool contains(const std::string& path) const;
+    //whether a directory ("dir/") may hold files of the set, so a scan enters it
+    bool reaches(const std::string& dir) const;
+};
+#endif
@@ -2,25 +2,37 @@
 #define STAGE_H
 #include <string>
 #include <vector>
-#include <map>
-#include <sstream>
+#include "../include/Manifest.h"
+
+//staging area in .gitlite/stage: a base section sorted by path and closed by a checksum, then a
+//journal of the changes made since, appended by each writeStageFile and folded into a new base
+//once it outgrows the base
 class Stage{
-    std::string stageContent;
-    std::map<std::string, std::string> addition;
-    std::map<std::string, int> removal;
+    std::string stagePath;
+    Manifest addition;
+    PathSet removal;
+    std::string journal;//records of changes not written yet
+    bool appendable;//the file is a base and whole records, so the journal can be appended to it
+    size_t baseSize;
+    size_t journalSize;//bytes of journal already in the file
 
+    void record(char op, const std::string& filename, const ObjectId* id);
+    void writeBase();
 
 public:
+    //a journal up to this size is always appended, however small the base
+    static constexpr size_t COMPACT_MIN = 64 * 1024;
+
     //constructor
-    Stage(const std::string& str);
+    Stage(const std::string& str, const std::string& repoPath = ".gitlite");
 
     //get
-    std::map<std::string, std::string> getAdd();
-    std::map<std::string, int> getRm();
-    
+    const Manifest& getAdd() const;
+    const PathSet& getRm() const;
+
 
-    bool is_in_add(const std::string& filename);
-    bool is_in_rm(const std::string& filename);
+    bool is_in_add(const std::string& filename) const;
+    bool is_in_rm(const std::string& filename) const;
 
     void add(const std::string& filename, const std::string& hash);
     void rm(const std::string& filename);
@@ -35,4 +47,4 @@ public:
     //clear stage
     void clear();
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,73 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+#include "../include/Reachability.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <iostream>
+#include <thread>
+#include <sys/types.h>
+
+//the connection push and fetch make to a remote repository: the remote side runs upload-pack
+//(for fetch) or receive-pack (for push) at the other end of a socket, on a thread of this process
+//for a repository directory, or as a command for an "ext::<command>" address ("%s" in the command
+//stands for the service name, e.g. "ext::ssh host gitlite %s repo/.gitlite")
+//the two sides agree on what to send from wants and haves, and the objects travel as one stream
+//in which a changed blob or tree is sent as a delta against its version in the parent commit
+//protocol, one text line per message, an empty line ending a list:
+//  remote  "<hash> <branch>" for each branch, "<hash> .have" for each branch of its alternates
+//          (see ObjectStore), then ""
+//  fetch   client "want <hash>"..., "have <hash>"..., "deepen <depth>" if limited, "shallow <hash>"
+//          for each commit of its shallow boundary, "resume <stream id or -> <count>", "";
+//          remote "shallow <hash>" for each commit it sends without its parents, "unshallow
+//          <hash>" for each boundary commit whose parents it sends, "" and the object stream
+//  push    client "update <old hash or -> <new hash> <branch>", ""; remote "resume <stream id
+//          or -> <count>"; client the object stream; remote "ok" or "error <message>"
+//the receiver journals the objects of a stream as they arrive, and "resume" tells the sender how
+//many of the stream it would send for the same request were received before an interruption
+//object stream (integers in host byte order): "GLSTRM2\n", 20-byte stream id, uint32 object
+//count, uint32 index of the first object sent, each object as kind byte, 20-byte id, 'f' (full)
+//or 'd' (delta, then the 20-byte id of its base), uint32 length and the content or the delta
+//(see Delta), then the CRC-32 of everything before it
+//push and fetch show progress on the stream they are given, if any
+class Transport{
+    struct Connection;
+    struct Journal;
+    std::unique_ptr<Connection> connection;
+    pid_t child;//running the ext:: command, or -1
+    std::thread server;//serving a repository directory
+    std::map<std::string, std::string> refs;//hash by branch
+    std::vector<std::string> alternateTips;//branches of the remote's alternates
+
+    void finish();//wait for the remote side to end
+    static void advertise(Connection& connection, const std::string& repoPath);
+    static void sendObjects(Connection& connection, std::vector<Reachability::Object> objects, const std::string& repoPath, const std::string& resume, std::ostream* progress, const std::vector<std::string>& shallow = {});
+    static void receiveObjects(Connection& connection, const std::string& repoPath, Journal& journal, std::ostream* progress);
+
+public:
+    //a stream of fewer objects is written as loose objects, a longer one as a pack
+    static constexpr size_t UNPACK_LIMIT = 100;
+
+    //start service ("upload-pack" or "receive-pack") for the repository at address and read its
+    //branches; an ext:: command runs in the working directory root
+    Transport(const std::string& address, const std::string& service, const std::string& root = ".");
+    ~Transport();
+    Transport(const Transport&) = delete;
+    Transport& operator=(const Transport&) = delete;
+
+    const std::map<std::string, std::string>& getRefs() const { return refs; }
+    //receive what wants reach into repoPath; haves are commits repoPath has, the remote leaves
+    //out what they reach. With depth, only that many generations from the wants are sent, and
+    //the shallow boundary of repoPath moves to where they stop (see Shallow)
+    void fetch(const std::vector<std::string>& wants, const std::vector<std::string>& haves, const std::string& repoPath = ".gitlite", int depth = 0, std::ostream* progress = nullptr);
+    //send what value reaches and haves do not, and have the remote move branch from expected
+    //("" for a new branch) to value; GitliteException with the remote's message if it refuses, or
+    //if value reaches a shallow commit the remote does not have
+    void push(const std::string& branch, const std::string& expected, const std::string& value, const std::vector<std::string>& haves, const std::string& repoPath = ".gitlite", std::ostream* progress = nullptr);
+
+    //the remote side: serve one client reading fd in and writing fd out
+    static void uploadPack(int in, int out, const std::string& repoPath);
+    static void receivePack(int in, int out, const std::string& repoPath);
+};
+#endif
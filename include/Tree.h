@@ -0,0 +1,75 @@
+#ifndef TREE_H
+#define TREE_H
+#include "../include/Manifest.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+
+//directory tree objects in .gitlite/trees, one per directory, named by the hash of their content
+//each line is "blob <hash> <name>" or "tree <hash> <name>"; lines are sorted so that walking a
+//tree depth-first yields full paths in byte order (a directory sorts as "name/")
+//the empty tree is never written: its id is the null ObjectId
+class Tree{
+public:
+    struct Entry{
+        bool isTree;
+        ObjectId id;
+        std::string name;
+    };
+    typedef std::vector<Entry> Entries;
+
+    //entries of a tree, shared from a per-process cache (tree objects never change)
+    static std::shared_ptr<const Entries> load(const ObjectId& id, const std::string& repoPath = ".gitlite");
+    //write a directory listing (any order) and return its id
+    static ObjectId write(Entries entries, const std::string& repoPath = ".gitlite");
+
+    //write the trees of a whole flat manifest
+    static ObjectId build(const Manifest& files, const std::string& repoPath = ".gitlite");
+    //apply staged changes to a tree; only directories on a changed path are read and rewritten
+    static ObjectId update(const ObjectId& root, const Manifest& addition, const PathSet& removal, const std::string& repoPath = ".gitlite");
+    //blob id of one path, false if the tree does not have it
+    static bool lookup(const ObjectId& root, std::string_view path, ObjectId& id, const std::string& repoPath = ".gitlite");
+    //every file of a tree, in path order
+    static void flatten(const ObjectId& root, Manifest& files, const std::string& repoPath = ".gitlite");
+
+    //visit every file that differs between trees a and b, in path order; the side missing the
+    //file gets nullptr. Subtrees with the same id on both sides are not read
+    template <typename Visit>
+    static void diff(const ObjectId& a, const ObjectId& b, Visit visit, const std::string& repoPath = ".gitlite"){
+        std::string prefix;
+        diffDir(a, b, prefix, visit, repoPath);
+    }
+
+private:
+    static bool entryLess(const Entry& a, const Entry& b);
+
+    template <typename Visit>
+    static void diffDir(const ObjectId& a, const ObjectId& b, std::string& prefix, Visit& visit, const std::string& repoPath){
+        if(a == b) return;
+        std::shared_ptr<const Entries> left = load(a, repoPath), right = load(b, repoPath);
+        static const ObjectId none;
+        size_t length = prefix.size();
+        auto i = left->begin(), j = right->begin();
+        while(i != left->end() || j != right->end()){
+            const Entry* x = nullptr;
+            const Entry* y = nullptr;
+            if(j == right->end() || (i != left->end() && entryLess(*i, *j))) x = &*i++;
+            else if(i == left->end() || entryLess(*j, *i)) y = &*j++;
+            else{
+                x = &*i++;
+                y = &*j++;
+            }
+            const Entry& e = x ? *x : *y;
+            prefix += e.name;
+            if(e.isTree){
+                prefix += '/';
+                diffDir(x ? x->id : none, y ? y->id : none, prefix, visit, repoPath);
+            }else if(!x || !y || x->id != y->id){
+                visit(prefix, x ? &x->id : static_cast<const ObjectId*>(nullptr), y ? &y->id : static_cast<const ObjectId*>(nullptr));
+            }
+            prefix.resize(length);
+        }
+    }
+};
+#endif
@@ -0,0 +1,48 @@
+#ifndef UNTRACKED_CACHE_H
+#define UNTRACKED_CACHE_H
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+
+//directory listings of the last working-directory scan, in .gitlite/untracked-cache
+//a listing is reused while its directory's mtime is unchanged: creating, deleting or renaming
+//an entry always updates the mtime of the directory holding it, while editing a file does not
+//each file is flagged untracked, tracked or ignored; the flags were computed against one stage
+//and HEAD commit (the tracked key) and are recomputed from the names when those differ
+//the whole cache is dropped when .gitliteignore or the sparse set (see SparseCheckout) changes
+class UntrackedCache{
+public:
+    static const char UNTRACKED = 'u';
+    static const char TRACKED = 't';
+    static const char IGNORED = 'i';
+
+    struct Dir{
+        int64_t mtime;//nanoseconds
+        std::vector<std::string> subdirs;//entered by the scan
+        std::vector<std::string> pruned;//ignored subdirectories
+        std::vector<std::pair<std::string, char>> files;//name and flag
+    };
+
+private:
+    std::string path;
+    std::string ignoreHash;
+    std::string trackedKey;
+    bool sameTracked;
+    int64_t writtenAt;//mtime of the cache file; newer listings may miss a same-tick change
+    std::unordered_map<std::string, Dir> dirs;
+
+public:
+    UntrackedCache(const std::string& repoPath, const std::string& ignoreHash, const std::string& trackedKey);
+
+    //listing of a directory ("" for the top, else "dir/") if it is still valid at this mtime
+    const Dir* lookup(const std::string& prefix, int64_t mtime) const;
+    //listing of a directory whatever its mtime, for a directory the file system monitor saw unchanged
+    const Dir* find(const std::string& prefix) const;
+    //whether the cached flags were computed against the current stage and HEAD commit
+    bool flagsValid() const { return sameTracked; }
+    //replace the cache with the listings of this scan
+    void save(const std::vector<std::pair<std::string, Dir>>& scanned) const;
+};
+#endif
@@ -31,7 +31,7 @@ namespace SHA1 {
         SHA();
         std::string sha(std::string message);
     };
-    extern SHA sha;
+    extern thread_local SHA sha;
     std::string sha1(std::string message);
     std::string sha1(std::string s1, std::string s2);
     std::string sha1(std::string s1, std::string s2, std::string s3, std::string s4);
@@ -47,14 +47,21 @@ public:
     static std::string sha1(const std::string& s1, const std::string& s2, 
                           const std::string& s3, const std::string& s4);
     static std::string sha1(const std::vector<unsigned char>& data);
+    // CRC-32 checksum, continued from crc for data in pieces
+    static uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
 
     // File operations
-    static bool restrictedDelete(const std::string& filepath);
+    static bool restrictedDelete(const std::string& filepath, const std::string& root = ".");
     static bool simpleDelete(const std::string& filepath);
     static std::vector<unsigned char> readContents(const std::string& filepath);
     static std::string readContentsAsString(const std::string& filepath);
     static void writeContents(const std::string& filepath, const std::string& content);
     static void writeContents(const std::string& filepath, const std::vector<unsigned char>& content);
+    // Write to a temporary file and rename it over FILEPATH, so readers see the old or new content
+    static void writeContentsAtomically(const std::string& filepath, const std::string& content);
+    static void writeContentsAtomically(const std::string& filepath, const std::vector<unsigned char>& content);
+    // Copy FROM to TO the same way, unless TO exists; returns whether it copied
+    static bool copyFileAtomically(const std::string& from, const std::string& to);
 
     // Directory operations
     static std::vector<std::string> plainFilenamesIn(const std::string& dirPath);
@@ -65,9 +72,8 @@ public:
     // Serialization (simplified for basic types)
     static std::vector<unsigned char> serialize(const std::string& obj);
 
-    // Message and error reporting
-    static void message(const std::string& msg);
-    static void exitWithMessage(const std::string& msg);
+    // Error reporting
+    [[noreturn]] static void exitWithMessage(const std::string& msg);
 
     // File existence check
     static bool exists(const std::string& path);
@@ -0,0 +1,90 @@
+#ifndef WORKING_TREE_H
+#define WORKING_TREE_H
+#include "../include/Manifest.h"
+#include "../include/UntrackedCache.h"
+#include "../include/FsMonitor.h"
+#include "../include/SparseCheckout.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+//one scan of the working directory, shared by everything a command does with it
+//directories are read with getdents64 and their files stat'ed with fstatat relative to the
+//directory fd; subdirectories are spread over a small work-stealing thread pool
+//.gitlite and nested repositories are skipped, and paths matched by .gitliteignore are left out
+//(ignored directories are not entered; tracked files inside them are stat'ed one by one)
+//with a sparse checkout, only the sparse set is looked at (see SparseCheckout)
+//directories unchanged since the last scan are not read again (see UntrackedCache)
+//content ids come from .gitlite/stat-cache while a file's stat data is unchanged
+//with a file system monitor running, only the paths it reports changed are read or stat'ed
+class WorkingTree{
+public:
+    //what the stage and HEAD commit track; key identifies them for the untracked cache
+    struct TrackedFiles{
+        const Manifest& committed;
+        const Manifest& added;
+        const PathSet& removed;
+        std::string key;
+        bool isTracked(const std::string& path) const;
+    };
+    //a tracked file with its stat data, or an untracked file (stat fields are zero)
+    struct File{
+        const std::string* path;
+        int64_t mtime;//nanoseconds
+        uint64_t size;
+        uint64_t ino;
+        bool untracked;
+        const std::string& name() const { return *path; }
+    };
+    //stat data of a file when its content id was computed
+    struct CacheEntry{
+        int64_t mtime;
+        uint64_t size;
+        uint64_t ino;
+        ObjectId id;
+    };
+
+private:
+
+    std::string root;
+    std::vector<File> files;//sorted by path
+    PathPool::Refs refs;//of the paths in files
+    bool cacheLoaded;
+    bool cacheDirty;
+    int64_t cacheTime;//mtime of the stat cache file
+    std::unordered_map<std::string, CacheEntry> statCache;
+    SparseCheckout sparse;
+    UntrackedCache untrackedCache;
+    std::vector<std::pair<std::string, UntrackedCache::Dir>> listings;//of this scan
+    bool listingsDirty;
+    std::string monitorToken;//the caches are valid for this token once saved
+    bool tokenDirty;
+
+    WorkingTree(const std::string& root, const std::string& ignoreText, const TrackedFiles& tracked);
+    void scan(const TrackedFiles& tracked, const std::string& ignoreText, const FsMonitor::Changes* changes);
+    void loadCache();
+    void saveStatCache();
+
+public:
+    //threads used for a scan (the calling thread included)
+    static const unsigned MAX_THREADS = 8;
+
+    //scan the working directory at root (which holds .gitlite); a repository keeps the scan for
+    //one command, and drops it once the command has written working files
+    WorkingTree(const std::string& root, const TrackedFiles& tracked);
+
+    typedef std::vector<File>::const_iterator const_iterator;
+    const_iterator begin() const { return files.begin(); }
+    const_iterator end() const { return files.end(); }
+    size_t size() const { return files.size(); }
+    const PathPool::Refs& pathRefs() const { return refs; }
+    const File* find(std::string_view path) const;
+
+    //content id (blob hash) of a tracked file
+    ObjectId idOf(const File& file);
+    //write .gitlite/stat-cache and .gitlite/untracked-cache if they changed, and the monitor token
+    void saveCache();
+};
+#endif
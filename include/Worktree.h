@@ -0,0 +1,27 @@
+#ifndef WORKTREE_H
+#define WORKTREE_H
+#include <string>
+#include <vector>
+
+//linked working trees (worktree add): the .gitlite directory of one holds only its HEAD, stage
+//and scan caches, and a file "commondir" with the absolute path of the main .gitlite, whose
+//objects, branches, remotes and caches it shares; the main .gitlite lists the linked trees in
+//worktrees/, one file each holding the absolute path of the tree's .gitlite directory
+//a branch is checked out in one working tree at most: a command checks that and moves HEAD to
+//the branch while it holds worktrees.lock in the main .gitlite
+class Worktree{
+public:
+    //the shared .gitlite of the working tree whose .gitlite directory is dir (dir itself unless linked)
+    static std::string commonDir(const std::string& dir);
+    //.gitlite directories of the linked working trees that still exist
+    static std::vector<std::string> linked(const std::string& repoPath = ".gitlite");
+    //.gitlite directory of the working tree, other than the one whose .gitlite directory is self,
+    //that has branch checked out; "" if there is none
+    static std::string holderOf(const std::string& branch, const std::string& self, const std::string& repoPath = ".gitlite");
+    //create the .gitlite directory of a linked working tree at dir, HEAD detached at hash and the
+    //stage empty, and list it in the main .gitlite
+    static void add(const std::string& dir, const std::string& hash, const std::string& repoPath = ".gitlite");
+    //undo add, after a failed first checkout
+    static void remove(const std::string& dir, const std::string& repoPath = ".gitlite");
+};
+#endif
@@ -1,11 +1,16 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <sstream>
+#include <unistd.h>
 #include "include/Repository.h"
 #include "include/Utils.h"
+#include "include/GitliteException.h"
+#include "include/GarbageCollector.h"
+#include "include/Transport.h"
 
-void checkCWD() {
-    if (!Utils::isDirectory(Repository::getGitliteDir())) {
+void checkCWD(const Repository& repo) {
+    if (!repo.isInitialized()) {
         Utils::exitWithMessage("Not in an initialized Gitlite directory.");
     }
 }
@@ -22,57 +27,110 @@ void checkArgsNum(const std::vector<std::string>& args, int n) {
     }
 }
 
-int main(int argc, char* argv[]) {
-    std::vector<std::string> args;
-    for (int i = 1; i < argc; ++i) {
-        args.push_back(std::string(argv[i]));
-    }
-    
+//run one command; errors are thrown as GitliteException
+//returns false if there is no such command
+bool runCommand(Repository& bloop, const std::vector<std::string>& args) {
     checkNoArgs(args);
-    Repository bloop;
     std::string firstArg = args[0];
     
     if (firstArg == "init") {
         checkArgsNum(args, 1);
         bloop.init();
     } else if (firstArg == "add-remote") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 3);
         bloop.addRemote(args[1], args[2]);
     } else if (firstArg == "rm-remote") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.rmRemote(args[1]);
     } else if (firstArg == "add") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.add(args[1]);
     } else if (firstArg == "commit") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.commit(args[1]);
     } else if (firstArg == "rm") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.rm(args[1]);
     } else if (firstArg == "log") {
-        checkCWD();
-        checkArgsNum(args, 1);
-        bloop.log();
+        checkCWD(bloop);
+        if (args.size() == 3 && args[1] == "--") {
+            bloop.logPath(args[2]);
+        } else if (args.size() == 4 && args[1] == "--stats" && args[2] == "--") {
+            bloop.logPath(args[3], true);
+        } else {
+            checkArgsNum(args, 1);
+            bloop.log();
+        }
     } else if (firstArg == "global-log") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 1);
         bloop.globalLog();
     } else if (firstArg == "find") {
-        checkCWD();
+        checkCWD(bloop);
+        if (args.size() == 3 && args[1] == "--grep") {
+            bloop.findMatching(args[2], true);
+        } else if (args.size() == 3 && args[1] == "--substring") {
+            bloop.findMatching(args[2], false);
+        } else {
+            checkArgsNum(args, 2);
+            bloop.find(args[1]);
+        }
+    } else if (firstArg == "commit-graph") {
+        checkCWD(bloop);
+        checkArgsNum(args, 2);
+        if (args[1] != "write") {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+        bloop.writeCommitGraph();
+    } else if (firstArg == "gc") {
+        checkCWD(bloop);
+        bool repack = false;
+        int64_t expiry = GarbageCollector::DEFAULT_EXPIRY;
+        for (size_t i = 1; i < args.size(); ++i) {
+            if (args[i] == "--repack") {
+                repack = true;
+            } else if (args[i] == "--prune=now") {
+                expiry = 0;
+            } else if (args[i].compare(0, 8, "--prune=") == 0 && args[i].size() > 8 && args[i].size() <= 26
+                       && args[i].find_first_not_of("0123456789", 8) == std::string::npos) {
+                expiry = std::stoll(args[i].substr(8));
+            } else {
+                Utils::exitWithMessage("Incorrect operands.");
+            }
+        }
+        bloop.gc(repack, expiry);
+    } else if (firstArg == "maintenance") {
+        checkCWD(bloop);
         checkArgsNum(args, 2);
-        bloop.find(args[1]);
+        bloop.maintenance(args[1]);
     } else if (firstArg == "status") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 1);
         bloop.status();
+    } else if (firstArg == "blame") {
+        checkCWD(bloop);
+        if (args.size() == 3 && args[1] == "--stats") {
+            bloop.blame(args[2], true);
+        } else {
+            checkArgsNum(args, 2);
+            bloop.blame(args[1]);
+        }
+    } else if (firstArg == "diff") {
+        checkCWD(bloop);
+        bool stat = args.size() > 1 && args[1] == "--stat";
+        std::vector<std::string> revs(args.begin() + (stat ? 2 : 1), args.end());
+        if (revs.size() > 2) {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+        revs.resize(2);
+        bloop.diff(revs[0], revs[1], stat);
     } else if (firstArg == "checkout") {
-        checkCWD();
+        checkCWD(bloop);
         if (args.size() == 2) {
             bloop.checkoutBranch(args[1]);
         } else if (args.size() == 3) {
@@ -89,37 +147,170 @@ int main(int argc, char* argv[]) {
             Utils::exitWithMessage("Incorrect operands.");
         }
     } else if (firstArg == "branch") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.branch(args[1]);
     } else if (firstArg == "rm-branch") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.rmBranch(args[1]);
     } else if (firstArg == "reset") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.reset(args[1]);
     } else if (firstArg == "merge") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 2);
         bloop.merge(args[1]);
     } else if (firstArg == "push") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 3);
         bloop.push(args[1], args[2]);
     } else if (firstArg == "fetch") {
-        checkCWD();
-        checkArgsNum(args, 3);
-        bloop.fetch(args[1], args[2]);
+        checkCWD(bloop);
+        if ((args.size() == 2 || args.size() == 3) && args[1] == "--all") {
+            bloop.fetchAll(args.size() == 3 ? args[2] : "");
+        } else if (args.size() == 5 && args[1] == "--depth") {
+            if (args[2].empty() || args[2].size() > 9 || args[2].find_first_not_of("0123456789") != std::string::npos
+                || std::stoi(args[2]) == 0) {
+                Utils::exitWithMessage("Incorrect operands.");
+            }
+            bloop.fetch(args[3], args[4], std::stoi(args[2]));
+        } else {
+            checkArgsNum(args, 3);
+            bloop.fetch(args[1], args[2]);
+        }
+    } else if (firstArg == "clone") {
+        bool reference = args.size() == 5 && args[3] == "--reference";
+        if (!reference) checkArgsNum(args, 3);
+        Repository target(args[2]);
+        target.showProgress(bloop.showsProgress());
+        if (reference) {
+            target.clone(args[1], args[4]);
+        } else {
+            target.clone(args[1]);
+        }
+    } else if (firstArg == "worktree") {
+        checkCWD(bloop);
+        if (args.size() != 4 || args[1] != "add") {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+        bloop.worktreeAdd(args[2], args[3]);
     } else if (firstArg == "pull") {
-        checkCWD();
+        checkCWD(bloop);
         checkArgsNum(args, 3);
         bloop.pull(args[1], args[2]);
+    } else if (firstArg == "sparse-checkout") {
+        checkCWD(bloop);
+        if (args.size() < 2) {
+            Utils::exitWithMessage("Incorrect operands.");
+        }
+        bloop.sparseCheckout(args[1], std::vector<std::string>(args.begin() + 2, args.end()));
+    } else if (firstArg == "fsmonitor") {
+        checkCWD(bloop);
+        checkArgsNum(args, 2);
+        bloop.fsmonitor(args[1]);
     } else {
         std::cout << "No command with that name exists." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//split a batch line into arguments: whitespace separates them, and single or double quotes
+//group them (a backslash escapes the next character inside double quotes and outside quotes)
+std::vector<std::string> splitCommand(const std::string& line) {
+    std::vector<std::string> args;
+    std::string arg;
+    bool inArg = false;
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); ++i) {
+        char c = line[i];
+        if (quote) {
+            if (c == quote) {
+                quote = 0;
+            } else if (c == '\\' && quote == '"' && i + 1 < line.size()) {
+                arg += line[++i];
+            } else {
+                arg += c;
+            }
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            if (inArg) args.push_back(arg);
+            arg.clear();
+            inArg = false;
+        } else {
+            inArg = true;
+            if (c == '"' || c == '\'') {
+                quote = c;
+            } else if (c == '\\' && i + 1 < line.size()) {
+                arg += line[++i];
+            } else {
+                arg += c;
+            }
+        }
+    }
+    if (inArg) args.push_back(arg);
+    return args;
+}
+
+//--batch: one command per line on stdin, each answered on stdout with "ok <length>" or
+//"error <length>" and then that many bytes of output
+//commits, trees and the parsed stage stay cached from one command to the next (each cache is
+//bounded, and interned paths are freed with the last of them holding them), while the working
+//directory is scanned again for each command
+void runBatch() {
+    Repository repo(".");
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::ostringstream out;
+        std::streambuf* saved = std::cout.rdbuf(out.rdbuf());
+        bool ok;
+        try {
+            ok = runCommand(repo, splitCommand(line));
+        } catch (const GitliteException& e) {
+            std::cout << e.what() << std::endl;
+            ok = false;
+        } catch (const std::exception& e) {
+            std::cout << e.what() << std::endl;
+            ok = false;
+        }
+        std::cout.rdbuf(saved);
+        std::string result = out.str();
+        std::cout << (ok ? "ok " : "error ") << result.size() << "\n" << result;
+        std::cout.flush();
+        if (ok) repo.scheduleMaintenance();
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        args.push_back(std::string(argv[i]));
+    }
+
+    if (args.size() == 1 && args[0] == "--batch") {
+        runBatch();
         return 0;
     }
-    
+    //the remote side of push and fetch, speaking the protocol on stdin and stdout
+    if (args.size() == 2 && (args[0] == "upload-pack" || args[0] == "receive-pack")) {
+        try {
+            if (args[0] == "upload-pack") {
+                Transport::uploadPack(0, 1, args[1]);
+            } else {
+                Transport::receivePack(0, 1, args[1]);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+        return 0;
+    }
+    try {
+        Repository repo(".");
+        repo.showProgress(isatty(1));
+        if (runCommand(repo, args)) repo.scheduleMaintenance();
+    } catch (const GitliteException& e) {
+        std::cout << e.what() << std::endl;
+    }
     return 0;
 }
@@ -0,0 +1,212 @@
+#include "../include/Utils.h"
+#include "../include/BitmapIndex.h"
+#include "../include/Ewah.h"
+#include "../include/Commit.h"
+#include "../include/Tree.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdint>
+
+static const char MAGIC[] = "GLBITMP1";
+static const size_t MAGIC_SIZE = 8;
+
+static void putU32(std::string& out, uint32_t value){
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+static bool readU32(std::string_view in, size_t& pos, uint32_t& value){
+    if(in.size() - pos < sizeof(value)) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+std::string BitmapIndex::pathOf(const std::string& packPath){
+    return packPath.substr(0, packPath.size() - 5) + ".bitmap";
+}
+
+BitmapIndex::BitmapIndex(const std::string& packPath, const Pack& pack) : file(pathOf(packPath)), pack(pack), valid{false} {
+    if(!file.is_open() || !pack.is_valid() || file.size() < MAGIC_SIZE + 4) return;
+    std::string_view data(file.data(), file.size() - 4);
+    uint32_t crc;
+    std::memcpy(&crc, file.data() + data.size(), 4);
+    if(data.compare(0, MAGIC_SIZE, MAGIC) != 0 || Utils::crc32(data.data(), data.size()) != crc) return;
+    size_t pos = MAGIC_SIZE;
+    uint32_t objects, count;
+    if(!readU32(data, pos, objects) || !readU32(data, pos, count) || objects != pack.size()) return;
+    order.resize(objects);
+    positions.assign(objects, objects);
+    for(uint32_t p = 0; p < objects; p++){
+        if(!readU32(data, pos, order[p]) || order[p] >= objects || positions[order[p]] != objects) return;
+        positions[order[p]] = p;
+    }
+    for(uint32_t i = 0; i < count; i++){
+        uint32_t commit, length;
+        if(!readU32(data, pos, commit) || !readU32(data, pos, length) || commit >= objects || data.size() - pos < length) return;
+        bitmaps[commit] = data.substr(pos, length);
+        pos += length;
+    }
+    valid = pos == data.size();
+}
+
+bool BitmapIndex::position(char kind, const ObjectId& id, uint32_t& pos) const{
+    size_t index;
+    if(!valid || !pack.lookup(kind, id, index)) return false;
+    pos = positions[index];
+    return true;
+}
+
+bool BitmapIndex::orBitmap(uint32_t pos, std::vector<uint64_t>& words) const{
+    auto it = bitmaps.find(pos);
+    return it != bitmaps.end() && Ewah::decodeOr(it->second, words);
+}
+
+//builds the bitmaps of one pack; every object reachable from a bitmapped commit must be in it
+struct BitmapBuilder{
+    const Pack& pack;
+    const std::string& repoPath;
+    const BitmapIndex* old;
+    std::vector<uint32_t> positions;//by table index
+    std::unordered_map<uint32_t, std::string> computed;//by commit position
+    std::vector<uint32_t> renumber;//position in this pack by position in old, made on first use
+
+    static constexpr uint32_t MISSING = UINT32_MAX;
+
+    bool position(char kind, const ObjectId& id, uint32_t& pos) const{
+        size_t index;
+        if(!pack.lookup(kind, id, index)) return false;
+        pos = positions[index];
+        return true;
+    }
+    //a set tree bit means the whole tree is set, so it is not entered again
+    bool markTree(const ObjectId& id, std::vector<uint64_t>& words){
+        uint32_t pos;
+        if(id.isNull()) return true;
+        if(!position('t', id, pos)) return false;
+        if(Ewah::test(words, pos)) return true;
+        for(auto& entry : *Tree::load(id, repoPath)){
+            if(entry.isTree){
+                if(!markTree(entry.id, words)) return false;
+            }else{
+                uint32_t blob;
+                if(!position('b', entry.id, blob)) return false;
+                Ewah::set(words, blob);
+            }
+        }
+        Ewah::set(words, pos);
+        return true;
+    }
+    //OR the bitmap old has for a commit, renumbered for this pack
+    bool reuse(const ObjectId& id, std::vector<uint64_t>& words){
+        uint32_t oldPos;
+        if(!old || !old->position('c', id, oldPos)) return false;
+        std::vector<uint64_t> oldWords(old->size() / 64 + 1);
+        if(!old->orBitmap(oldPos, oldWords)) return false;
+        if(renumber.empty()){
+            renumber.assign(old->size(), MISSING);
+            for(uint32_t p = 0; p < old->size(); p++){
+                Pack::Entry entry = old->entryAt(p);
+                position(entry.kind, entry.id, renumber[p]);
+            }
+        }
+        std::vector<uint32_t> found;
+        for(size_t w = 0; w < oldWords.size(); w++){
+            for(uint64_t bits = oldWords[w]; bits; bits &= bits - 1){
+                uint32_t pos = renumber[w * 64 + __builtin_ctzll(bits)];
+                if(pos == MISSING) return false;
+                found.push_back(pos);
+            }
+        }
+        for(uint32_t pos : found) Ewah::set(words, pos);
+        return true;
+    }
+    //everything reachable from one commit, stopping at commits already bitmapped
+    bool build(uint32_t start, const ObjectId& startId, std::vector<uint64_t>& words){
+        std::vector<std::pair<uint32_t, ObjectId>> stack{{start, startId}};
+        while(!stack.empty()){
+            uint32_t pos = stack.back().first;
+            ObjectId id = stack.back().second;
+            stack.pop_back();
+            if(Ewah::test(words, pos)) continue;
+            auto it = computed.find(pos);
+            if(pos != start && it != computed.end()){
+                Ewah::decodeOr(it->second, words);
+                continue;
+            }
+            if(reuse(id, words)) continue;
+            Ewah::set(words, pos);
+            std::shared_ptr<const Commit> commit = Commit::load(id.hex(), repoPath);
+            if(!markTree(commit->getTree(), words)) return false;
+            for(auto& parent : commit->getParents()){
+                ObjectId parentId = ObjectId::fromHex(parent);
+                uint32_t parentPos;
+                if(!position('c', parentId, parentPos)) return false;
+                stack.push_back({parentPos, parentId});
+            }
+        }
+        return true;
+    }
+};
+
+void BitmapIndex::write(const std::string& packPath, const std::vector<std::string>& tips, const std::string& repoPath, const std::vector<std::string>& oldPacks){
+    Pack pack(packPath);
+    if(!pack.is_valid()) return;
+    std::unique_ptr<Pack> oldPack;
+    std::unique_ptr<BitmapIndex> old;
+    for(auto& path : oldPacks){
+        if(!Utils::isFile(pathOf(path))) continue;
+        oldPack.reset(new Pack(path));
+        old.reset(new BitmapIndex(path, *oldPack));
+        if(old->is_valid()) break;
+        old.reset();
+    }
+    uint32_t objects = static_cast<uint32_t>(pack.size());
+    std::vector<uint32_t> order = pack.dataOrder();
+    BitmapBuilder builder{pack, repoPath, old.get(), std::vector<uint32_t>(objects), {}, {}};
+    for(uint32_t p = 0; p < objects; p++) builder.positions[order[p]] = p;
+
+    //the tips, and every SPACING-th commit in pack order
+    std::unordered_set<uint32_t> chosen;
+    size_t commits = 0;
+    for(uint32_t p = 0; p < objects; p++){
+        if(pack.entry(order[p]).kind == 'c' && commits++ % SPACING == 0) chosen.insert(p);
+    }
+    for(auto& tip : tips){
+        uint32_t pos;
+        if(tip.size() == Utils::UID_LENGTH && builder.position('c', ObjectId::fromHex(tip), pos)) chosen.insert(pos);
+    }
+    //oldest first, so most walks stop at a bitmap built just before
+    std::vector<std::pair<time_t, uint32_t>> selected;
+    for(uint32_t pos : chosen){
+        selected.push_back({Commit::load(pack.entry(order[pos]).id.hex(), repoPath)->getTimestamp(), pos});
+    }
+    std::sort(selected.begin(), selected.end());
+
+    //a commit whose history is not all in the pack (an unreachable one gc kept) gets no bitmap
+    std::vector<uint32_t> built;
+    for(auto& item : selected){
+        uint32_t pos = item.second;
+        std::vector<uint64_t> words(objects / 64 + 1);
+        if(!builder.build(pos, pack.entry(order[pos]).id, words)) continue;
+        builder.computed[pos] = Ewah::encode(words);
+        built.push_back(pos);
+    }
+
+    std::string content(MAGIC, MAGIC_SIZE);
+    putU32(content, objects);
+    putU32(content, static_cast<uint32_t>(built.size()));
+    for(uint32_t index : order) putU32(content, index);
+    for(uint32_t pos : built){
+        const std::string& bitmap = builder.computed[pos];
+        putU32(content, pos);
+        putU32(content, static_cast<uint32_t>(bitmap.size()));
+        content += bitmap;
+    }
+    putU32(content, Utils::crc32(content.data(), content.size()));
+    Utils::writeContentsAtomically(pathOf(packPath), content);
+}
@@ -0,0 +1,195 @@
+#include "../include/Utils.h"
+#include "../include/Blame.h"
+#include "../include/Diff.h"
+#include "../include/Commit.h"
+#include "../include/CommitGraph.h"
+#include "../include/BloomFilter.h"
+#include "../include/Tree.h"
+#include "../include/Blob.h"
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <sstream>
+#include <stdexcept>
+
+static std::string cacheDir(const std::string& repoPath){
+    return Utils::join(repoPath, "blame-cache");
+}
+//commit ids have a fixed length, so commit and path cannot run into each other
+static std::string cachePath(const std::string& commit, const std::string& path, const std::string& repoPath){
+    return Utils::join(cacheDir(repoPath), Utils::sha1(commit, path));
+}
+
+//"blame <lines> <path>", then one "<commit> <first line> <count>" line per run of lines from
+//consecutive lines of one commit
+static std::shared_ptr<const Blame::Lines> readCache(const std::string& commit, const std::string& path, const std::string& repoPath){
+    std::string content;
+    try{
+        content = Utils::readContentsAsString(cachePath(commit, path, repoPath));
+    }catch(const std::invalid_argument&){//not cached
+        return nullptr;
+    }
+    std::istringstream in(content);
+    std::string word, name;
+    size_t count;
+    if(!(in >> word >> count) || word != "blame" || in.get() != ' ' || !std::getline(in, name) || name != path) return nullptr;
+    auto lines = std::make_shared<Blame::Lines>();
+    lines->reserve(count);
+    std::string hex;
+    uint32_t first;
+    size_t run;
+    while(in >> hex >> first >> run){
+        if(hex.size() != Utils::UID_LENGTH || run > count - lines->size()) return nullptr;
+        ObjectId id = ObjectId::fromHex(hex);
+        for(size_t k = 0; k < run; k++) lines->push_back({id, static_cast<uint32_t>(first + k)});
+    }
+    if(lines->size() != count) return nullptr;
+    return lines;
+}
+static void writeCache(const std::string& commit, const std::string& path, const Blame::Lines& lines, const std::string& repoPath){
+    std::string content = "blame " + std::to_string(lines.size()) + " " + path + "\n";
+    for(size_t i = 0; i < lines.size();){
+        size_t j = i + 1;
+        while(j < lines.size() && lines[j].commit == lines[i].commit && lines[j].line == lines[i].line + (j - i)) j++;
+        content += lines[i].commit.hex() + " " + std::to_string(lines[i].line) + " " + std::to_string(j - i) + "\n";
+        i = j;
+    }
+    Utils::createDirectories(cacheDir(repoPath));
+    Utils::writeContentsAtomically(cachePath(commit, path, repoPath), content);
+}
+
+namespace{
+struct Walk{
+    const std::string& path;
+    const std::string& repoPath;
+    Blame::Stats& stats;
+    CommitGraph graph;
+    BloomFilter::Key key;
+    std::unordered_map<std::string, std::shared_ptr<const Blame::Lines>> done;
+
+    Walk(const std::string& path, const std::string& repoPath, Blame::Stats& stats)
+        : path{path}, repoPath{repoPath}, stats{stats}, graph{CommitGraph::open(repoPath)}, key{BloomFilter::keyFor(path)} {}
+
+    std::vector<std::string> parentsOf(const std::string& hash, bool& unchanged){
+        size_t row;
+        if(graph.findRow(hash, row)){
+            //a filter that rules the path out means the first parent has the same blob
+            unchanged = !graph.mayHaveChanged(row, key);
+            return graph.getParents(row);
+        }
+        unchanged = false;
+        return Commit::load(hash, repoPath)->getParents();
+    }
+    bool blobOf(const std::string& hash, ObjectId& id){
+        return Tree::lookup(Commit::load(hash, repoPath)->getTree(), path, id, repoPath);
+    }
+    //the commit that introduced the version of the file hash has: parents with the same blob are
+    //followed down
+    std::string introOf(std::string hash, const ObjectId& blob){
+        while(true){
+            stats.walked++;
+            bool unchanged;
+            std::vector<std::string> parents = parentsOf(hash, unchanged);
+            if(parents.empty()) return hash;
+            if(unchanged){
+                stats.skipped++;
+                hash = parents[0];
+                continue;
+            }
+            bool same = false;
+            for(auto& parent : parents){
+                ObjectId id;
+                if(blobOf(parent, id) && id == blob){
+                    hash = parent;
+                    same = true;
+                    break;
+                }
+            }
+            if(!same) return hash;
+        }
+    }
+
+    //the version introduced at each commit is blamed once its parents' versions are, depth first
+    //with an explicit stack, since a history can hold more versions of a file than the call stack
+    std::shared_ptr<const Blame::Lines> blame(const std::string& top, const ObjectId& topBlob){
+        struct Version{
+            std::string commit;
+            ObjectId blob;
+            bool expanded;
+            std::vector<std::pair<std::string, ObjectId>> parents;//the parents' versions
+        };
+        std::vector<Version> stack{{top, topBlob, false, {}}};
+        while(!stack.empty()){
+            if(done.count(stack.back().commit)){
+                stack.pop_back();
+                continue;
+            }
+            if(!stack.back().expanded){
+                Version& version = stack.back();
+                if(auto cached = readCache(version.commit, path, repoPath)){
+                    stats.cached++;
+                    done[version.commit] = cached;
+                    stack.pop_back();
+                    continue;
+                }
+                version.expanded = true;
+                bool unchanged;
+                for(auto& parent : parentsOf(version.commit, unchanged)){
+                    ObjectId id;
+                    if(blobOf(parent, id)) version.parents.push_back({introOf(parent, id), id});
+                }
+                std::vector<std::pair<std::string, ObjectId>> parents = version.parents;
+                for(auto& parent : parents){
+                    if(!done.count(parent.first)) stack.push_back({parent.first, parent.second, false, {}});
+                }
+                continue;
+            }
+            Version version = std::move(stack.back());
+            stack.pop_back();
+            stats.diffed++;
+            std::string content = Blob::readBlobContentsAsString(version.blob.hex(), repoPath);
+            std::vector<std::string_view> lines = Diff::splitLines(content);
+            ObjectId self = ObjectId::fromHex(version.commit);
+            auto result = std::make_shared<Blame::Lines>();
+            result->reserve(lines.size());
+            for(size_t j = 0; j < lines.size(); j++) result->push_back({self, static_cast<uint32_t>(j + 1)});
+            std::vector<bool> passed(lines.size(), false);
+            for(auto& parent : version.parents){
+                std::string parentContent = Blob::readBlobContentsAsString(parent.second.hex(), repoPath);
+                std::vector<std::string_view> parentLines = Diff::splitLines(parentContent);
+                Diff::Script script = Diff::compare(parentLines, lines);
+                const Blame::Lines& origins = *done.at(parent.first);
+                for(size_t i = 0, j = 0; i < parentLines.size() || j < lines.size();){
+                    if(i < parentLines.size() && script.deleted[i]) i++;
+                    else if(j < lines.size() && script.inserted[j]) j++;
+                    else{
+                        if(!passed[j]){
+                            (*result)[j] = origins[i];
+                            passed[j] = true;
+                        }
+                        i++;
+                        j++;
+                    }
+                }
+            }
+            //only the version asked for is saved: the next blame stops at it, and writing every
+            //version of a long history would cost more than diffing it
+            if(version.commit == top) writeCache(version.commit, path, *result, repoPath);
+            done[version.commit] = result;
+        }
+        return done.at(top);
+    }
+};
+}
+
+std::shared_ptr<const Blame::Lines> Blame::of(const std::string& commit, const std::string& path, Stats& stats, const std::string& repoPath){
+    Walk walk(path, repoPath, stats);
+    ObjectId blob;
+    if(!walk.blobOf(commit, blob)) return std::make_shared<const Lines>();
+    return walk.blame(walk.introOf(commit, blob), blob);
+}
+
+void Blame::clearCache(const std::string& repoPath){
+    std::string dir = cacheDir(repoPath);
+    for(auto& name : Utils::plainFilenamesIn(dir)) Utils::simpleDelete(Utils::join(dir, name));
+}
@@ -1,23 +1,20 @@
 #include "../include/Utils.h"
 #include "../include/Blob.h"
+#include "../include/ObjectStore.h"
 #include <string>
 #include <vector>
 
-void Blob::createBlob(const std::vector<unsigned char>& blobContent){
+void Blob::createBlob(const std::vector<unsigned char>& blobContent, const std::string& repoPath){
     std::string hash = Utils::sha1(blobContent);
-    std::string path = Utils::join(".gitlite/blobs/", hash);
-    //if there is already a same blob
-    if(Utils::isFile(path)) return;
-    //write content
-    Utils::writeContents(path, blobContent);
+    //written unless there is already a same blob
+    ObjectStore::write(ObjectStore::BLOB, hash, std::string(blobContent.begin(), blobContent.end()), repoPath);
 }
 
-std::vector<unsigned char> Blob::readBlobContents(const std::string& blobHash){
-    std::string path = Utils::join(".gitlite/blobs/", blobHash);
-    return Utils::readContents(path);
+std::vector<unsigned char> Blob::readBlobContents(const std::string& blobHash, const std::string& repoPath){
+    std::string content = ObjectStore::read(ObjectStore::BLOB, blobHash, repoPath);
+    return std::vector<unsigned char>(content.begin(), content.end());
 }
 
-std::string Blob::readBlobContentsAsString(const std::string& blobHash){
-    std::string path = Utils::join(".gitlite/blobs/", blobHash);
-    return Utils::readContentsAsString(path);
-}
\ No newline at end of file
+std::string Blob::readBlobContentsAsString(const std::string& blobHash, const std::string& repoPath){
+    return ObjectStore::read(ObjectStore::BLOB, blobHash, repoPath);
+}
@@ -0,0 +1,45 @@
+#include "../include/BloomFilter.h"
+#include <string>
+#include <vector>
+
+BloomFilter::Key BloomFilter::keyFor(const std::string& path){
+    //64-bit FNV-1a, then a murmur3 finalizer to spread the bits
+    uint64_t h = 1469598103934665603ULL;
+    for(unsigned char c : path){
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    //an odd step visits distinct bits for every power-of-two sized filter
+    return {static_cast<uint32_t>(h), static_cast<uint32_t>(h >> 32) | 1};
+}
+
+std::string BloomFilter::build(const std::vector<std::string>& paths){
+    if(paths.size() > MAX_PATHS) return "";
+    //bit count is a power of two of at least 64 bits
+    size_t bits = 64;
+    while(bits < paths.size() * BITS_PER_PATH) bits <<= 1;
+    std::string filter(bits / 8, '\0');
+    for(auto& path : paths){
+        Key key = keyFor(path);
+        for(uint32_t i = 0; i < NUM_HASHES; i++){
+            size_t bit = (key.h1 + i * key.h2) & (bits - 1);
+            filter[bit / 8] = static_cast<char>(filter[bit / 8] | (1 << (bit % 8)));
+        }
+    }
+    return filter;
+}
+
+bool BloomFilter::mayContain(const char* filter, size_t size, const Key& key){
+    if(size == 0) return true;
+    size_t bits = size * 8;
+    for(uint32_t i = 0; i < NUM_HASHES; i++){
+        size_t bit = (key.h1 + i * key.h2) & (bits - 1);
+        if(!(static_cast<unsigned char>(filter[bit / 8]) & (1 << (bit % 8)))) return false;
+    }
+    return true;
+}
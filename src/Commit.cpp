@@ -1,35 +1,119 @@
 #include "../include/Utils.h"
 #include "../include/Commit.h"
+#include "../include/CommitGraph.h"
+#include "../include/Tree.h"
+#include "../include/ObjectStore.h"
+#include "../include/Shallow.h"
 #include <string>
 #include <ctime>
 #include <chrono>
 #include <vector>
-#include <map>
-#include <sstream>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdlib>
 
 //constructor from hash
-Commit::Commit(const std::string& commitHash, const std::string& repoPath){
+//header fields are parsed now; the file list is only located, and read on first use
+//a shallow commit (see Shallow) is read without its parents
+Commit::Commit(const std::string& commitHash, const std::string& repoPath) : timestamp{0}, repoPath{repoPath}, filesParsed{false} {
     hash = commitHash;
-    std::string path = Utils::join(repoPath, "commits", commitHash);
-    std::string commitStr = Utils::readContentsAsString(path);
-    size_t posn = commitStr.find("\n");
-    message = commitStr.substr(9, posn - 9);//"message: " length is 9
-    std::istringstream stream(commitStr.substr(posn + 1));
-    std::string first;
-    while(stream >> first){
-        std::string second;
-        if(first == "timestamp:"){
-            stream >> second;
-            long long secondll = std::stoll(second);
-            timestamp = static_cast<time_t>(secondll);
-        }else if(first == "parent:"){
-            stream >> second;
-            parents.push_back(second);
+    buffer = std::make_shared<const std::string>(ObjectStore::read(ObjectStore::COMMIT, commitHash, repoPath));
+    std::string_view content(*buffer);
+    size_t posn = content.find('\n');
+    if(posn == std::string_view::npos) posn = content.size();
+    message = content.substr(9, posn - 9);//"message: " length is 9
+    size_t pos = posn < content.size() ? posn + 1 : content.size();
+    while(pos < content.size()){
+        size_t eol = content.find('\n', pos);
+        if(eol == std::string_view::npos) eol = content.size();
+        std::string_view line = content.substr(pos, eol - pos);
+        if(line.substr(0, 11) == "timestamp: "){
+            timestamp = static_cast<time_t>(std::strtoll(line.data() + 11, nullptr, 10));
+        }else if(line.substr(0, 8) == "parent: "){
+            parents.push_back(std::string(line.substr(8)));
+        }else if(line.substr(0, 6) == "tree: "){
+            tree = ObjectId::fromHex(line.substr(6));
         }else{
-            stream >> second;
-            files[first] = second;
+            break;
         }
+        pos = eol + 1;
     }
+    if(pos < content.size()) filesText = content.substr(pos);
+    if(!parents.empty() && Shallow::contains(hash, repoPath)) parents.clear();
+}
+
+//flatten the root tree, or for an older commit parse its "filename blobhash" lines
+//the hash never contains a space, so split at the last one
+void Commit::ensureFiles() const{
+    if(filesParsed) return;
+    if(filesText.empty()){
+        Tree::flatten(tree, files, repoPath);
+        filesParsed = true;
+        return;
+    }
+    size_t pos = 0;
+    while(pos < filesText.size()){
+        size_t eol = filesText.find('\n', pos);
+        if(eol == std::string_view::npos) eol = filesText.size();
+        std::string_view line = filesText.substr(pos, eol - pos);
+        size_t space = line.rfind(' ');
+        if(space != std::string_view::npos && space > 0){
+            std::string_view name = line.substr(0, space);
+            ObjectId id = ObjectId::fromHex(line.substr(space + 1));
+            //lines are written in path order, so this is normally a plain append
+            if(files.empty() || *(files.end() - 1)->path < name) files.append(name, id);
+            else files.set(name, id);
+        }
+        pos = eol + 1;
+    }
+    filesParsed = true;
+}
+
+Commit Commit::initial(const std::string& repoPath){
+    Commit commit;
+    commit.repoPath = repoPath;
+    return commit;
+}
+
+//per-process LRU cache of parsed commits, keyed by repository and hash
+struct CommitCache{
+    std::mutex lock;
+    std::list<std::pair<std::string, std::shared_ptr<const Commit>>> order;//most recently used first
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::shared_ptr<const Commit>>>::iterator> index;
+};
+static CommitCache& commitCache(){
+    static CommitCache cache;
+    return cache;
+}
+std::shared_ptr<const Commit> Commit::load(const std::string& hash, const std::string& repoPath){
+    CommitCache& cache = commitCache();
+    std::string key = repoPath + '\0' + hash;
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        auto it = cache.index.find(key);
+        if(it != cache.index.end()){
+            cache.order.splice(cache.order.begin(), cache.order, it->second);
+            return it->second->second;
+        }
+    }
+    //read outside the lock; a racing load of the same commit just parses it twice
+    std::shared_ptr<const Commit> commit = std::make_shared<const Commit>(hash, repoPath);
+    std::lock_guard<std::mutex> guard(cache.lock);
+    if(cache.index.count(key)) return cache.index[key]->second;
+    cache.order.emplace_front(key, commit);
+    cache.index[key] = cache.order.begin();
+    if(cache.order.size() > CACHE_CAPACITY){
+        cache.index.erase(cache.order.back().first);
+        cache.order.pop_back();
+    }
+    return commit;
+}
+void Commit::clearCache(){
+    CommitCache& cache = commitCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    cache.order.clear();
+    cache.index.clear();
 }
 
 
@@ -38,16 +122,19 @@ Commit::Commit(const std::string& commitHash, const std::string& repoPath){
 
 
 //make all content to one string
+//the initial commit has an empty tree and no tree line, so its hash is the same as before trees
 std::string Commit::tostring(){
     std::string parents_string;
     for(int i = 0; i < parents.size(); i++){
         parents_string += ("parent: " + parents[i] + "\n");
     }
     std::string files_string;
-    for(auto& file : files){
-        files_string += (file.first + " " + file.second + "\n");
+    if(!filesText.empty()){//a commit from before tree objects keeps its file lines
+        files_string = std::string(filesText);
+    }else if(!tree.isNull()){
+        files_string = "tree: " + tree.hex() + "\n";
     }
-    std::string stringcontent = "message: " + message + "\n"
+    std::string stringcontent = "message: " + std::string(message) + "\n"
                                 + "timestamp: " + std::to_string(timestamp) + "\n"
                                 + parents_string
                                 + files_string;
@@ -70,7 +157,7 @@ std::string Commit::getHash() const{
     //to get the hash of initial-commit or current-commit, which do not need modification
     return hash;
 }
-std::string Commit::getMessage() const{
+std::string_view Commit::getMessage() const{
     return message;
 }
 time_t Commit::getTimestamp() const{
@@ -79,17 +166,30 @@ time_t Commit::getTimestamp() const{
 std::string Commit::getFirstParent() const{
     return parents[0];
 }
-std::vector<std::string> Commit::getParents() const{
+const std::vector<std::string>& Commit::getParents() const{
     return parents;
 }
-std::string Commit::getBlob(const std::string& filename){
-    if(in_commit(filename)){
-        return files[filename];
+std::string Commit::getBlob(const std::string& filename) const{
+    if(!filesParsed && filesText.empty()){//one walk down the tree instead of flattening it
+        ObjectId id;
+        return Tree::lookup(tree, filename, id, repoPath) ? id.hex() : "";
     }
+    ensureFiles();
+    const Manifest::Entry* entry = files.find(filename);
+    if(!entry) return "";
+    return entry->id.hex();
 }
-std::map<std::string, std::string> Commit::getFiles() const{
+const Manifest& Commit::getFiles() const{
+    ensureFiles();
     return files;
 }
+ObjectId Commit::getTree() const{
+    if(!filesText.empty() && tree.isNull()){
+        ensureFiles();
+        tree = Tree::build(files, repoPath);
+    }
+    return tree;
+}
 
 //modify
 void Commit::setTime(){
@@ -104,22 +204,26 @@ void Commit::addParent(const std::string& parent){
     parents.push_back(parent);
 }
 void Commit::setMessage(const std::string& msg){
-    message = msg;
-}
-void Commit::addFiles(std::map<std::string, std::string>& addition){
-    for(auto& add : addition){
-        files[add.first] = add.second;
-    }
+    ownedMessage = std::make_shared<const std::string>(msg);
+    message = *ownedMessage;
 }
-void Commit::rmFiles(std::map<std::string, int>& removal){
-    for(auto& rm : removal){
-        files.erase(rm.first);
-    }
+void Commit::updateFiles(const Manifest& addition, const PathSet& removal){
+    ObjectId root = getTree();
+    //from now on the commit is stored as a tree
+    filesText = std::string_view();
+    tree = Tree::update(root, addition, removal, repoPath);
+    files.clear();
+    filesParsed = false;
 }
 
 //find
 bool Commit::in_commit(const std::string& filename) const{
-    if(files.count(filename)) return true;
+    if(!filesParsed && filesText.empty()){
+        ObjectId id;
+        return Tree::lookup(tree, filename, id, repoPath);
+    }
+    ensureFiles();
+    if(files.contains(filename)) return true;
     return false;
 }
 
@@ -128,7 +232,6 @@ bool Commit::in_commit(const std::string& filename) const{
 //write to file
 void Commit::writeCommitFile(){
     computeHash();
-    std::string path = ".gitlite/commits/" + hash;
-    std::vector<unsigned char> content = Utils::serialize(tostring());
-    Utils::writeContents(path, content);
+    //an identical commit (same content, same second) is already recorded
+    if(ObjectStore::write(ObjectStore::COMMIT, hash, tostring(), repoPath)) CommitGraph::append(*this, repoPath);
 }
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "../include/Utils.h"
+#include "../include/CommitGraph.h"
+#include "../include/Tree.h"
+#include "../include/MessageIndex.h"
+#include "../include/LockFile.h"
+#include "../include/ObjectStore.h"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+//helper function to get the path of a column file
+static std::string columnPath(const std::string& repoPath, const std::string& column){
+    return Utils::join(repoPath, "commit-graph", column);
+}
+//helper function to append raw bytes to a column file
+static void appendColumn(const std::string& path, const void* data, size_t size){
+    int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if(fd < 0){
+        throw std::invalid_argument("cannot open commit-graph column");
+    }
+    const char* p = static_cast<const char*>(data);
+    while(size > 0){
+        ssize_t n = ::write(fd, p, size);
+        if(n <= 0) break;
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    ::close(fd);
+}
+//helper function to lay out the parents of a commit as one fixed-width row
+static std::string parentsRow(const std::vector<std::string>& parents){
+    std::string row(CommitGraph::PARENTS_WIDTH, '\0');
+    for(size_t i = 0; i < parents.size() && i < 2; i++){
+        row.replace(i * CommitGraph::HASH_WIDTH, CommitGraph::HASH_WIDTH, parents[i]);
+    }
+    return row;
+}
+
+CommitGraph::CommitGraph(const std::string& repoPath)
+    : dir{Utils::join(repoPath, "commit-graph")}, rows{0}, valid{false}, exact{false}, bloomValid{false} {
+    hashCol = MappedFile(columnPath(repoPath, "hashes"));
+    timeCol = MappedFile(columnPath(repoPath, "timestamps"));
+    parentCol = MappedFile(columnPath(repoPath, "parents"));
+    offsetCol = MappedFile(columnPath(repoPath, "message-offsets"));
+    messageCol = MappedFile(columnPath(repoPath, "messages"));
+    if(!hashCol.is_open() || !timeCol.is_open() || !parentCol.is_open()
+       || !offsetCol.is_open() || !messageCol.is_open()) return;
+    //hashes are written last, so they decide how many rows are complete
+    if(hashCol.size() % HASH_WIDTH != 0) return;
+    //the other columns may run ahead, for a row being appended or one cut short by a crash
+    rows = hashCol.size() / HASH_WIDTH;
+    if(timeCol.size() < rows * sizeof(int64_t)
+       || parentCol.size() < rows * PARENTS_WIDTH
+       || offsetCol.size() < rows * sizeof(uint64_t)){
+        rows = 0;
+        return;
+    }
+    uint64_t end = 0;
+    if(rows > 0){
+        std::memcpy(&end, offsetCol.data() + (rows - 1) * sizeof(uint64_t), sizeof(uint64_t));
+    }
+    if(end > messageCol.size()){
+        rows = 0;
+        return;
+    }
+    valid = true;
+    exact = timeCol.size() == rows * sizeof(int64_t) && parentCol.size() == rows * PARENTS_WIDTH
+            && offsetCol.size() == rows * sizeof(uint64_t) && end == messageCol.size();
+
+    //filters are optional: without them every commit may have changed any path
+    bloomOffsetCol = MappedFile(columnPath(repoPath, "bloom-offsets"));
+    bloomDataCol = MappedFile(columnPath(repoPath, "bloom-data"));
+    if(bloomOffsetCol.is_open() && bloomDataCol.is_open()
+       && bloomOffsetCol.size() >= rows * sizeof(uint64_t)){
+        uint64_t bloomEnd = 0;
+        if(rows > 0){
+            std::memcpy(&bloomEnd, bloomOffsetCol.data() + (rows - 1) * sizeof(uint64_t), sizeof(uint64_t));
+        }
+        bloomValid = bloomEnd <= bloomDataCol.size();
+        exact = exact && bloomValid && bloomOffsetCol.size() == rows * sizeof(uint64_t) && bloomEnd == bloomDataCol.size();
+    }else if(bloomOffsetCol.is_open() || bloomDataCol.is_open()){
+        exact = false;
+    }
+}
+
+bool CommitGraph::is_valid() const{
+    return valid;
+}
+size_t CommitGraph::size() const{
+    return rows;
+}
+std::string_view CommitGraph::getHash(size_t row) const{
+    return std::string_view(hashCol.data() + row * HASH_WIDTH, HASH_WIDTH);
+}
+time_t CommitGraph::getTimestamp(size_t row) const{
+    int64_t t;
+    std::memcpy(&t, timeCol.data() + row * sizeof(int64_t), sizeof(int64_t));
+    return static_cast<time_t>(t);
+}
+std::vector<std::string> CommitGraph::getParents(size_t row) const{
+    std::vector<std::string> parents;
+    const char* p = parentCol.data() + row * PARENTS_WIDTH;
+    for(size_t i = 0; i < 2; i++){
+        if(p[i * HASH_WIDTH] == '\0') break;
+        parents.push_back(std::string(p + i * HASH_WIDTH, HASH_WIDTH));
+    }
+    return parents;
+}
+std::string_view CommitGraph::getMessage(size_t row) const{
+    uint64_t begin = 0, end;
+    if(row > 0){
+        std::memcpy(&begin, offsetCol.data() + (row - 1) * sizeof(uint64_t), sizeof(uint64_t));
+    }
+    std::memcpy(&end, offsetCol.data() + row * sizeof(uint64_t), sizeof(uint64_t));
+    return std::string_view(messageCol.data() + begin, end - begin);
+}
+
+bool CommitGraph::findRow(const std::string& hash, size_t& row) const{
+    if(rowOf.empty() && rows > 0){
+        rowOf.reserve(rows);
+        for(size_t i = 0; i < rows; i++) rowOf.emplace(getHash(i), i);
+    }
+    auto it = rowOf.find(std::string_view(hash));
+    if(it == rowOf.end()) return false;
+    row = it->second;
+    return true;
+}
+
+bool CommitGraph::hasBloom() const{
+    return bloomValid;
+}
+bool CommitGraph::mayHaveChanged(size_t row, const BloomFilter::Key& key) const{
+    if(!bloomValid) return true;
+    uint64_t begin = 0, end;
+    if(row > 0){
+        std::memcpy(&begin, bloomOffsetCol.data() + (row - 1) * sizeof(uint64_t), sizeof(uint64_t));
+    }
+    std::memcpy(&end, bloomOffsetCol.data() + row * sizeof(uint64_t), sizeof(uint64_t));
+    return BloomFilter::mayContain(bloomDataCol.data() + begin, end - begin, key);
+}
+
+std::vector<std::string> CommitGraph::changedPaths(const Commit& commit, const std::string& repoPath){
+    ObjectId parentTree;
+    const std::vector<std::string>& parents = commit.getParents();
+    if(!parents.empty()){
+        parentTree = Commit::load(parents[0], repoPath)->getTree();
+    }
+    std::vector<std::string> changed;
+    //subtrees the commit shares with its parent are skipped whole
+    Tree::diff(commit.getTree(), parentTree, [&changed](const std::string& name, const ObjectId*, const ObjectId*){
+        changed.push_back(name);
+    }, repoPath);
+    //a directory changed if anything below it changed
+    size_t n = changed.size();
+    for(size_t i = 0; i < n; i++){
+        size_t slash = changed[i].rfind('/');
+        while(slash != std::string::npos && slash > 0){
+            changed.push_back(changed[i].substr(0, slash));
+            slash = changed[i].rfind('/', slash - 1);
+        }
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    return changed;
+}
+
+//helper function to build the changed-path filter of a commit
+//without its first parent (not copied yet) nothing is known, so every path may have changed
+static std::string filterFor(const Commit& commit, const std::string& repoPath){
+    const std::vector<std::string>& parents = commit.getParents();
+    if(!parents.empty() && !ObjectStore::contains(ObjectStore::COMMIT, parents[0], repoPath)) return "";
+    return BloomFilter::build(CommitGraph::changedPaths(commit, repoPath));
+}
+
+CommitGraph CommitGraph::open(const std::string& repoPath){
+    CommitGraph graph(repoPath);
+    if(graph.is_valid()) return graph;
+    rebuild(repoPath);
+    return CommitGraph(repoPath);
+}
+
+//helper function to write the whole store anew; the caller holds the lock
+static void rebuildStore(const std::string& repoPath){
+    std::vector<std::string> hashes = ObjectStore::list(ObjectStore::COMMIT, repoPath);
+    std::string hashData, timeData, parentData, offsetData, messageData;
+    std::string bloomOffsetData, bloomData;
+    std::vector<std::string> messages;
+    for(auto& hash : hashes){
+        std::shared_ptr<const Commit> loaded = Commit::load(hash, repoPath);
+        const Commit& commit = *loaded;
+        std::string message(commit.getMessage());
+        messages.push_back(message);
+        bloomData += filterFor(commit, repoPath);
+        uint64_t bloomEnd = bloomData.size();
+        bloomOffsetData.append(reinterpret_cast<const char*>(&bloomEnd), sizeof(bloomEnd));
+        int64_t timestamp = static_cast<int64_t>(commit.getTimestamp());
+        messageData += message;
+        uint64_t end = messageData.size();
+        hashData += hash;
+        timeData.append(reinterpret_cast<const char*>(&timestamp), sizeof(timestamp));
+        parentData += parentsRow(commit.getParents());
+        offsetData.append(reinterpret_cast<const char*>(&end), sizeof(end));
+    }
+
+    Utils::createDirectories(Utils::join(repoPath, "commit-graph"));
+    //drop the row count first so a crash midway leaves an invalid (rebuildable) store
+    Utils::writeContentsAtomically(columnPath(repoPath, "hashes"), "");
+    std::vector<std::pair<std::string, const std::string*>> columns = {
+        {"messages", &messageData},
+        {"message-offsets", &offsetData},
+        {"timestamps", &timeData},
+        {"parents", &parentData},
+        {"bloom-data", &bloomData},
+        {"bloom-offsets", &bloomOffsetData},
+        {"hashes", &hashData},
+    };
+    for(auto& column : columns){
+        Utils::writeContentsAtomically(columnPath(repoPath, column.first), *column.second);
+    }
+    MessageIndex::rebuild(messages, repoPath);
+}
+
+void CommitGraph::append(const Commit& commit, const std::string& repoPath, const std::string& sourcePath){
+    //repositories created before the store existed get one on the next rebuild
+    if(!Utils::isDirectory(Utils::join(repoPath, "commit-graph"))) return;
+    LockFile lock(Utils::join(repoPath, "commit-graph"));
+    //columns left longer than the rows by a writer that died midway are cleared by a rebuild,
+    //which also picks up this commit
+    CommitGraph graph(repoPath);
+    if(!graph.exact){
+        rebuildStore(repoPath);
+        return;
+    }
+
+    //filters are written before the row becomes visible, and only to a store that has them
+    std::string bloomOffsetsPath = columnPath(repoPath, "bloom-offsets");
+    if(Utils::isFile(bloomOffsetsPath)){
+        std::string dataPath = columnPath(repoPath, "bloom-data");
+        std::string filter = filterFor(commit, sourcePath.empty() ? repoPath : sourcePath);
+        struct stat bst;
+        uint64_t bloomEnd = 0;
+        if(stat(dataPath.c_str(), &bst) == 0) bloomEnd = static_cast<uint64_t>(bst.st_size);
+        bloomEnd += filter.size();
+        appendColumn(dataPath, filter.data(), filter.size());
+        appendColumn(bloomOffsetsPath, &bloomEnd, sizeof(bloomEnd));
+    }
+
+    std::string messagesPath = columnPath(repoPath, "messages");
+    struct stat st;
+    uint64_t end = 0;
+    if(stat(messagesPath.c_str(), &st) == 0) end = static_cast<uint64_t>(st.st_size);
+    uint32_t row = static_cast<uint32_t>(graph.rows);
+
+    std::string message(commit.getMessage());
+    std::string hash = commit.getHash();
+    std::string parents = parentsRow(commit.getParents());
+    int64_t timestamp = static_cast<int64_t>(commit.getTimestamp());
+    end += message.size();
+
+    appendColumn(messagesPath, message.data(), message.size());
+    appendColumn(columnPath(repoPath, "message-offsets"), &end, sizeof(end));
+    appendColumn(columnPath(repoPath, "timestamps"), &timestamp, sizeof(timestamp));
+    appendColumn(columnPath(repoPath, "parents"), parents.data(), parents.size());
+    MessageIndex::append(message, row, repoPath);
+    appendColumn(columnPath(repoPath, "hashes"), hash.data(), hash.size());
+}
+
+void CommitGraph::rebuild(const std::string& repoPath){
+    Utils::createDirectories(Utils::join(repoPath, "commit-graph"));
+    LockFile lock(Utils::join(repoPath, "commit-graph"));
+    rebuildStore(repoPath);
+}
@@ -0,0 +1,98 @@
+#include "../include/Delta.h"
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+
+static const char COPY = 'c';
+static const char INSERT = 'i';
+
+static void putU32(std::string& out, uint32_t value){
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+static bool readU32(std::string_view in, size_t& pos, uint32_t& value){
+    if(in.size() - pos < sizeof(value)) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+static uint64_t blockHash(const char* p){
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < Delta::BLOCK; i++){
+        h ^= static_cast<unsigned char>(p[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void insert(std::string& out, std::string_view bytes){
+    if(bytes.empty()) return;
+    out += INSERT;
+    putU32(out, static_cast<uint32_t>(bytes.size()));
+    out.append(bytes.data(), bytes.size());
+}
+
+//greedy: each block-aligned piece of the base is indexed once, and a match found at any offset
+//of the target is extended both ways as far as the bytes agree
+std::string Delta::create(std::string_view base, std::string_view target){
+    std::string out;
+    putU32(out, static_cast<uint32_t>(base.size()));
+    putU32(out, static_cast<uint32_t>(target.size()));
+    std::unordered_map<uint64_t, size_t> blocks;
+    for(size_t i = 0; i + BLOCK <= base.size(); i += BLOCK){
+        blocks.emplace(blockHash(base.data() + i), i);
+    }
+    size_t pending = 0;//start of the bytes not yet emitted
+    size_t pos = 0;
+    while(pos + BLOCK <= target.size()){
+        auto it = blocks.find(blockHash(target.data() + pos));
+        if(it == blocks.end() || std::memcmp(base.data() + it->second, target.data() + pos, BLOCK) != 0){
+            pos++;
+            continue;
+        }
+        size_t from = it->second, start = pos, end = pos + BLOCK;
+        while(start > pending && from > 0 && base[from - 1] == target[start - 1]){
+            from--;
+            start--;
+        }
+        size_t length = end - start;
+        while(end < target.size() && from + length < base.size() && base[from + length] == target[end]){
+            end++;
+            length++;
+        }
+        insert(out, target.substr(pending, start - pending));
+        out += COPY;
+        putU32(out, static_cast<uint32_t>(from));
+        putU32(out, static_cast<uint32_t>(length));
+        pos = pending = end;
+    }
+    insert(out, target.substr(pending));
+    return out;
+}
+
+bool Delta::apply(std::string_view base, std::string_view delta, std::string& result){
+    size_t pos = 0;
+    uint32_t baseSize, size;
+    if(!readU32(delta, pos, baseSize) || !readU32(delta, pos, size) || baseSize != base.size()) return false;
+    result.clear();
+    result.reserve(size);
+    while(pos < delta.size()){
+        char op = delta[pos++];
+        uint32_t offset, length;
+        if(op == COPY){
+            if(!readU32(delta, pos, offset) || !readU32(delta, pos, length)) return false;
+            if(offset > base.size() || base.size() - offset < length) return false;
+            result.append(base.data() + offset, length);
+        }else if(op == INSERT){
+            if(!readU32(delta, pos, length) || delta.size() - pos < length) return false;
+            result.append(delta.data() + pos, length);
+            pos += length;
+        }else{
+            return false;
+        }
+        if(result.size() > size) return false;
+    }
+    return result.size() == size;
+}
@@ -0,0 +1,450 @@
+#include "../include/Diff.h"
+#include "../include/Similarity.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+std::vector<std::string_view> Diff::splitLines(std::string_view text){
+    std::vector<std::string_view> lines;
+    for(size_t pos = 0; pos < text.size();){
+        size_t eol = text.find('\n', pos);
+        size_t end = eol == std::string_view::npos ? text.size() : eol + 1;
+        lines.push_back(text.substr(pos, end - pos));
+        pos = end;
+    }
+    return lines;
+}
+
+bool Diff::isBinary(std::string_view content){
+    //as git does: a NUL byte near the start
+    return std::memchr(content.data(), 0, std::min<size_t>(content.size(), 8000)) != nullptr;
+}
+
+namespace{
+//Myers' search over the line ids both sides have; each side's index maps back to its lines
+struct Kernel{
+    std::vector<uint32_t> a, b;
+    std::vector<size_t> aLines, bLines;
+    std::vector<long> forward, backward;//furthest x on each diagonal k = x - y
+    long offset;
+    long costLimit;
+    Diff::Script& script;
+
+    explicit Kernel(Diff::Script& script) : offset{0}, costLimit{Diff::MIN_COST_LIMIT}, script{script} {}
+
+    //a point on a shortest path from (aLo, bLo) to (aHi, bHi), found by searching from both
+    //ends at once until the searches meet; past costLimit, the point the searches got furthest to
+    void split(long aLo, long aHi, long bLo, long bHi, long& splitA, long& splitB){
+        long dmin = aLo - bHi, dmax = aHi - bLo;
+        long fmid = aLo - bLo, bmid = aHi - bHi;
+        long fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+        bool odd = (fmid - bmid) & 1;
+        long* kf = forward.data() + offset;
+        long* kb = backward.data() + offset;
+        kf[fmid] = aLo;
+        kb[bmid] = aHi;
+        for(long cost = 1;; cost++){
+            //diagonals one step further from the start, bounded by the box
+            if(fmin > dmin) kf[--fmin - 1] = -1;
+            else ++fmin;
+            if(fmax < dmax) kf[++fmax + 1] = -1;
+            else --fmax;
+            for(long k = fmax; k >= fmin; k -= 2){
+                long x = kf[k - 1] >= kf[k + 1] ? kf[k - 1] + 1 : kf[k + 1];
+                long y = x - k;
+                while(x < aHi && y < bHi && a[x] == b[y]){
+                    x++;
+                    y++;
+                }
+                kf[k] = x;
+                if(odd && bmin <= k && k <= bmax && kb[k] <= x){
+                    splitA = x;
+                    splitB = y;
+                    return;
+                }
+            }
+            //and from the end
+            if(bmin > dmin) kb[--bmin - 1] = LONG_MAX;
+            else ++bmin;
+            if(bmax < dmax) kb[++bmax + 1] = LONG_MAX;
+            else --bmax;
+            for(long k = bmax; k >= bmin; k -= 2){
+                long x = kb[k - 1] < kb[k + 1] ? kb[k - 1] : kb[k + 1] - 1;
+                long y = x - k;
+                while(x > aLo && y > bLo && a[x - 1] == b[y - 1]){
+                    x--;
+                    y--;
+                }
+                kb[k] = x;
+                if(!odd && fmin <= k && k <= fmax && x <= kf[k]){
+                    splitA = x;
+                    splitB = y;
+                    return;
+                }
+            }
+            if(cost < costLimit) continue;
+            long best = -1;
+            for(long k = fmax; k >= fmin; k -= 2){
+                long x = std::min(kf[k], aHi), y = x - k;
+                if(y > bHi){
+                    x = bHi + k;
+                    y = bHi;
+                }
+                if(x + y - aLo - bLo > best){
+                    best = x + y - aLo - bLo;
+                    splitA = x;
+                    splitB = y;
+                }
+            }
+            for(long k = bmax; k >= bmin; k -= 2){
+                long x = std::max(kb[k], aLo), y = x - k;
+                if(y < bLo){
+                    x = bLo + k;
+                    y = bLo;
+                }
+                if(aHi + bHi - x - y > best){
+                    best = aHi + bHi - x - y;
+                    splitA = x;
+                    splitB = y;
+                }
+            }
+            return;
+        }
+    }
+
+    void run(long aLo, long aHi, long bLo, long bHi){
+        //a common prefix and suffix are kept as they are
+        while(aLo < aHi && bLo < bHi && a[aLo] == b[bLo]){
+            aLo++;
+            bLo++;
+        }
+        while(aLo < aHi && bLo < bHi && a[aHi - 1] == b[bHi - 1]){
+            aHi--;
+            bHi--;
+        }
+        if(aLo == aHi){
+            for(long y = bLo; y < bHi; y++) script.inserted[bLines[y]] = true;
+            return;
+        }
+        if(bLo == bHi){
+            for(long x = aLo; x < aHi; x++) script.deleted[aLines[x]] = true;
+            return;
+        }
+        long x = aLo, y = bLo;
+        split(aLo, aHi, bLo, bHi, x, y);
+        run(aLo, x, bLo, y);
+        run(x, aHi, y, bHi);
+    }
+};
+}
+
+Diff::Script Diff::compare(const std::vector<std::string_view>& a, const std::vector<std::string_view>& b){
+    Script script;
+    script.deleted.assign(a.size(), false);
+    script.inserted.assign(b.size(), false);
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<uint32_t> aIds(a.size()), bIds(b.size());
+    std::vector<bool> inA, inB;
+    auto intern = [&](std::string_view line){
+        auto it = ids.emplace(line, static_cast<uint32_t>(ids.size())).first;
+        if(inA.size() < ids.size()){
+            inA.push_back(false);
+            inB.push_back(false);
+        }
+        return it->second;
+    };
+    for(size_t i = 0; i < a.size(); i++) inA[aIds[i] = intern(a[i])] = true;
+    for(size_t j = 0; j < b.size(); j++) inB[bIds[j] = intern(b[j])] = true;
+
+    //a line the other side does not have is always changed, and is left out of the search
+    Kernel kernel(script);
+    for(size_t i = 0; i < a.size(); i++){
+        if(!inB[aIds[i]]){
+            script.deleted[i] = true;
+            continue;
+        }
+        kernel.a.push_back(aIds[i]);
+        kernel.aLines.push_back(i);
+    }
+    for(size_t j = 0; j < b.size(); j++){
+        if(!inA[bIds[j]]){
+            script.inserted[j] = true;
+            continue;
+        }
+        kernel.b.push_back(bIds[j]);
+        kernel.bLines.push_back(j);
+    }
+    long n = static_cast<long>(kernel.a.size()), m = static_cast<long>(kernel.b.size());
+    kernel.offset = m + 1;
+    long root = static_cast<long>(std::sqrt(static_cast<double>(n + m)));
+    if(root > kernel.costLimit) kernel.costLimit = root;
+    kernel.forward.resize(n + m + 3);
+    kernel.backward.resize(n + m + 3);
+    kernel.run(0, n, 0, m);
+    return script;
+}
+
+void Diff::detectRenames(std::vector<File>& files, const Reader& readOld, const Reader& readNew){
+    //sources are deleted files (a rename or copy takes their old content) and modified ones
+    //(only copied); targets are added files
+    std::vector<size_t> sources, targets;
+    for(size_t i = 0; i < files.size(); i++){
+        if(files[i].newPath.empty()) sources.push_back(i);
+        else if(files[i].oldPath.empty()) targets.push_back(i);
+    }
+    if(targets.empty() || sources.empty()) return;
+    size_t deletedCount = sources.size();
+    for(size_t i = 0; i < files.size(); i++){
+        if(!files[i].oldPath.empty() && !files[i].newPath.empty()) sources.push_back(i);
+    }
+    std::vector<bool> renamed(sources.size(), false), matched(targets.size(), false);
+    auto take = [&](size_t s, size_t t, int similarity){
+        File& source = files[sources[s]];
+        File& target = files[targets[t]];
+        target.oldPath = source.oldPath;
+        target.oldId = source.oldId;
+        target.similarity = similarity;
+        target.copy = s >= deletedCount || renamed[s];
+        renamed[s] = true;
+        matched[t] = true;
+    };
+
+    //same content: no blob is read
+    std::unordered_map<std::string, std::vector<size_t>> byId;
+    for(size_t s = 0; s < sources.size(); s++) byId[files[sources[s]].oldId.hex()].push_back(s);
+    for(size_t t = 0; t < targets.size(); t++){
+        auto it = byId.find(files[targets[t]].newId.hex());
+        if(it == byId.end()) continue;
+        //a deleted file not yet renamed if there is one, else the first
+        size_t s = it->second.front();
+        for(size_t candidate : it->second){
+            if(candidate < deletedCount && !renamed[candidate]){
+                s = candidate;
+                break;
+            }
+        }
+        take(s, t, 100);
+    }
+
+    //similar content: sketches of the text files left, scored only for the pairs LSH proposes
+    std::vector<Similarity::Sketch> sourceSketches(sources.size()), targetSketches(targets.size());
+    std::vector<const Similarity::Sketch*> sourceList, targetList;
+    std::vector<size_t> sourceOf, targetOf;
+    for(size_t s = 0; s < sources.size(); s++){
+        const File& file = files[sources[s]];
+        std::string content = readOld(file.oldPath, file.oldId);
+        if(content.empty() || isBinary(content)) continue;
+        sourceSketches[s] = Similarity::sketch(content);
+        sourceList.push_back(&sourceSketches[s]);
+        sourceOf.push_back(s);
+    }
+    for(size_t t = 0; t < targets.size(); t++){
+        if(matched[t]) continue;
+        const File& file = files[targets[t]];
+        std::string content = readNew(file.newPath, file.newId);
+        if(content.empty() || isBinary(content)) continue;
+        targetSketches[t] = Similarity::sketch(content);
+        targetList.push_back(&targetSketches[t]);
+        targetOf.push_back(t);
+    }
+    struct Match{
+        int score;
+        size_t source, target;
+    };
+    std::vector<Match> found;
+    if(!sourceList.empty() && !targetList.empty()){
+        for(auto& pair : Similarity::candidates(sourceList, targetList)){
+            size_t s = sourceOf[pair.first], t = targetOf[pair.second];
+            int score = Similarity::score(sourceSketches[s], targetSketches[t]);
+            if(score >= RENAME_SCORE) found.push_back({score, s, t});
+        }
+    }
+    //best matches first; a deleted file is renamed once, and copied after that
+    std::sort(found.begin(), found.end(), [](const Match& x, const Match& y){
+        if(x.score != y.score) return x.score > y.score;
+        if(x.target != y.target) return x.target < y.target;
+        return x.source < y.source;
+    });
+    for(auto& match : found){
+        if(!matched[match.target]) take(match.source, match.target, match.score);
+    }
+
+    std::vector<File> kept;
+    for(size_t i = 0, s = 0; i < files.size(); i++){
+        //deleted files come first among the sources, in file order
+        if(s < deletedCount && sources[s] == i){
+            if(!renamed[s++]) kept.push_back(std::move(files[i]));
+            continue;
+        }
+        kept.push_back(std::move(files[i]));
+    }
+    files = std::move(kept);
+}
+
+//"l,s" of a hunk header, "l" alone for a single line
+static std::string range(size_t start, size_t count){
+    std::string text = std::to_string(start);
+    if(count != 1) text += "," + std::to_string(count);
+    return text;
+}
+
+static void writeLine(std::ostream& out, char prefix, std::string_view line){
+    out << prefix << line;
+    if(line.empty() || line.back() != '\n') out << "\n\\ No newline at end of file\n";
+}
+
+static void writeHunks(std::ostream& out, const std::vector<std::string_view>& a, const std::vector<std::string_view>& b, const Diff::Script& script){
+    //the script as one sequence of kept, deleted and inserted lines, with the position on each side
+    struct Op{
+        char kind;
+        size_t a, b;
+    };
+    std::vector<Op> ops;
+    for(size_t i = 0, j = 0; i < a.size() || j < b.size();){
+        if(i < a.size() && script.deleted[i]) ops.push_back({'-', i++, j});
+        else if(j < b.size() && script.inserted[j]) ops.push_back({'+', i, j++});
+        else ops.push_back({' ', i++, j++});
+    }
+    const size_t context = Diff::CONTEXT;
+    size_t next = 0;
+    while(true){
+        while(next < ops.size() && ops[next].kind == ' ') next++;
+        if(next == ops.size()) return;
+        //changes less than two contexts apart share a hunk
+        size_t start = next > context ? next - context : 0;
+        size_t end = next + 1;
+        for(size_t scan = next + 1; scan < ops.size();){
+            if(ops[scan].kind != ' '){
+                end = ++scan;
+                continue;
+            }
+            size_t run = scan;
+            while(run < ops.size() && ops[run].kind == ' ') run++;
+            if(run == ops.size() || run - scan > 2 * context) break;
+            scan = run;
+        }
+        size_t stop = std::min(ops.size(), end + context);
+        size_t oldCount = 0, newCount = 0;
+        for(size_t k = start; k < stop; k++){
+            if(ops[k].kind != '+') oldCount++;
+            if(ops[k].kind != '-') newCount++;
+        }
+        out << "@@ -" << range(ops[start].a + (oldCount ? 1 : 0), oldCount)
+            << " +" << range(ops[start].b + (newCount ? 1 : 0), newCount) << " @@\n";
+        for(size_t k = start; k < stop; k++){
+            if(ops[k].kind == '+') writeLine(out, '+', b[ops[k].b]);
+            else writeLine(out, ops[k].kind, a[ops[k].a]);
+        }
+        next = stop;
+    }
+}
+
+void Diff::write(std::ostream& out, std::vector<File> files, const Reader& readOld, const Reader& readNew, bool stat){
+    //content by blob id, so a blob the rename search read is not read again for the patch
+    std::unordered_map<std::string, std::string> contents;
+    auto load = [&](const Reader& read, const std::string& path, const ObjectId& id) -> const std::string& {
+        std::string key = id.hex();
+        auto it = contents.find(key);
+        if(it == contents.end()) it = contents.emplace(key, read(path, id)).first;
+        return it->second;
+    };
+    detectRenames(files,
+        [&](const std::string& path, const ObjectId& id){ return load(readOld, path, id); },
+        [&](const std::string& path, const ObjectId& id){ return load(readNew, path, id); });
+    std::sort(files.begin(), files.end(), [](const File& x, const File& y){
+        const std::string& xPath = x.newPath.empty() ? x.oldPath : x.newPath;
+        const std::string& yPath = y.newPath.empty() ? y.oldPath : y.newPath;
+        return xPath < yPath;
+    });
+
+    struct Stat{
+        std::string name;
+        bool binary;
+        size_t insertions, deletions;
+    };
+    std::vector<Stat> stats;
+    static const std::string none;
+    for(auto& file : files){
+        bool sameContent = !file.oldPath.empty() && !file.newPath.empty() && file.oldId == file.newId;
+        const std::string& oldText = file.oldPath.empty() || sameContent ? none : load(readOld, file.oldPath, file.oldId);
+        const std::string& newText = file.newPath.empty() || sameContent ? none : load(readNew, file.newPath, file.newId);
+        bool binary = isBinary(oldText) || isBinary(newText);
+        std::vector<std::string_view> oldLines, newLines;
+        Script script;
+        if(!binary && !sameContent){
+            oldLines = splitLines(oldText);
+            newLines = splitLines(newText);
+            script = compare(oldLines, newLines);
+        }
+
+        if(stat){
+            Stat line{file.newPath.empty() ? file.oldPath : file.newPath, binary, 0, 0};
+            if(file.similarity) line.name = file.oldPath + " => " + file.newPath;
+            line.deletions = std::count(script.deleted.begin(), script.deleted.end(), true);
+            line.insertions = std::count(script.inserted.begin(), script.inserted.end(), true);
+            stats.push_back(line);
+            continue;
+        }
+        const std::string& oldName = file.oldPath.empty() ? file.newPath : file.oldPath;
+        const std::string& newName = file.newPath.empty() ? file.oldPath : file.newPath;
+        out << "diff --gitlite a/" << oldName << " b/" << newName << "\n";
+        if(file.oldPath.empty()) out << "new file\n";
+        if(file.newPath.empty()) out << "deleted file\n";
+        if(file.similarity){
+            const char* kind = file.copy ? "copy" : "rename";
+            out << "similarity index " << file.similarity << "%\n"
+                << kind << " from " << file.oldPath << "\n"
+                << kind << " to " << file.newPath << "\n";
+        }
+        if(sameContent) continue;
+        out << "index " << file.oldId.hex().substr(0, 7) << ".." << file.newId.hex().substr(0, 7) << "\n";
+        if(binary){
+            out << "Binary files " << (file.oldPath.empty() ? "/dev/null" : "a/" + oldName)
+                << " and " << (file.newPath.empty() ? "/dev/null" : "b/" + newName) << " differ\n";
+            continue;
+        }
+        if(oldLines.empty() && newLines.empty()) continue;
+        out << "--- " << (file.oldPath.empty() ? "/dev/null" : "a/" + oldName) << "\n";
+        out << "+++ " << (file.newPath.empty() ? "/dev/null" : "b/" + newName) << "\n";
+        writeHunks(out, oldLines, newLines, script);
+    }
+    if(!stat || stats.empty()) return;
+
+    //" name | count +++--", the bars scaled to fit BAR_WIDTH
+    const size_t BAR_WIDTH = 50;
+    size_t nameWidth = 0, countWidth = 1, most = 0, insertions = 0, deletions = 0;
+    for(auto& line : stats){
+        nameWidth = std::max(nameWidth, line.name.size());
+        size_t changes = line.insertions + line.deletions;
+        countWidth = std::max(countWidth, line.binary ? 3 : std::to_string(changes).size());
+        most = std::max(most, changes);
+        insertions += line.insertions;
+        deletions += line.deletions;
+    }
+    auto scale = [&](size_t n){
+        if(most <= BAR_WIDTH || n == 0) return n;
+        return std::max<size_t>(1, n * BAR_WIDTH / most);
+    };
+    for(auto& line : stats){
+        out << " " << std::left << std::setw(nameWidth) << line.name << " | " << std::right << std::setw(countWidth);
+        if(line.binary){
+            out << "Bin\n";
+            continue;
+        }
+        out << line.insertions + line.deletions;
+        std::string bar = std::string(scale(line.insertions), '+') + std::string(scale(line.deletions), '-');
+        if(!bar.empty()) out << " " << bar;
+        out << "\n";
+    }
+    out << " " << stats.size() << (stats.size() == 1 ? " file changed" : " files changed");
+    if(insertions || !deletions) out << ", " << insertions << (insertions == 1 ? " insertion(+)" : " insertions(+)");
+    if(deletions || !insertions) out << ", " << deletions << (deletions == 1 ? " deletion(-)" : " deletions(-)");
+    out << "\n";
+}
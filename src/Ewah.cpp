@@ -0,0 +1,58 @@
+#include "../include/Ewah.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+
+static const uint64_t RUN_MAX = 0xffffffffULL;
+static const uint64_t LITERAL_MAX = 0x7fffffffULL;
+static const uint64_t ONES = ~uint64_t(0);
+
+static void putWord(std::string& out, uint64_t word){
+    out.append(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+std::string Ewah::encode(const std::vector<uint64_t>& words){
+    std::string out;
+    size_t i = 0, n = words.size();
+    while(i < n){
+        //clean words first (possibly none), then the literal words up to the next clean one
+        uint64_t bit = words[i] == ONES ? 1 : 0;
+        uint64_t clean = bit ? ONES : 0;
+        uint64_t run = 0;
+        while(i < n && words[i] == clean && run < RUN_MAX){
+            i++;
+            run++;
+        }
+        size_t start = i;
+        while(i < n && words[i] != 0 && words[i] != ONES && i - start < LITERAL_MAX) i++;
+        uint64_t literals = i - start;
+        putWord(out, bit | (run << 1) | (literals << 33));
+        out.append(reinterpret_cast<const char*>(words.data() + start), literals * sizeof(uint64_t));
+    }
+    return out;
+}
+
+bool Ewah::decodeOr(std::string_view data, std::vector<uint64_t>& words){
+    if(data.size() % sizeof(uint64_t) != 0) return false;
+    size_t count = data.size() / sizeof(uint64_t);
+    size_t pos = 0;
+    for(size_t w = 0; w < count;){
+        uint64_t marker;
+        std::memcpy(&marker, data.data() + w * sizeof(uint64_t), sizeof(marker));
+        w++;
+        uint64_t run = (marker >> 1) & RUN_MAX;
+        uint64_t literals = marker >> 33;
+        if(run > words.size() - pos || literals > words.size() - pos - run || literals > count - w) return false;
+        if(marker & 1){
+            for(uint64_t k = 0; k < run; k++) words[pos + k] = ONES;
+        }
+        pos += run;
+        for(uint64_t k = 0; k < literals; k++, w++, pos++){
+            uint64_t literal;
+            std::memcpy(&literal, data.data() + w * sizeof(uint64_t), sizeof(literal));
+            words[pos] |= literal;
+        }
+    }
+    return true;
+}
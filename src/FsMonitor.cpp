@@ -0,0 +1,322 @@
+#include "../include/Utils.h"
+#include "../include/FsMonitor.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//paths kept in the journal; older tokens expire and their commands scan everything
+static const size_t JOURNAL_LIMIT = 1 << 18;
+//how long a command waits for the monitor before scanning without it
+static const int TIMEOUT_MS = 5000;
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO
+                                 | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+
+static void setTimeout(int fd, int ms){
+    struct timeval tv{ms / 1000, (ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+//the socket of the monitor of the working directory at root
+static std::string socketPath(const std::string& root){
+    return Utils::join(root, ".gitlite/fsmonitor.sock");
+}
+//false if the path does not fit in a socket address
+static bool socketAddress(const std::string& path, sockaddr_un& addr){
+    addr = sockaddr_un{};
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path)) return false;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+static bool sendAll(int fd, const std::string& data){
+    for(size_t sent = 0; sent < data.size();){
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+//read until the peer closes the connection, or until the first newline if line is set
+static bool receive(int fd, std::string& data, bool line){
+    char buffer[65536];
+    while(!line || data.find('\n') == std::string::npos){
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if(n < 0) return false;
+        if(n == 0) return !line;
+        data.append(buffer, n);
+    }
+    return true;
+}
+//a connection to the running monitor, or -1
+static int connectToMonitor(const std::string& root){
+    sockaddr_un addr;
+    if(!socketAddress(socketPath(root), addr)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+    if(connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0){
+        close(fd);
+        return -1;
+    }
+    setTimeout(fd, TIMEOUT_MS);
+    return fd;
+}
+//send one request and read the whole reply
+static bool request(const std::string& root, const std::string& line, std::string& reply){
+    int fd = connectToMonitor(root);
+    if(fd < 0) return false;
+    bool ok = sendAll(fd, line + "\n") && receive(fd, reply, false);
+    close(fd);
+    return ok;
+}
+
+//the monitor process: one inotify watch per directory, and the journal of changed paths
+//journal[i] has sequence number firstSeq + i; a token "<instance>:<seq>" has seen everything before seq
+class Monitor{
+    std::string root;
+    std::string gitliteDir;
+    std::string socketFile;
+    int inotifyFd;
+    int listenFd;
+    int rootWd;
+    std::unordered_map<int, std::string> dirs;//watch descriptor -> "" for the root, else "dir/"
+    std::deque<std::string> journal;
+    uint64_t firstSeq;
+    std::string instance;
+    unsigned generation;
+    bool running;
+
+    uint64_t nextSeq() const { return firstSeq + journal.size(); }
+    void newInstance(){
+        instance = std::to_string(getpid()) + "." + std::to_string(std::chrono::system_clock::now().time_since_epoch().count())
+                 + "." + std::to_string(generation++);
+        journal.clear();
+        firstSeq = 0;
+    }
+    void record(const std::string& path){
+        if(!journal.empty() && journal.back() == path) return;//a write in several pieces
+        journal.push_back(path);
+        if(journal.size() > JOURNAL_LIMIT){
+            size_t dropped = JOURNAL_LIMIT / 2;
+            journal.erase(journal.begin(), journal.begin() + dropped);
+            firstSeq += dropped;
+        }
+    }
+    void watch(const std::string& prefix, bool recordEntries);
+    void unwatch(const std::string& prefix);
+    void drain();
+    void answer(int fd);
+
+public:
+    explicit Monitor(const std::string& root)
+        : root(root), gitliteDir(Utils::join(root, ".gitlite")), socketFile(socketPath(root)),
+          inotifyFd(-1), listenFd(-1), rootWd(-1), firstSeq(0), generation(0), running(true) {}
+    //watch the tree and listen on the socket; false if either fails
+    bool open();
+    void run();
+};
+
+//watch a directory and everything below it; entries of a directory that appeared after the
+//monitor started are recorded too, since they may have been created before the watch was added
+void Monitor::watch(const std::string& prefix, bool recordEntries){
+    std::string path = prefix.empty() ? root : Utils::join(root, prefix.substr(0, prefix.size() - 1));
+    int wd = inotify_add_watch(inotifyFd, path.c_str(), WATCH_MASK);
+    if(wd < 0) return;
+    dirs[wd] = prefix;//a directory moved within the tree keeps its watch under the new name
+    if(prefix.empty()) rootWd = wd;
+    DIR* d = opendir(path.c_str());
+    if(d == nullptr) return;
+    struct dirent* e;
+    while((e = readdir(d)) != nullptr){
+        std::string name = e->d_name;
+        if(name == "." || name == ".." || name == ".gitlite") continue;
+        std::string entry = prefix + name;
+        if(recordEntries) record(entry);
+        bool isDir = e->d_type == DT_DIR;
+        if(e->d_type == DT_UNKNOWN){
+            struct stat st;
+            isDir = lstat(Utils::join(root, entry).c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if(isDir) watch(entry + "/", recordEntries);
+    }
+    closedir(d);
+}
+
+//stop watching a directory moved away; if it moved within the tree it is watched again under its new name
+void Monitor::unwatch(const std::string& prefix){
+    for(auto it = dirs.begin(); it != dirs.end();){
+        if(it->second.compare(0, prefix.size(), prefix) == 0){
+            inotify_rm_watch(inotifyFd, it->first);
+            it = dirs.erase(it);
+        }else{
+            ++it;
+        }
+    }
+}
+
+//record every event queued so far
+void Monitor::drain(){
+    alignas(struct inotify_event) char buffer[65536];
+    while(true){
+        ssize_t n = read(inotifyFd, buffer, sizeof(buffer));
+        if(n <= 0) return;
+        for(ssize_t pos = 0; pos < n;){
+            const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(buffer + pos);
+            pos += sizeof(struct inotify_event) + ev->len;
+            if(ev->mask & IN_Q_OVERFLOW){
+                newInstance();//events were lost: every token expires
+                continue;
+            }
+            auto it = dirs.find(ev->wd);
+            if(it == dirs.end()) continue;
+            if(ev->wd == rootWd && (ev->mask & (IN_DELETE_SELF | IN_IGNORED))){
+                running = false;//the working directory is gone
+                continue;
+            }
+            if(ev->mask & IN_IGNORED){
+                dirs.erase(it);
+                continue;
+            }
+            if(ev->len == 0) continue;
+            std::string name = ev->name;
+            if(name == ".gitlite") continue;
+            std::string path = it->second + name;
+            record(path);
+            if(ev->mask & IN_ISDIR){
+                if(ev->mask & IN_MOVED_FROM) unwatch(path + "/");
+                if(ev->mask & (IN_CREATE | IN_MOVED_TO)) watch(path + "/", true);
+            }
+        }
+    }
+}
+
+//requests: "query <token>", answered with the new token and then "*" (scan everything) or the
+//changed paths, one per line, and an empty line; or "stop"
+void Monitor::answer(int fd){
+    setTimeout(fd, TIMEOUT_MS);
+    std::string request;
+    if(!receive(fd, request, true)) return;
+    request.erase(request.find('\n'));
+    if(request == "stop"){
+        sendAll(fd, "stopping\n");
+        running = false;
+        return;
+    }
+    if(request.compare(0, 6, "query ") != 0) return;
+    drain();
+    std::string token = request.substr(6);
+    std::string reply = instance + ":" + std::to_string(nextSeq()) + "\n";
+    size_t colon = token.rfind(':');
+    uint64_t seq = colon == std::string::npos ? 0 : std::strtoull(token.c_str() + colon + 1, nullptr, 10);
+    if(colon == std::string::npos || token.compare(0, colon, instance) != 0 || seq < firstSeq || seq > nextSeq()){
+        reply += "*\n";
+    }else{
+        std::unordered_set<std::string> seen;
+        for(size_t i = seq - firstSeq; i < journal.size(); i++){
+            if(seen.insert(journal[i]).second) reply += journal[i] + "\n";
+        }
+    }
+    reply += "\n";
+    sendAll(fd, reply);
+}
+
+bool Monitor::open(){
+    newInstance();
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(inotifyFd < 0) return false;
+    watch("", false);
+    if(rootWd < 0) return false;
+    sockaddr_un addr;
+    if(!socketAddress(socketFile, addr)) return false;
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenFd < 0) return false;
+    unlink(socketFile.c_str());//left by a monitor that did not exit cleanly
+    return bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 && listen(listenFd, 16) == 0;
+}
+
+void Monitor::run(){
+    while(running){
+        struct pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {listenFd, POLLIN, 0}};
+        int ready = poll(fds, 2, 10000);
+        if(ready < 0 && errno != EINTR) break;
+        if(!Utils::isDirectory(gitliteDir)) break;//the repository was removed
+        if(fds[0].revents & POLLIN) drain();
+        if(fds[1].revents & POLLIN){
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if(fd >= 0){
+                answer(fd);
+                close(fd);
+            }
+        }
+    }
+    unlink(socketFile.c_str());
+}
+
+void FsMonitor::start(const std::string& root){
+    int fd = connectToMonitor(root);
+    if(fd >= 0){
+        close(fd);
+        Utils::exitWithMessage("A file system monitor is already running.");
+    }
+    //the tree is watched and the socket bound before returning, so no later change is missed
+    Monitor monitor(root);
+    if(!monitor.open()){
+        unlink(socketPath(root).c_str());
+        Utils::exitWithMessage("Cannot start the file system monitor.");
+    }
+    pid_t pid = fork();
+    if(pid < 0) Utils::exitWithMessage("Cannot start the file system monitor.");
+    if(pid > 0) return;
+    //the monitor: detached from the terminal and from the output of the command that started it
+    setsid();
+    int null = ::open("/dev/null", O_RDWR);
+    if(null >= 0){
+        dup2(null, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        if(null > 2) close(null);
+    }
+    monitor.run();
+    std::_Exit(0);
+}
+
+void FsMonitor::stop(const std::string& root){
+    std::string reply;
+    if(!request(root, "stop", reply)){
+        Utils::exitWithMessage("No file system monitor is running.");
+    }
+}
+
+bool FsMonitor::query(const std::string& root, const std::string& token, Changes& changes){
+    std::string reply;
+    if(!request(root, "query " + token, reply)) return false;
+    //a complete reply ends with an empty line
+    if(reply.size() < 2 || reply.compare(reply.size() - 2, 2, "\n\n") != 0) return false;
+    size_t eol = reply.find('\n');
+    changes.token = reply.substr(0, eol);
+    changes.full = false;
+    changes.paths.clear();
+    for(size_t pos = eol + 1; pos < reply.size(); pos = eol + 1){
+        eol = reply.find('\n', pos);
+        if(eol == pos) break;
+        std::string path = reply.substr(pos, eol - pos);
+        if(path == "*"){
+            changes.full = true;
+        }else{
+            changes.paths.push_back(path);
+        }
+    }
+    return true;
+}
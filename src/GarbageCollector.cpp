@@ -0,0 +1,180 @@
+#include "../include/Utils.h"
+#include "../include/GarbageCollector.h"
+#include "../include/ObjectStore.h"
+#include "../include/Pack.h"
+#include "../include/BitmapIndex.h"
+#include "../include/Reachability.h"
+#include "../include/Stage.h"
+#include "../include/Worktree.h"
+#include "../include/CommitGraph.h"
+#include "../include/LockFile.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <sys/stat.h>
+
+static const ObjectStore::Kind KINDS[] = {ObjectStore::COMMIT, ObjectStore::TREE, ObjectStore::BLOB};
+
+//reachable objects, keyed by kind byte and hash
+struct Marks{
+    std::unordered_set<std::string> keys;
+    std::vector<std::pair<ObjectStore::Kind, std::string>> objects;//in marking order
+
+    static std::string key(ObjectStore::Kind kind, const std::string& hash){
+        return static_cast<char>(kind) + hash;
+    }
+    bool insert(ObjectStore::Kind kind, const std::string& hash){
+        if(!keys.insert(key(kind, hash)).second) return false;
+        objects.push_back({kind, hash});
+        return true;
+    }
+    bool contains(ObjectStore::Kind kind, const std::string& hash) const{
+        return keys.count(key(kind, hash)) > 0;
+    }
+};
+
+//every object reachable from the branches and HEADs, from the bitmaps of the last repack where
+//they cover it, and the staged blobs of every worktree
+static Marks mark(const std::vector<std::string>& tips, const std::string& repoPath){
+    Marks marks;
+    for(auto& object : Reachability::reachable(tips, repoPath)){
+        marks.insert(object.kind, object.hash);
+    }
+    std::vector<std::string> trees = Worktree::linked(repoPath);
+    trees.insert(trees.begin(), repoPath);
+    for(auto& tree : trees){
+        Stage stage(Utils::readContentsAsString(Utils::join(tree, "stage")), tree);
+        for(auto& add : stage.getAdd()){
+            marks.insert(ObjectStore::BLOB, add.id.hex());
+        }
+    }
+    return marks;
+}
+
+static int64_t nowNanos(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+static int64_t mtimeNanos(const struct stat& st){
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+//helper function to sum the disk space of loose objects and packs
+static uint64_t storageSize(const std::string& repoPath){
+    uint64_t total = 0;
+    struct stat st;
+    for(auto kind : KINDS){
+        std::string dir = ObjectStore::dirOf(kind, repoPath);
+        for(auto& name : Utils::plainFilenamesIn(dir)){
+            if(stat(Utils::join(dir, name).c_str(), &st) == 0) total += static_cast<uint64_t>(st.st_blocks) * 512;
+        }
+    }
+    for(auto& pack : ObjectStore::packFiles(repoPath)){
+        if(stat(pack.c_str(), &st) == 0) total += static_cast<uint64_t>(st.st_blocks) * 512;
+    }
+    return total;
+}
+
+//helper function to delete the objects in dir that are old enough and not kept, and the
+//temporary files interrupted writes left there; returns the number of objects deleted
+static size_t sweep(const std::string& dir, int64_t cutoff, const std::function<bool(const std::string&)>& keep){
+    size_t pruned = 0;
+    struct stat st;
+    for(auto& name : Utils::plainFilenamesIn(dir)){
+        std::string path = Utils::join(dir, name);
+        bool object = name.size() == Utils::UID_LENGTH;
+        if(object ? keep(name) : name.find(".tmp-") == std::string::npos) continue;
+        if(stat(path.c_str(), &st) != 0 || mtimeNanos(st) > cutoff) continue;
+        if(std::remove(path.c_str()) == 0 && object) pruned++;
+    }
+    return pruned;
+}
+
+GarbageCollector::Result GarbageCollector::collect(int64_t expiry, bool repack, const std::string& repoPath){
+    //packs are rewritten by one gc or maintenance run at a time
+    LockFile packLock(Utils::join(repoPath, "packs"));
+    Result result{0, 0, 0, 0, 0};
+    result.bytesBefore = storageSize(repoPath);
+    int64_t now = nowNanos();
+    //an expiry reaching back before 1970 keeps everything
+    int64_t cutoff = expiry > now / 1000000000 ? 0 : now - expiry * 1000000000;
+    std::string packsDir = Utils::join(repoPath, "packs");
+    std::vector<std::string> oldPacks = ObjectStore::packFiles(repoPath);
+    std::vector<std::string> tips;
+    Marks marks;
+    //the new pack is written before anything is deleted, so every reachable object is read first
+    std::unique_ptr<Pack::Writer> writer;
+    bool commitsPruned = false;
+    try{
+        tips = Reachability::refTips(repoPath);
+        marks = mark(tips, repoPath);
+        //temporary packs left by an interrupted gc
+        sweep(packsDir, cutoff, [](const std::string&){ return true; });
+        //journals of transfers that were interrupted and never resumed
+        sweep(Utils::join(repoPath, "transfers"), cutoff, [](const std::string&){ return false; });
+        if(repack){
+            writer.reset(new Pack::Writer(packsDir));
+            for(auto& object : marks.objects){
+                //objects lent by an alternate stay there
+                if(!ObjectStore::containsLocally(object.first, object.second, repoPath)) continue;
+                writer->add(object.first, ObjectId::fromHex(object.second), ObjectStore::read(object.first, object.second, repoPath));
+            }
+            //unreachable objects of recent packs stay until their pack is old enough
+            Marks kept, dropped;
+            struct stat st;
+            for(auto& path : oldPacks){
+                Pack pack(path);
+                bool recent = stat(path.c_str(), &st) == 0 && mtimeNanos(st) > cutoff;
+                for(size_t i = 0; pack.is_valid() && i < pack.size(); i++){
+                    Pack::Entry entry = pack.entry(i);
+                    ObjectStore::Kind kind = static_cast<ObjectStore::Kind>(entry.kind);
+                    std::string hash = entry.id.hex();
+                    if(marks.contains(kind, hash) || kept.contains(kind, hash)) continue;
+                    if(recent){
+                        kept.insert(kind, hash);
+                        writer->add(kind, entry.id, pack.content(entry));
+                    }else if(dropped.insert(kind, hash)){
+                        if(kind == ObjectStore::COMMIT) commitsPruned = true;
+                    }
+                }
+            }
+            //an object dropped from one pack may still be kept from a recent one
+            for(auto& object : dropped.objects){
+                if(!kept.contains(object.first, object.second)) result.pruned++;
+            }
+        }
+    }catch(const std::invalid_argument&){
+        Utils::exitWithMessage("Cannot read every reachable object; nothing was removed.");
+    }
+    result.reachable = marks.objects.size();
+
+    for(auto kind : KINDS){
+        size_t pruned = sweep(ObjectStore::dirOf(kind, repoPath), cutoff, [&](const std::string& hash){ return marks.contains(kind, hash); });
+        if(kind == ObjectStore::COMMIT && pruned > 0) commitsPruned = true;
+        result.pruned += pruned;
+    }
+
+    if(writer){
+        result.packed = writer->size();
+        std::string newPack = result.packed > 0 ? writer->finish() : "";
+        writer.reset();
+        if(!newPack.empty()) BitmapIndex::write(newPack, tips, repoPath, oldPacks);
+        for(auto& path : oldPacks){
+            if(path == newPack) continue;
+            std::remove(path.c_str());
+            std::remove(BitmapIndex::pathOf(path).c_str());
+        }
+        //the loose copies are read from the pack from now on
+        for(auto& object : marks.objects){
+            std::remove(Utils::join(ObjectStore::dirOf(object.first, repoPath), object.second).c_str());
+        }
+    }
+
+    if(commitsPruned) CommitGraph::rebuild(repoPath);
+    result.bytesAfter = storageSize(repoPath);
+    return result;
+}
@@ -0,0 +1,101 @@
+#include "../include/Utils.h"
+#include "../include/LockFile.h"
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string readLock(const std::string& lockPath){
+    std::ifstream file(lockPath, std::ios::binary);
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+//a lock is stale if its owner is gone, or if it has had no owner for STALE_SECONDS
+//(a committing owner replaces "pid <n>" with the new content, so that counts as owned)
+static bool isStale(const std::string& lockPath, const std::string& content){
+    if(content.compare(0, 4, "pid ") == 0){
+        pid_t pid = static_cast<pid_t>(std::strtol(content.c_str() + 4, nullptr, 10));
+        return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+    }
+    if(!content.empty()) return false;
+    struct stat st;
+    if(stat(lockPath.c_str(), &st) != 0) return false;
+    return std::time(nullptr) - st.st_mtime > LockFile::STALE_SECONDS;
+}
+//move a stale lock aside and delete it; another process may have broken it first and taken
+//the lock in between, in which case the lock moved aside is live and is put back
+static void breakLock(const std::string& lockPath, const std::string& content){
+    std::string aside = lockPath + ".stale-" + std::to_string(getpid());
+    if(rename(lockPath.c_str(), aside.c_str()) != 0) return;
+    if(readLock(aside) != content) link(aside.c_str(), lockPath.c_str());
+    unlink(aside.c_str());
+}
+
+LockFile::LockFile(const std::string& path, int timeoutMs) : path(path), lockPath(path + ".lock"), fd(-1) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    int backoffMs = 1;
+    while(true){
+        fd = open(lockPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if(fd >= 0) break;
+        if(errno != EEXIST) Utils::exitWithMessage("Unable to create " + lockPath + ".");
+        std::string content = readLock(lockPath);
+        if(isStale(lockPath, content)){
+            breakLock(lockPath, content);
+            continue;
+        }
+        if(std::chrono::steady_clock::now() >= deadline){
+            Utils::exitWithMessage("Unable to lock " + path + ": another gitlite process is using it.");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoffMs));
+        backoffMs = std::min(backoffMs * 2, 50);
+    }
+    std::string owner = "pid " + std::to_string(getpid()) + "\n";
+    if(write(fd, owner.data(), owner.size()) != static_cast<ssize_t>(owner.size())){
+        release();
+        Utils::exitWithMessage("Unable to lock " + path + ".");
+    }
+}
+
+LockFile::~LockFile(){
+    release();
+}
+
+void LockFile::commit(const std::string& content){
+    if(fd < 0) return;
+    bool ok = ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0;
+    for(size_t written = 0; ok && written < content.size();){
+        ssize_t n = write(fd, content.data() + written, content.size() - written);
+        ok = n > 0;
+        if(ok) written += n;
+    }
+    close(fd);
+    fd = -1;
+    if(!ok || rename(lockPath.c_str(), path.c_str()) != 0){
+        unlink(lockPath.c_str());
+        Utils::exitWithMessage("Unable to write " + path + ".");
+    }
+}
+
+void LockFile::remove(){
+    if(fd < 0) return;
+    unlink(path.c_str());
+    release();
+}
+
+void LockFile::release(){
+    if(fd < 0) return;
+    close(fd);
+    fd = -1;
+    unlink(lockPath.c_str());
+}
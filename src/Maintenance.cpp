@@ -0,0 +1,167 @@
+#include "../include/Utils.h"
+#include "../include/Maintenance.h"
+#include "../include/ObjectStore.h"
+#include "../include/Pack.h"
+#include "../include/BitmapIndex.h"
+#include "../include/Reachability.h"
+#include "../include/CommitGraph.h"
+#include "../include/MessageIndex.h"
+#include "../include/LockFile.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <sstream>
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static const ObjectStore::Kind KINDS[] = {ObjectStore::COMMIT, ObjectStore::TREE, ObjectStore::BLOB};
+
+static std::string reportPath(const std::string& repoPath){
+    return Utils::join(repoPath, "maintenance.log");
+}
+
+//helper function to count loose objects, stopping at limit
+static size_t countLoose(const std::string& repoPath, size_t limit){
+    size_t count = 0;
+    for(auto kind : KINDS){
+        DIR* dir = opendir(ObjectStore::dirOf(kind, repoPath).c_str());
+        if(!dir) continue;
+        struct dirent* entry;
+        while(count < limit && (entry = readdir(dir)) != nullptr){
+            if(std::strlen(entry->d_name) == Utils::UID_LENGTH) count++;
+        }
+        closedir(dir);
+    }
+    return count;
+}
+
+std::string Maintenance::due(const std::string& repoPath){
+    if(countLoose(repoPath, LOOSE_LIMIT) >= LOOSE_LIMIT) return std::to_string(LOOSE_LIMIT) + " loose objects";
+    if(ObjectStore::packFiles(repoPath).size() >= PACK_LIMIT) return std::to_string(PACK_LIMIT) + " packs";
+    CommitGraph graph(repoPath);
+    if(!graph.is_valid() || !graph.hasBloom()) return "stale commit-graph";
+    if(MessageIndex::logSize(repoPath) >= INDEX_LOG_LIMIT) return "message index log";
+    return "";
+}
+
+void Maintenance::schedule(const std::string& repoPath){
+    if(Utils::exists(Utils::join(repoPath, "maintenance.lock"))) return;
+    std::string reason = due(repoPath);
+    if(reason.empty()) return;
+    pid_t pid = fork();
+    if(pid < 0) return;
+    if(pid > 0){
+        //the intermediate process exits at once, so the command is not left with a child
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+    //the run: detached from the terminal and from the output of the command that started it
+    setsid();
+    if(fork() != 0) std::_Exit(0);
+    int null = ::open("/dev/null", O_RDWR);
+    if(null >= 0){
+        dup2(null, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        if(null > 2) close(null);
+    }
+    try{
+        run(reason, repoPath);
+    }catch(const std::exception&){//another run got the lock first, or a task failed
+    }
+    std::_Exit(0);
+}
+
+//helper function to pack the loose objects, with the objects of every pack once there are
+//PACK_LIMIT of them; the new pack is complete before anything it replaces is deleted
+static std::string packObjects(const std::string& repoPath){
+    LockFile packLock(Utils::join(repoPath, "packs"));
+    std::vector<std::string> oldPacks = ObjectStore::packFiles(repoPath);
+    bool merge = oldPacks.size() >= Maintenance::PACK_LIMIT;
+    Pack::Writer writer(Utils::join(repoPath, "packs"));
+    std::unordered_set<std::string> added;
+    std::vector<std::string> loose;
+    for(auto kind : KINDS){
+        std::string dir = ObjectStore::dirOf(kind, repoPath);
+        for(auto& name : Utils::plainFilenamesIn(dir)){
+            if(name.size() != Utils::UID_LENGTH) continue;
+            std::string path = Utils::join(dir, name);
+            std::string content;
+            try{
+                content = Utils::readContentsAsString(path);
+            }catch(const std::invalid_argument&){//pruned by gc meanwhile
+                continue;
+            }
+            if(!added.insert(static_cast<char>(kind) + name).second) continue;
+            writer.add(kind, ObjectId::fromHex(name), content);
+            loose.push_back(path);
+        }
+    }
+    size_t merged = 0;
+    if(merge){
+        for(auto& path : oldPacks){
+            Pack pack(path);
+            for(size_t i = 0; pack.is_valid() && i < pack.size(); i++){
+                Pack::Entry entry = pack.entry(i);
+                if(added.insert(entry.kind + entry.id.hex()).second) writer.add(entry.kind, entry.id, pack.content(entry));
+            }
+            merged++;
+        }
+    }
+    if(writer.size() == 0) return "Packed 0 loose objects.";
+    std::string newPack = writer.finish();
+    if(merge){
+        //the merged pack holds everything, so it gets the bitmaps
+        BitmapIndex::write(newPack, Reachability::refTips(repoPath), repoPath, oldPacks);
+        for(auto& path : oldPacks){
+            if(path == newPack) continue;
+            std::remove(path.c_str());
+            std::remove(BitmapIndex::pathOf(path).c_str());
+        }
+    }
+    for(auto& path : loose){
+        std::remove(path.c_str());
+    }
+    std::string report = "Packed " + std::to_string(loose.size()) + " loose objects";
+    if(merge) report += ", merged " + std::to_string(merged) + " packs into one";
+    return report + ".";
+}
+
+std::string Maintenance::run(const std::string& reason, const std::string& repoPath){
+    LockFile lock(Utils::join(repoPath, "maintenance"), 0);
+    auto start = std::chrono::steady_clock::now();
+    std::ostringstream tasks;
+    tasks<<packObjects(repoPath)<<"\n";
+    CommitGraph graph(repoPath);
+    if(!graph.is_valid() || !graph.hasBloom()){
+        CommitGraph::rebuild(repoPath);
+        tasks<<"Commit-graph: rebuilt.\n";
+    }else{
+        tasks<<"Commit-graph: up to date.\n";
+        LockFile graphLock(Utils::join(repoPath, "commit-graph"));
+        size_t merged = MessageIndex::compact(repoPath);
+        tasks<<"Message index: merged "<<merged<<" log entries.\n";
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    time_t now = std::time(nullptr);
+    struct tm timeinfo;
+    char buffer[80];
+    localtime_r(&now, &timeinfo);
+    std::strftime(buffer, sizeof(buffer), "%a %b %d %H:%M:%S %Y %z", &timeinfo);
+    std::string report = "Last run (" + reason + ") finished " + buffer + " in " + std::to_string(elapsed) + " ms.\n" + tasks.str();
+    Utils::writeContentsAtomically(reportPath(repoPath), report);
+    return report;
+}
+
+std::string Maintenance::lastReport(const std::string& repoPath){
+    if(!Utils::isFile(reportPath(repoPath))) return "";
+    return Utils::readContentsAsString(reportPath(repoPath));
+}
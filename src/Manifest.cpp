@@ -0,0 +1,126 @@
+#include "../include/Manifest.h"
+#include <string>
+#include <unordered_set>
+#include <mutex>
+#include <algorithm>
+
+static int hexValue(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return 0;
+}
+
+ObjectId ObjectId::fromHex(std::string_view hex){
+    ObjectId id;
+    for(size_t i = 0; i < id.bytes.size() && 2 * i + 1 < hex.size(); i++){
+        id.bytes[i] = static_cast<unsigned char>(hexValue(hex[2 * i]) << 4 | hexValue(hex[2 * i + 1]));
+    }
+    return id;
+}
+std::string ObjectId::hex() const{
+    static const char digits[] = "0123456789abcdef";
+    std::string out(2 * bytes.size(), '0');
+    for(size_t i = 0; i < bytes.size(); i++){
+        out[2 * i] = digits[bytes[i] >> 4];
+        out[2 * i + 1] = digits[bytes[i] & 15];
+    }
+    return out;
+}
+bool ObjectId::isNull() const{
+    for(unsigned char b : bytes){
+        if(b) return false;
+    }
+    return true;
+}
+
+struct PathPool::Generation{
+    //node-based set: element addresses stay valid as it grows
+    std::unordered_set<std::string> paths;
+};
+
+void PathPool::Refs::add(const std::shared_ptr<const Generation>& generation){
+    if(std::find(generations.begin(), generations.end(), generation) == generations.end()){
+        generations.push_back(generation);
+    }
+}
+void PathPool::Refs::add(const Refs& other){
+    if(&other == this) return;
+    for(auto& generation : other.generations) add(generation);
+}
+const std::string* PathPool::intern(std::string_view path, Refs& refs){
+    static std::mutex lock;
+    static std::shared_ptr<Generation> current = std::make_shared<Generation>();
+    std::lock_guard<std::mutex> guard(lock);
+    if(current->paths.size() >= GENERATION_SIZE) current = std::make_shared<Generation>();
+    if(refs.generations.empty() || refs.generations.back() != current) refs.add(current);
+    return &*current->paths.emplace(path).first;
+}
+
+size_t Manifest::lowerBound(std::string_view path) const{
+    size_t lo = 0, hi = entries.size();
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(std::string_view(*entries[mid].path) < path) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+const Manifest::Entry* Manifest::find(std::string_view path) const{
+    size_t i = lowerBound(path);
+    if(i < entries.size() && *entries[i].path == path) return &entries[i];
+    return nullptr;
+}
+bool Manifest::contains(std::string_view path) const{
+    return find(path) != nullptr;
+}
+void Manifest::set(std::string_view path, const ObjectId& id){
+    size_t i = lowerBound(path);
+    if(i < entries.size() && *entries[i].path == path){
+        entries[i].id = id;
+        return;
+    }
+    entries.insert(entries.begin() + i, Entry{PathPool::intern(path, refs), id});
+}
+bool Manifest::erase(std::string_view path){
+    size_t i = lowerBound(path);
+    if(i < entries.size() && *entries[i].path == path){
+        entries.erase(entries.begin() + i);
+        return true;
+    }
+    return false;
+}
+void Manifest::append(std::string_view path, const ObjectId& id){
+    entries.push_back(Entry{PathPool::intern(path, refs), id});
+}
+void Manifest::append(const std::string* internedPath, const ObjectId& id, const PathPool::Refs& owner){
+    refs.add(owner);
+    entries.push_back(Entry{internedPath, id});
+}
+
+size_t PathSet::lowerBound(std::string_view path) const{
+    size_t lo = 0, hi = paths.size();
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(std::string_view(*paths[mid]) < path) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+bool PathSet::contains(std::string_view path) const{
+    size_t i = lowerBound(path);
+    return i < paths.size() && *paths[i] == path;
+}
+void PathSet::insert(std::string_view path){
+    size_t i = lowerBound(path);
+    if(i < paths.size() && *paths[i] == path) return;
+    paths.insert(paths.begin() + i, PathPool::intern(path, refs));
+}
+bool PathSet::erase(std::string_view path){
+    size_t i = lowerBound(path);
+    if(i < paths.size() && *paths[i] == path){
+        paths.erase(paths.begin() + i);
+        return true;
+    }
+    return false;
+}
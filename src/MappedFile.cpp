@@ -0,0 +1,51 @@
+#include "../include/MappedFile.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+MappedFile::MappedFile(const std::string& path) : addr{nullptr}, length{0}, opened{false} {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) return;
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)){
+        close(fd);
+        return;
+    }
+    length = static_cast<size_t>(st.st_size);
+    //an empty file cannot be mapped, but it is still a valid (empty) column
+    if(length > 0){
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(p == MAP_FAILED){
+            close(fd);
+            length = 0;
+            return;
+        }
+        addr = p;
+        madvise(addr, length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    opened = true;
+}
+
+MappedFile::~MappedFile(){
+    if(addr) munmap(addr, length);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : addr{other.addr}, length{other.length}, opened{other.opened} {
+    other.addr = nullptr;
+    other.length = 0;
+    other.opened = false;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept{
+    if(this != &other){
+        if(addr) munmap(addr, length);
+        addr = std::exchange(other.addr, nullptr);
+        length = std::exchange(other.length, 0);
+        opened = std::exchange(other.opened, false);
+    }
+    return *this;
+}
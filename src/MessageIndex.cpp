@@ -0,0 +1,274 @@
+#include "../include/Utils.h"
+#include "../include/MessageIndex.h"
+#include "../include/MappedFile.h"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+struct Posting{
+    uint32_t trigram;
+    uint32_t row;
+    bool operator<(const Posting& other) const{
+        if(trigram != other.trigram) return trigram < other.trigram;
+        return row < other.row;
+    }
+};
+
+static std::string indexPath(const std::string& repoPath){
+    return Utils::join(repoPath, "commit-graph", "trigram-index");
+}
+static std::string logPath(const std::string& repoPath){
+    return Utils::join(repoPath, "commit-graph", "trigram-log");
+}
+static uint32_t packTrigram(const char* p){
+    return (static_cast<uint32_t>(static_cast<unsigned char>(p[0])) << 16)
+         | (static_cast<uint32_t>(static_cast<unsigned char>(p[1])) << 8)
+         | static_cast<uint32_t>(static_cast<unsigned char>(p[2]));
+}
+//helper function to read postings out of a mapped file
+static Posting postingAt(const MappedFile& file, size_t i){
+    Posting p;
+    std::memcpy(&p, file.data() + i * sizeof(Posting), sizeof(Posting));
+    return p;
+}
+static void writePostings(const std::string& path, const std::vector<Posting>& postings){
+    std::string data(reinterpret_cast<const char*>(postings.data()), postings.size() * sizeof(Posting));
+    Utils::writeContentsAtomically(path, data);
+}
+//merge the log into the sorted index
+size_t MessageIndex::compact(const std::string& repoPath){
+    MappedFile base(indexPath(repoPath));
+    MappedFile log(logPath(repoPath));
+    if(!base.is_open() || !log.is_open() || log.size() < sizeof(Posting)) return 0;
+    std::vector<Posting> fresh;
+    size_t logCount = log.size() / sizeof(Posting);
+    for(size_t i = 0; i < logCount; i++) fresh.push_back(postingAt(log, i));
+    std::sort(fresh.begin(), fresh.end());
+    std::vector<Posting> merged;
+    size_t baseCount = base.size() / sizeof(Posting);
+    merged.reserve(baseCount + fresh.size());
+    size_t j = 0;
+    for(size_t i = 0; i < baseCount; i++){
+        Posting p = postingAt(base, i);
+        while(j < fresh.size() && fresh[j] < p) merged.push_back(fresh[j++]);
+        merged.push_back(p);
+    }
+    while(j < fresh.size()) merged.push_back(fresh[j++]);
+    //the index is replaced before the log is emptied, and neither is truncated in place, since
+    //readers may have them mapped
+    writePostings(indexPath(repoPath), merged);
+    Utils::writeContentsAtomically(logPath(repoPath), "");
+    return logCount;
+}
+size_t MessageIndex::logSize(const std::string& repoPath){
+    struct stat st;
+    if(stat(logPath(repoPath).c_str(), &st) != 0) return 0;
+    return static_cast<size_t>(st.st_size) / sizeof(Posting);
+}
+
+std::vector<uint32_t> MessageIndex::trigramsOf(const std::string& literal){
+    std::vector<uint32_t> trigrams;
+    for(size_t i = 0; i + 3 <= literal.size(); i++){
+        trigrams.push_back(packTrigram(literal.data() + i));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+//walk the regex and collect runs of plain characters that every match must contain;
+//anything that can be skipped (alternation, optional atoms or groups) is left out
+std::vector<std::string> MessageIndex::requiredLiterals(const std::string& regex){
+    std::vector<std::string> literals;
+    //size of literals when each open group started, and whether its literals are dropped (it has
+    //alternatives or is a negative lookahead)
+    std::vector<std::pair<size_t, bool>> groups;
+    std::string run;
+    auto endRun = [&](){
+        if(!run.empty()) literals.push_back(run);
+        run.clear();
+    };
+    auto isOptionalQuantifier = [&](size_t i){
+        return i < regex.size() && (regex[i] == '*' || regex[i] == '?' || regex[i] == '{');
+    };
+    for(size_t i = 0; i < regex.size(); i++){
+        char c = regex[i];
+        if(c == '|'){
+            //any branch may match: outside a group nothing is required,
+            //inside one the group contributes nothing
+            if(groups.empty()) return {};
+            endRun();
+            groups.back().second = true;
+            continue;
+        }
+        if(c == '('){
+            endRun();
+            //what a negative lookahead holds must not match, so it contributes nothing either
+            bool negative = i + 2 < regex.size() && regex[i + 1] == '?' && regex[i + 2] == '!';
+            groups.push_back({literals.size(), negative});
+            if(i + 2 < regex.size() && regex[i + 1] == '?') i += 2;//(?: (?= (?!
+            continue;
+        }
+        if(c == ')'){
+            endRun();
+            if(groups.empty()) continue;
+            std::pair<size_t, bool> group = groups.back();
+            groups.pop_back();
+            if(group.second || isOptionalQuantifier(i + 1)) literals.resize(group.first);
+            continue;
+        }
+        if(c == '['){
+            endRun();
+            size_t j = i + 1;
+            if(j < regex.size() && regex[j] == '^') j++;
+            if(j < regex.size() && regex[j] == ']') j++;
+            while(j < regex.size() && regex[j] != ']'){
+                if(regex[j] == '\\') j++;
+                j++;
+            }
+            i = j;
+            continue;
+        }
+        if(c == '*' || c == '?' || c == '{'){
+            //the previous character was optional
+            if(!run.empty()) run.pop_back();
+            endRun();
+            if(c == '{'){
+                while(i < regex.size() && regex[i] != '}') i++;
+            }
+            continue;
+        }
+        if(c == '+'){
+            endRun();
+            continue;
+        }
+        if(c == '.' || c == '^' || c == '$'){
+            endRun();
+            continue;
+        }
+        if(c == '\\'){
+            if(i + 1 >= regex.size()) break;
+            char e = regex[++i];
+            if(std::isalnum(static_cast<unsigned char>(e))){
+                //character classes, anchors and back-references
+                endRun();
+            }else{
+                run += e;
+            }
+            continue;
+        }
+        run += c;
+    }
+    endRun();
+    return literals;
+}
+
+bool MessageIndex::candidates(const std::vector<std::string>& literals, size_t rows, std::vector<uint32_t>& result, const std::string& repoPath){
+    std::vector<uint32_t> trigrams;
+    for(auto& literal : literals){
+        std::vector<uint32_t> t = trigramsOf(literal);
+        trigrams.insert(trigrams.end(), t.begin(), t.end());
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    if(trigrams.empty()) return false;
+
+    //the log is mapped first: a compaction in between leaves its postings in the newer index
+    MappedFile log(logPath(repoPath));
+    MappedFile base(indexPath(repoPath));
+    if(!base.is_open() || base.size() % sizeof(Posting) != 0) return false;
+    size_t baseCount = base.size() / sizeof(Posting);
+    size_t logCount = log.is_open() ? log.size() / sizeof(Posting) : 0;
+
+    //where each trigram's postings live in the sorted index
+    struct Range{
+        uint32_t trigram;
+        size_t lo, hi;
+    };
+    std::vector<Range> ranges;
+    for(uint32_t trigram : trigrams){
+        size_t lo = 0, hi = baseCount;
+        while(lo < hi){
+            size_t mid = (lo + hi) / 2;
+            if(postingAt(base, mid).trigram < trigram) lo = mid + 1;
+            else hi = mid;
+        }
+        size_t end = lo, right = baseCount;
+        while(end < right){
+            size_t mid = (end + right) / 2;
+            if(postingAt(base, mid).trigram <= trigram) end = mid + 1;
+            else right = mid;
+        }
+        ranges.push_back({trigram, lo, end});
+    }
+    //the rarest trigrams narrow the candidates the most; intersecting common ones
+    //costs more than verifying the few rows they would remove
+    std::sort(ranges.begin(), ranges.end(), [](const Range& a, const Range& b){
+        return a.hi - a.lo < b.hi - b.lo;
+    });
+    if(ranges.size() > MAX_LISTS) ranges.resize(MAX_LISTS);
+
+    //posting lists of the chosen trigrams; rows ascend within the index and within the log
+    std::vector<std::vector<uint32_t>> lists(ranges.size());
+    for(size_t t = 0; t < ranges.size(); t++){
+        for(size_t i = ranges[t].lo; i < ranges[t].hi; i++){
+            uint32_t row = postingAt(base, i).row;
+            if(row < rows) lists[t].push_back(row);
+        }
+    }
+    for(size_t i = 0; i < logCount; i++){
+        Posting p = postingAt(log, i);
+        if(p.row >= rows) continue;
+        for(size_t t = 0; t < ranges.size(); t++){
+            if(ranges[t].trigram == p.trigram) lists[t].push_back(p.row);
+        }
+    }
+    for(auto& list : lists){
+        if(!std::is_sorted(list.begin(), list.end())) std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    }
+    result = lists[0];
+    for(size_t t = 1; t < lists.size() && !result.empty(); t++){
+        std::vector<uint32_t> next;
+        std::set_intersection(result.begin(), result.end(), lists[t].begin(), lists[t].end(), std::back_inserter(next));
+        result.swap(next);
+    }
+    return true;
+}
+
+void MessageIndex::append(const std::string& message, uint32_t row, const std::string& repoPath){
+    if(!Utils::isFile(indexPath(repoPath))) return;
+    std::vector<Posting> postings;
+    for(uint32_t trigram : trigramsOf(message)){
+        postings.push_back({trigram, row});
+    }
+    if(!postings.empty()){
+        std::string path = logPath(repoPath);
+        int fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+        if(fd < 0){
+            throw std::invalid_argument("cannot open trigram log");
+        }
+        ssize_t n = ::write(fd, postings.data(), postings.size() * sizeof(Posting));
+        ::close(fd);
+        if(n < 0) return;
+    }
+    if(logSize(repoPath) > COMPACT_THRESHOLD) compact(repoPath);
+}
+
+void MessageIndex::rebuild(const std::vector<std::string>& messages, const std::string& repoPath){
+    std::vector<Posting> postings;
+    for(size_t row = 0; row < messages.size(); row++){
+        for(uint32_t trigram : trigramsOf(messages[row])){
+            postings.push_back({trigram, static_cast<uint32_t>(row)});
+        }
+    }
+    std::sort(postings.begin(), postings.end());
+    Utils::writeContentsAtomically(logPath(repoPath), "");
+    writePostings(indexPath(repoPath), postings);
+}
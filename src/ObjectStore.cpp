@@ -0,0 +1,191 @@
+#include "../include/Utils.h"
+#include "../include/ObjectStore.h"
+#include "../include/Pack.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <set>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+#include <climits>
+#include <cstdlib>
+#include <sys/stat.h>
+
+typedef std::vector<std::shared_ptr<const Pack>> Packs;
+
+//helper function to get the packs of a repository, mapped once per process and mapped again
+//whenever the packs directory changes (gc adds and removes whole packs only)
+static std::shared_ptr<const Packs> packsOf(const std::string& repoPath){
+    static const std::shared_ptr<const Packs> none = std::make_shared<const Packs>();
+    std::string dir = Utils::join(repoPath, "packs");
+    struct stat st;
+    if(stat(dir.c_str(), &st) != 0) return none;
+    int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    static std::mutex lock;
+    static std::map<std::string, std::pair<int64_t, std::shared_ptr<const Packs>>> cache;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(repoPath);
+        if(it != cache.end() && it->second.first == mtime) return it->second.second;
+    }
+    auto packs = std::make_shared<Packs>();
+    for(auto& path : ObjectStore::packFiles(repoPath)){
+        auto pack = std::make_shared<const Pack>(path);
+        if(pack->is_valid()) packs->push_back(pack);
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    cache[repoPath] = {mtime, packs};
+    return packs;
+}
+
+//helper function to find a packed object
+static bool findPacked(ObjectStore::Kind kind, const std::string& hash, const std::string& repoPath, std::string* content){
+    std::shared_ptr<const Packs> packs = packsOf(repoPath);
+    if(packs->empty() || hash.size() != Utils::UID_LENGTH) return false;
+    ObjectId id = ObjectId::fromHex(hash);
+    std::string_view found;
+    for(auto& pack : *packs){
+        if(pack->find(kind, id, found)){
+            if(content) content->assign(found);
+            return true;
+        }
+    }
+    return false;
+}
+
+//helper function to read the alternates of one repository, paths made relative to the process
+static std::vector<std::string> readAlternates(const std::string& repoPath){
+    std::vector<std::string> paths;
+    std::string content;
+    try{
+        content = Utils::readContentsAsString(Utils::join(repoPath, "alternates"));
+    }catch(const std::invalid_argument&){
+        return paths;
+    }
+    std::istringstream lines(content);
+    for(std::string line; std::getline(lines, line);){
+        if(line.empty()) continue;
+        paths.push_back(line[0] == '/' ? line : Utils::join(repoPath, line));
+    }
+    return paths;
+}
+
+std::vector<std::string> ObjectStore::alternates(const std::string& repoPath){
+    static const std::shared_ptr<const std::vector<std::string>> none = std::make_shared<const std::vector<std::string>>();
+    std::string path = Utils::join(repoPath, "alternates");
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return *none;
+    int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    static std::mutex lock;
+    static std::map<std::string, std::pair<int64_t, std::shared_ptr<const std::vector<std::string>>>> cache;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(repoPath);
+        if(it != cache.end() && it->second.first == mtime) return *it->second.second;
+    }
+    //breadth first through the alternates of alternates, each repository once
+    auto found = std::make_shared<std::vector<std::string>>();
+    std::set<std::string> seen;
+    char resolved[PATH_MAX];
+    if(realpath(repoPath.c_str(), resolved)) seen.insert(resolved);
+    std::vector<std::string> queue = readAlternates(repoPath);
+    for(size_t i = 0; i < queue.size(); i++){
+        if(!realpath(queue[i].c_str(), resolved) || !seen.insert(resolved).second) continue;
+        found->push_back(queue[i]);
+        for(auto& next : readAlternates(queue[i])) queue.push_back(next);
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    cache[repoPath] = {mtime, found};
+    return *found;
+}
+
+std::string ObjectStore::dirOf(Kind kind, const std::string& repoPath){
+    switch(kind){
+        case BLOB: return Utils::join(repoPath, "blobs");
+        case TREE: return Utils::join(repoPath, "trees");
+        default: return Utils::join(repoPath, "commits");
+    }
+}
+
+bool ObjectStore::containsLocally(Kind kind, const std::string& hash, const std::string& repoPath){
+    if(Utils::isFile(Utils::join(dirOf(kind, repoPath), hash))) return true;
+    return findPacked(kind, hash, repoPath, nullptr);
+}
+
+bool ObjectStore::contains(Kind kind, const std::string& hash, const std::string& repoPath){
+    if(containsLocally(kind, hash, repoPath)) return true;
+    for(auto& alternate : alternates(repoPath)){
+        if(containsLocally(kind, hash, alternate)) return true;
+    }
+    return false;
+}
+
+//helper function to read an object from one repository's own store
+static bool readLocally(ObjectStore::Kind kind, const std::string& hash, const std::string& repoPath, std::string& content){
+    try{
+        content = Utils::readContentsAsString(Utils::join(ObjectStore::dirOf(kind, repoPath), hash));
+        return true;
+    }catch(const std::invalid_argument&){//not loose, or packed and removed by gc just now
+    }
+    return findPacked(kind, hash, repoPath, &content);
+}
+
+std::string ObjectStore::read(Kind kind, const std::string& hash, const std::string& repoPath){
+    std::string content;
+    if(readLocally(kind, hash, repoPath, content)) return content;
+    for(auto& alternate : alternates(repoPath)){
+        if(readLocally(kind, hash, alternate, content)) return content;
+    }
+    throw std::invalid_argument("object " + hash + " not found");
+}
+
+bool ObjectStore::write(Kind kind, const std::string& hash, const std::string& content, const std::string& repoPath){
+    if(contains(kind, hash, repoPath)) return false;
+    Utils::writeContentsAtomically(Utils::join(dirOf(kind, repoPath), hash), content);
+    return true;
+}
+
+bool ObjectStore::copy(Kind kind, const std::string& hash, const std::string& from, const std::string& to){
+    if(contains(kind, hash, to)) return false;
+    std::string path = Utils::join(dirOf(kind, from), hash);
+    //repositories from before tree objects have no trees directory yet
+    Utils::createDirectories(dirOf(kind, to));
+    if(Utils::isFile(path)) return Utils::copyFileAtomically(path, Utils::join(dirOf(kind, to), hash));
+    return write(kind, hash, read(kind, hash, from), to);
+}
+
+//helper function to add the objects of a kind in one repository's own store
+static void listLocally(ObjectStore::Kind kind, const std::string& repoPath, std::vector<std::string>& hashes){
+    for(auto& name : Utils::plainFilenamesIn(ObjectStore::dirOf(kind, repoPath))){
+        //skip files being written by another process
+        if(name.size() == Utils::UID_LENGTH) hashes.push_back(name);
+    }
+    for(auto& pack : *packsOf(repoPath)){
+        for(size_t i = 0; i < pack->size(); i++){
+            Pack::Entry entry = pack->entry(i);
+            if(entry.kind == kind) hashes.push_back(entry.id.hex());
+        }
+    }
+}
+
+std::vector<std::string> ObjectStore::list(Kind kind, const std::string& repoPath){
+    std::vector<std::string> hashes;
+    listLocally(kind, repoPath, hashes);
+    for(auto& alternate : alternates(repoPath)) listLocally(kind, alternate, hashes);
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+}
+
+std::vector<std::string> ObjectStore::packFiles(const std::string& repoPath){
+    std::string dir = Utils::join(repoPath, "packs");
+    std::vector<std::string> packs;
+    for(auto& name : Utils::plainFilenamesIn(dir)){
+        if(name.size() > 5 && name.compare(name.size() - 5, 5, ".pack") == 0) packs.push_back(Utils::join(dir, name));
+    }
+    return packs;
+}
@@ -0,0 +1,150 @@
+#include "../include/Utils.h"
+#include "../include/Pack.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+
+static const char MAGIC[] = "GLPACK1\n";
+static const size_t MAGIC_SIZE = 8;
+//id, kind, offset, size
+static const size_t ENTRY_SIZE = 20 + 1 + 8 + 8;
+//table offset, count, crc
+static const size_t TRAILER_SIZE = 8 + 4 + 4;
+
+static bool entryLess(const Pack::Entry& a, const Pack::Entry& b){
+    if(a.id.bytes != b.id.bytes) return a.id.bytes < b.id.bytes;
+    return a.kind < b.kind;
+}
+
+Pack::Pack(const std::string& path) : file(path), table{nullptr}, count{0}, valid{false} {
+    if(!file.is_open() || file.size() < MAGIC_SIZE + TRAILER_SIZE) return;
+    const char* data = file.data();
+    if(std::memcmp(data, MAGIC, MAGIC_SIZE) != 0) return;
+    const char* trailer = data + file.size() - TRAILER_SIZE;
+    uint64_t tableOffset;
+    uint32_t n, crc;
+    std::memcpy(&tableOffset, trailer, 8);
+    std::memcpy(&n, trailer + 8, 4);
+    std::memcpy(&crc, trailer + 12, 4);
+    uint64_t tableEnd = file.size() - TRAILER_SIZE;
+    if(tableOffset < MAGIC_SIZE || tableOffset > tableEnd || (tableEnd - tableOffset) != uint64_t(n) * ENTRY_SIZE) return;
+    if(Utils::crc32(data + tableOffset, tableEnd - tableOffset) != crc) return;
+    table = data + tableOffset;
+    count = n;
+    //every object must lie between the magic and the table
+    for(uint32_t i = 0; i < count; i++){
+        Entry e = entry(i);
+        if(e.offset < MAGIC_SIZE || e.offset > tableOffset || e.size > tableOffset - e.offset){
+            count = 0;
+            return;
+        }
+    }
+    valid = true;
+}
+
+Pack::Entry Pack::entry(size_t i) const{
+    const char* p = table + i * ENTRY_SIZE;
+    Entry e;
+    std::memcpy(e.id.bytes.data(), p, 20);
+    e.kind = p[20];
+    std::memcpy(&e.offset, p + 21, 8);
+    std::memcpy(&e.size, p + 29, 8);
+    return e;
+}
+
+std::string_view Pack::content(const Entry& entry) const{
+    return std::string_view(file.data() + entry.offset, entry.size);
+}
+
+bool Pack::lookup(char kind, const ObjectId& id, size_t& index) const{
+    if(!valid) return false;
+    Entry probe{id, kind, 0, 0};
+    size_t lo = 0, hi = count;
+    while(lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        if(entryLess(entry(mid), probe)) lo = mid + 1;
+        else hi = mid;
+    }
+    if(lo == count) return false;
+    Entry found = entry(lo);
+    if(found.id != id || found.kind != kind) return false;
+    index = lo;
+    return true;
+}
+
+bool Pack::find(char kind, const ObjectId& id, std::string_view& content) const{
+    size_t index;
+    if(!lookup(kind, id, index)) return false;
+    content = this->content(entry(index));
+    return true;
+}
+
+std::vector<uint32_t> Pack::dataOrder() const{
+    std::vector<std::pair<std::pair<uint64_t, uint64_t>, uint32_t>> byOffset;
+    byOffset.reserve(count);
+    for(uint32_t i = 0; i < count; i++){
+        Entry e = entry(i);
+        //an empty object shares its offset with the object written after it
+        byOffset.push_back({{e.offset, e.size}, i});
+    }
+    std::sort(byOffset.begin(), byOffset.end());
+    std::vector<uint32_t> order;
+    order.reserve(count);
+    for(auto& item : byOffset) order.push_back(item.second);
+    return order;
+}
+
+Pack::Writer::Writer(const std::string& dir) : dir(dir), offset{MAGIC_SIZE} {
+    Utils::createDirectories(dir);
+    tmpPath = Utils::join(dir, "pack.tmp-" + std::to_string(getpid()));
+    out.open(tmpPath, std::ios::binary | std::ios::trunc);
+    if(!out) throw std::invalid_argument("cannot create file");
+    out.write(MAGIC, MAGIC_SIZE);
+}
+
+Pack::Writer::~Writer(){
+    //not finished: leave nothing behind
+    if(out.is_open()){
+        out.close();
+        std::remove(tmpPath.c_str());
+    }
+}
+
+void Pack::Writer::add(char kind, const ObjectId& id, std::string_view content){
+    out.write(content.data(), content.size());
+    entries.push_back(Entry{id, kind, offset, content.size()});
+    offset += content.size();
+}
+
+std::string Pack::Writer::finish(){
+    std::sort(entries.begin(), entries.end(), entryLess);
+    std::string table;
+    table.reserve(entries.size() * ENTRY_SIZE);
+    for(auto& e : entries){
+        table.append(reinterpret_cast<const char*>(e.id.bytes.data()), 20);
+        table += e.kind;
+        table.append(reinterpret_cast<const char*>(&e.offset), 8);
+        table.append(reinterpret_cast<const char*>(&e.size), 8);
+    }
+    uint32_t n = static_cast<uint32_t>(entries.size());
+    uint32_t crc = Utils::crc32(table.data(), table.size());
+    out.write(table.data(), table.size());
+    out.write(reinterpret_cast<const char*>(&offset), 8);
+    out.write(reinterpret_cast<const char*>(&n), 4);
+    out.write(reinterpret_cast<const char*>(&crc), 4);
+    out.close();
+    if(!out){
+        std::remove(tmpPath.c_str());
+        throw std::invalid_argument("cannot write file");
+    }
+    std::string path = Utils::join(dir, "pack-" + Utils::sha1(table) + ".pack");
+    if(std::rename(tmpPath.c_str(), path.c_str()) != 0){
+        std::remove(tmpPath.c_str());
+        throw std::invalid_argument("cannot create file");
+    }
+    return path;
+}
@@ -1,41 +1,102 @@
 #include "../include/Utils.h"
 #include "../include/Pointers.h"
+#include "../include/LockFile.h"
 #include <string>
 #include <vector>
+#include <memory>
 #include <algorithm>
 
 //HEAD
 //if is ref, HEAD file starts with ref: 
 //if is reference to remote branch, HEAD file starts with remote_ref: 
-bool Pointers::is_ref(){
-    std::string head = Utils::readContentsAsString(".gitlite/HEAD");
+//the branch is named relative to the repository ("ref: .gitlite/branches/<name>" whatever its path)
+bool Pointers::is_ref(const std::string& repoPath){
+    std::string head = Utils::readContentsAsString(Utils::join(repoPath, "HEAD"));
     size_t pos = head.find("ref: ");
     if(pos == std::string::npos) return false;
     return true;
 }
-std::string Pointers::get_ref(){
-    if(is_ref()){
-        std::string head = Utils::readContentsAsString(".gitlite/HEAD");
+std::string Pointers::get_ref(const std::string& repoPath){
+    if(is_ref(repoPath)){
+        std::string head = Utils::readContentsAsString(Utils::join(repoPath, "HEAD"));
         std::string preffix = "ref: .gitlite/branches/";
         size_t length = preffix.size();
         return head.substr(length);
     }
+    return "";
 }
 void Pointers::set_ref(const std::string& branchname, const std::string& repoPath){
-    std::string path = Utils::join(repoPath, "HEAD");
-    Utils::writeContents(path, "ref: .gitlite/branches/" + branchname);
+    LockFile lock(Utils::join(repoPath, "HEAD"));
+    lock.commit("ref: .gitlite/branches/" + branchname);
+}
+
+//branch names
+//helper function to tell a lock file (see LockFile) from a ref
+static bool isLockName(const std::string& name){
+    return name.size() >= 5 && name.compare(name.size() - 5, 5, ".lock") == 0;
+}
+bool Pointers::isValidName(const std::string& branchname){
+    if(branchname.empty() || branchname[0] == '/') return false;
+    for(unsigned char c : branchname){
+        if(c < 0x20 || c == 0x7f) return false;
+    }
+    for(size_t start = 0; start <= branchname.size();){
+        size_t end = branchname.find('/', start);
+        if(end == std::string::npos) end = branchname.size();
+        std::string component = branchname.substr(start, end - start);
+        if(component.empty() || component == "." || component == "..") return false;
+        if(isLockName(component)) return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+//refs
+//helper function to check a locked ref against the value the caller read before
+static void checkRef(const std::string& ref, const std::string& path, const std::string& expected){
+    std::string current = Utils::isFile(path) ? Utils::readContentsAsString(path) : "";
+    if(current != expected){
+        Utils::exitWithMessage("Cannot update " + ref + ": it was changed by another process.");
+    }
+}
+void Pointers::updateRef(const std::string& ref, const std::string& value, const std::string& expected, const std::string& repoPath){
+    std::string path = Utils::join(repoPath, ref);
+    Utils::createDirectories(path.substr(0, path.find_last_of('/')));//a new remote's branches
+    LockFile lock(path);
+    checkRef(ref, path, expected);
+    lock.commit(value);
+}
+void Pointers::updateRefs(std::vector<RefUpdate> updates, const std::string& repoPath){
+    std::sort(updates.begin(), updates.end(), [](const RefUpdate& a, const RefUpdate& b){ return a.ref < b.ref; });
+    std::vector<std::unique_ptr<LockFile>> locks;
+    for(auto& update : updates){
+        std::string path = Utils::join(repoPath, update.ref);
+        Utils::createDirectories(path.substr(0, path.find_last_of('/')));
+        locks.emplace_back(new LockFile(path));
+        checkRef(update.ref, path, update.expected);
+    }
+    for(size_t i = 0; i < updates.size(); i++) locks[i]->commit(updates[i].value);
+}
+void Pointers::deleteRef(const std::string& ref, const std::string& expected, const std::string& repoPath){
+    std::string path = Utils::join(repoPath, ref);
+    LockFile lock(path);
+    checkRef(ref, path, expected);
+    lock.remove();
 }
 
 //branches
-std::vector<std::string> Pointers::getBranches(){
-    std::vector<std::string> branches =  Utils::plainFilenamesIn(".gitlite/branches");
-    std::vector<std::string> remoteNames = Utils::DirnamesIn(".gitlite/branches");
+std::vector<std::string> Pointers::getBranches(const std::string& repoPath){
+    std::string branchesDir = Utils::join(repoPath, "branches");
+    std::vector<std::string> branches =  Utils::plainFilenamesIn(branchesDir);
+    std::vector<std::string> remoteNames = Utils::DirnamesIn(branchesDir);
     for(auto& remoteName : remoteNames){
-        std::vector<std::string> remoteBranchNames = Utils::plainFilenamesIn(".gitlite/branches/" + remoteName);
+        std::vector<std::string> remoteBranchNames = Utils::plainFilenamesIn(Utils::join(branchesDir, remoteName));
         for(auto& remoteBranchName : remoteBranchNames){
             branches.push_back(remoteName + "/" + remoteBranchName);
         }
     }
+    //refs being updated by another process have a lock file next to them
+    branches.erase(std::remove_if(branches.begin(), branches.end(), isLockName), branches.end());
     std::sort(branches.begin(), branches.end());
     return branches;
 }
\ No newline at end of file
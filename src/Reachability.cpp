@@ -0,0 +1,219 @@
+#include "../include/Utils.h"
+#include "../include/Reachability.h"
+#include "../include/BitmapIndex.h"
+#include "../include/Ewah.h"
+#include "../include/Pack.h"
+#include "../include/Pointers.h"
+#include "../include/Worktree.h"
+#include "../include/Commit.h"
+#include "../include/Tree.h"
+#include "../include/Shallow.h"
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <memory>
+
+//the first pack of a repository with valid bitmaps, if any
+struct Bitmapped{
+    std::unique_ptr<Pack> pack;
+    std::unique_ptr<BitmapIndex> index;
+
+    explicit Bitmapped(const std::string& repoPath){
+        for(auto& path : ObjectStore::packFiles(repoPath)){
+            if(!Utils::isFile(BitmapIndex::pathOf(path))) continue;
+            pack.reset(new Pack(path));
+            index.reset(new BitmapIndex(path, *pack));
+            if(index->is_valid()) return;
+            index.reset();
+            pack.reset();
+        }
+    }
+};
+
+//a set of objects: a bit for each one in the bitmapped pack, a key for the rest
+struct ObjectSet{
+    const BitmapIndex* index;
+    std::vector<uint64_t> words;
+    std::unordered_set<std::string> keys;
+    std::vector<Reachability::Object> walked;//objects outside the pack, in insertion order
+
+    explicit ObjectSet(const BitmapIndex* index) : index(index), words(index ? index->size() / 64 + 1 : 0) {}
+
+    bool position(ObjectStore::Kind kind, const ObjectId& id, uint32_t& pos) const{
+        return index && index->position(kind, id, pos);
+    }
+    bool contains(ObjectStore::Kind kind, const ObjectId& id) const{
+        uint32_t pos;
+        if(position(kind, id, pos)) return Ewah::test(words, pos);
+        return keys.count(static_cast<char>(kind) + id.hex()) > 0;
+    }
+    void insert(ObjectStore::Kind kind, const ObjectId& id){
+        uint32_t pos;
+        if(position(kind, id, pos)){
+            Ewah::set(words, pos);
+            return;
+        }
+        std::string hash = id.hex();
+        if(keys.insert(static_cast<char>(kind) + hash).second) walked.push_back({kind, hash});
+    }
+    //add everything a commit reaches from its bitmap, false if it has none
+    bool insertBitmap(const ObjectId& id){
+        uint32_t pos;
+        return position(ObjectStore::COMMIT, id, pos) && index->orBitmap(pos, words);
+    }
+};
+
+//helper function to add a tree, its subtrees and their blobs, leaving out what exclude holds
+//or known says the other side has
+static void walkTree(const ObjectId& id, ObjectSet& set, const ObjectSet* exclude, const Reachability::Known& known, const std::string& repoPath){
+    if(id.isNull() || set.contains(ObjectStore::TREE, id)) return;
+    if((exclude && exclude->contains(ObjectStore::TREE, id)) || (known && known(ObjectStore::TREE, id.hex()))) return;
+    set.insert(ObjectStore::TREE, id);
+    for(auto& entry : *Tree::load(id, repoPath)){
+        if(entry.isTree){
+            walkTree(entry.id, set, exclude, known, repoPath);
+        }else if(!set.contains(ObjectStore::BLOB, entry.id) && !(exclude && exclude->contains(ObjectStore::BLOB, entry.id))
+                 && !(known && known(ObjectStore::BLOB, entry.id.hex()))){
+            set.insert(ObjectStore::BLOB, entry.id);
+        }
+    }
+}
+
+//helper function to add the commits reachable from tips with their trees; a bitmapped commit
+//adds its bitmap and is not walked below, nor is a commit in stop
+static void walk(const std::vector<std::string>& tips, ObjectSet& set, const ObjectSet* exclude, const Reachability::Known& known, const std::string& repoPath, const std::unordered_set<std::string>* stop = nullptr){
+    std::vector<std::string> stack(tips.rbegin(), tips.rend());
+    while(!stack.empty()){
+        std::string hash = std::move(stack.back());
+        stack.pop_back();
+        ObjectId id = ObjectId::fromHex(hash);
+        if(set.contains(ObjectStore::COMMIT, id)) continue;
+        if((exclude && exclude->contains(ObjectStore::COMMIT, id)) || (known && known(ObjectStore::COMMIT, hash))) continue;
+        if(set.insertBitmap(id)) continue;
+        set.insert(ObjectStore::COMMIT, id);
+        std::shared_ptr<const Commit> commit = Commit::load(hash, repoPath);
+        //commits from before tree objects get their trees written here
+        walkTree(commit->getTree(), set, exclude, known, repoPath);
+        if(stop && stop->count(hash)) continue;
+        const std::vector<std::string>& parents = commit->getParents();
+        for(auto it = parents.rbegin(); it != parents.rend(); ++it) stack.push_back(*it);
+    }
+}
+
+std::vector<Reachability::Object> Reachability::missing(const std::vector<std::string>& wants, const std::vector<std::string>& haves, const std::string& repoPath, const Known& known){
+    Bitmapped bitmapped(repoPath);
+    ObjectSet have(bitmapped.index.get()), want(bitmapped.index.get());
+    walk(haves, have, nullptr, nullptr, repoPath);
+    walk(wants, want, &have, known, repoPath);
+    std::vector<Object> objects = std::move(want.walked);
+    for(size_t w = 0; w < want.words.size(); w++){
+        for(uint64_t bits = want.words[w] & ~have.words[w]; bits; bits &= bits - 1){
+            Pack::Entry entry = bitmapped.index->entryAt(static_cast<uint32_t>(w * 64 + __builtin_ctzll(bits)));
+            objects.push_back({static_cast<ObjectStore::Kind>(entry.kind), entry.id.hex()});
+        }
+    }
+    return objects;
+}
+
+//the walk down from the wants goes one generation at a time, so a commit is counted at the
+//shortest distance from a want
+std::vector<Reachability::Object> Reachability::missing(const std::vector<std::string>& wants, const std::vector<std::string>& haves, const std::string& repoPath, Limits& limits){
+    std::vector<Object> objects;
+    if(limits.depth <= 0 && limits.shallow.empty()){
+        objects = missing(wants, haves, repoPath);
+    }else{
+        //bitmaps reach below the other side's boundary, so everything is walked
+        ObjectSet have(nullptr), want(nullptr);
+        walk(haves, have, nullptr, nullptr, repoPath, &limits.shallow);
+        if(limits.depth <= 0){
+            walk(wants, want, &have, nullptr, repoPath);
+        }else{
+            std::unordered_set<std::string> seen;
+            std::vector<std::string> level(wants), next;
+            for(int depth = 1; !level.empty(); depth++){
+                for(auto& hash : level){
+                    if(!seen.insert(hash).second) continue;
+                    ObjectId id = ObjectId::fromHex(hash);
+                    bool had = have.contains(ObjectStore::COMMIT, id);
+                    bool wasShallow = limits.shallow.count(hash) > 0;
+                    std::shared_ptr<const Commit> commit = Commit::load(hash, repoPath);
+                    if(!had){
+                        want.insert(ObjectStore::COMMIT, id);
+                        walkTree(commit->getTree(), want, &have, nullptr, repoPath);
+                    }
+                    const std::vector<std::string>& parents = commit->getParents();
+                    if(parents.empty()) continue;
+                    if(depth >= limits.depth){
+                        //a commit the other side has keeps the boundary it has, as does one
+                        //whose parents it has
+                        bool complete = true;
+                        for(auto& parent : parents){
+                            complete = complete && have.contains(ObjectStore::COMMIT, ObjectId::fromHex(parent));
+                        }
+                        if(!had && !complete) limits.boundary.push_back(hash);
+                        continue;
+                    }
+                    if(wasShallow) limits.deepened.push_back(hash);
+                    next.insert(next.end(), parents.begin(), parents.end());
+                }
+                level.swap(next);
+                next.clear();
+            }
+        }
+        objects = std::move(want.walked);
+    }
+    //a commit at this side's own boundary is sent without its parents too
+    std::shared_ptr<const Shallow::Commits> own = Shallow::commits(repoPath);
+    if(!own->empty()){
+        std::unordered_set<std::string> boundary(limits.boundary.begin(), limits.boundary.end());
+        for(auto& object : objects){
+            if(object.kind == ObjectStore::COMMIT && own->count(object.hash) && boundary.insert(object.hash).second){
+                limits.boundary.push_back(object.hash);
+            }
+        }
+    }
+    return objects;
+}
+
+std::vector<Reachability::Object> Reachability::reachable(const std::vector<std::string>& tips, const std::string& repoPath){
+    return missing(tips, {}, repoPath);
+}
+
+bool Reachability::isAncestor(const std::string& ancestor, const std::string& descendant, const std::string& repoPath){
+    Bitmapped bitmapped(repoPath);
+    const BitmapIndex* index = bitmapped.index.get();
+    uint32_t target;
+    //the bitmapped pack holds everything its bitmaps reach
+    bool packed = index && index->position(ObjectStore::COMMIT, ObjectId::fromHex(ancestor), target);
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> stack{descendant};
+    while(!stack.empty()){
+        std::string hash = std::move(stack.back());
+        stack.pop_back();
+        if(hash == ancestor) return true;
+        if(!seen.insert(hash).second) continue;
+        uint32_t pos;
+        if(index && index->position(ObjectStore::COMMIT, ObjectId::fromHex(hash), pos)){
+            std::vector<uint64_t> words(index->size() / 64 + 1);
+            if(index->orBitmap(pos, words)){
+                if(packed && Ewah::test(words, target)) return true;
+                continue;
+            }
+        }
+        for(auto& parent : Commit::load(hash, repoPath)->getParents()) stack.push_back(parent);
+    }
+    return false;
+}
+
+std::vector<std::string> Reachability::refTips(const std::string& repoPath){
+    std::vector<std::string> tips;
+    for(auto& branch : Pointers::getBranches(repoPath)){
+        tips.push_back(Utils::readContentsAsString(Utils::join(repoPath, "branches", branch)));
+    }
+    std::vector<std::string> trees = Worktree::linked(repoPath);
+    trees.insert(trees.begin(), repoPath);
+    for(auto& tree : trees){
+        if(!Pointers::is_ref(tree)) tips.push_back(Utils::readContentsAsString(Utils::join(tree, "HEAD")));
+    }
+    return tips;
+}
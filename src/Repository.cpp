@@ -4,6 +4,22 @@
 #include "../include/Stage.h"
 #include "../include/Commit.h"
 #include "../include/Blob.h"
+#include "../include/CommitGraph.h"
+#include "../include/MessageIndex.h"
+#include "../include/Tree.h"
+#include "../include/WorkingTree.h"
+#include "../include/FsMonitor.h"
+#include "../include/LockFile.h"
+#include "../include/ObjectStore.h"
+#include "../include/GarbageCollector.h"
+#include "../include/Maintenance.h"
+#include "../include/Reachability.h"
+#include "../include/Transport.h"
+#include "../include/Worktree.h"
+#include "../include/SparseCheckout.h"
+#include "../include/Diff.h"
+#include "../include/Blame.h"
+#include "../include/GitliteException.h"
 
 #include <string>
 #include <map>
@@ -11,87 +27,164 @@
 #include <iostream>
 #include <ctime>
 #include <queue>
-#include <filesystem>
+#include <numeric>
+#include <algorithm>
+#include <regex>
+#include <chrono>
+#include <unordered_set>
+#include <thread>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
 
 
-std::string Repository::getGitliteDir(){
-    return ".gitlite";
+//commands nest (merge runs add and commit): the working-directory scan and the stage lock taken
+//by one are kept until the outermost returns, and then dropped, since the directory may change
+//before the next command
+struct Repository::Command{
+    Repository& repo;
+    explicit Command(Repository& repo) : repo(repo) { repo.running++; }
+    ~Command(){
+        if(--repo.running > 0) return;
+        try{
+            repo.dropWorkingTree();
+        }catch(const std::exception&){//the caches are only an optimization
+        }
+        repo.stageLock.reset();
+    }
+};
+
+Repository::Repository(const std::string& root, std::ostream& out)
+    : root(root), gitliteDir(Utils::join(root, ".gitlite")), out(out), running(0), maintenancePending(false), progress(false) {
+    //paths stay as the user typed them in the current directory
+    if(root == ".") gitliteDir = ".gitlite";
+    worktreeDir = gitliteDir;
+    gitliteDir = Worktree::commonDir(worktreeDir);
+}
+Repository::~Repository() = default;
+
+const std::string& Repository::getGitliteDir() const{
+    return gitliteDir;
+}
+std::string Repository::workPath(const std::string& filename) const{
+    return root == "." ? filename : Utils::join(root, filename);
+}
+//a relative remote path is relative to the working directory
+//an "ext::<command>" address runs the remote side as a command (see Transport)
+static bool isExtAddress(const std::string& address){
+    return address.compare(0, 5, "ext::") == 0;
+}
+
+std::string Repository::remotePath(const std::string& remotename) const{
+    std::string remotepath = Utils::readContentsAsString(Utils::join(gitliteDir, "remotes", remotename));
+    if(remotepath.empty() || remotepath[0] == '/' || isExtAddress(remotepath)) return remotepath;
+    return workPath(remotepath);
 }
 
 //get commit hash of current HEAD
-std::string Repository::getHEAD(){
-    std::string head = Utils::readContentsAsString(".gitlite/HEAD");
-    size_t pos = head.find("ref: ");
-    if(pos != std::string::npos){
-        std::string branch = head.substr(5);
-        head = Utils::readContentsAsString(branch);
+std::string Repository::getHEAD() const{
+    if(Pointers::is_ref(worktreeDir)){
+        return Utils::readContentsAsString(Utils::join(gitliteDir, "branches", Pointers::get_ref(worktreeDir)));
     }
-    return head;
+    return Utils::readContentsAsString(Utils::join(worktreeDir, "HEAD"));
 }
 //get current commit
-Commit Repository::getCurrentCommit(){
+std::shared_ptr<const Commit> Repository::getCurrentCommit() const{
     std::string hash = getHEAD();
-    return Commit(hash);
+    return Commit::load(hash, gitliteDir);
+}
+//commands that change the stage hold its lock from before they read it, so concurrent writers
+//take turns; readers never lock it, since a stage change is one rename or one appended record
+void Repository::lockStage(){
+    if(!stageLock) stageLock.reset(new LockFile(Utils::join(worktreeDir, "stage")));
+}
+//move HEAD (or the branch it points to) from old to hash
+void Repository::updateHEAD(const std::string& hash, const std::string& old){
+    if(Pointers::is_ref(worktreeDir)){
+        Pointers::updateRef("branches/" + Pointers::get_ref(worktreeDir), hash, old, gitliteDir);
+    }else{
+        Pointers::updateRef("HEAD", hash, old, worktreeDir);
+    }
 }
 //get current stage
+//the last stage parsed is kept with the file content it came from, so later commands that find
+//the file unchanged copy it instead of parsing it again
 Stage Repository::getCurrentStage(){
-    return Stage(Utils::readContentsAsString(".gitlite/stage"));
+    std::string content = Utils::readContentsAsString(Utils::join(worktreeDir, "stage"));
+    if(!parsedStage || content != parsedStageContent){
+        parsedStage.reset(new Stage(content, worktreeDir));
+        parsedStageContent = std::move(content);
+    }
+    return *parsedStage;
+}
+//scan the working directory once per command, against the stage and current commit
+WorkingTree& Repository::scanWorkingTree(const Stage& stage, const Commit& commit){
+    if(!workingTree){
+        //the stage file and HEAD identify what is tracked, for the untracked cache
+        std::string key = commit.getHash() + ":" + Utils::sha1(Utils::readContentsAsString(Utils::join(worktreeDir, "stage")));
+        WorkingTree::TrackedFiles tracked{commit.getFiles(), stage.getAdd(), stage.getRm(), key};
+        workingTree.reset(new WorkingTree(root, tracked));
+    }
+    return *workingTree;
+}
+//save the caches and drop the scan, after the command has written working files
+void Repository::dropWorkingTree(){
+    std::unique_ptr<WorkingTree> tree = std::move(workingTree);
+    if(tree) tree->saveCache();
 }
 //get untracked files
-std::map<std::string, int> Repository::getUntrackedFiles(){
-    std::vector<std::string> file_names_in_workdir = Utils::plainFilenamesIn(".");
-    std::map<std::string, int> untrackedfiles;
+//files matched by .gitliteignore are never untracked
+PathSet Repository::getUntrackedFiles(){
+    PathSet untrackedfiles;
     Stage stage = getCurrentStage();
-    Commit commit = getCurrentCommit();
-    for(auto& name : file_names_in_workdir){
-        if(stage.is_in_rm(name)){
-            untrackedfiles[name] = 1;
-            continue;
-        }
-        if(!stage.is_in_add(name) && !commit.in_commit(name)){
-            untrackedfiles[name] = 1;
-        }
+    std::shared_ptr<const Commit> commit = getCurrentCommit();
+    for(auto& file : scanWorkingTree(stage, *commit)){
+        if(file.untracked) untrackedfiles.insert(file.name());
     }
     return untrackedfiles;
 }
 
-bool Repository::is_initialized(){
-    return Utils::isDirectory(".gitlite");
+bool Repository::isInitialized() const{
+    return Utils::isDirectory(gitliteDir);
 }
 void Repository::init(){
+    Command command(*this);
     //check whether there is already a .gitlite dir
-    if(Repository::is_initialized()){
+    if(isInitialized()){
         Utils::exitWithMessage("A Gitlite version-control system already exists in the current directory.");
     }
     //create .gitlite
-    Utils::createDirectories(".gitlite");
-    Utils::createDirectories(".gitlite/branches");
-    Utils::writeContents(".gitlite/HEAD", "ref: .gitlite/branches/master");
-    Utils::writeContents(".gitlite/stage", "");//stage for addition and removal
-    Utils::createDirectories(".gitlite/commits");
-    Utils::createDirectories(".gitlite/blobs");
-    Utils::createDirectories(".gitlite/remotes");
+    Utils::createDirectories(gitliteDir);
+    Utils::createDirectories(Utils::join(gitliteDir, "branches"));
+    Pointers::set_ref("master", gitliteDir);
+    Utils::writeContents(Utils::join(gitliteDir, "stage"), "");//stage for addition and removal
+    Utils::createDirectories(Utils::join(gitliteDir, "commits"));
+    Utils::createDirectories(Utils::join(gitliteDir, "blobs"));
+    Utils::createDirectories(Utils::join(gitliteDir, "trees"));
+    Utils::createDirectories(Utils::join(gitliteDir, "remotes"));
+    CommitGraph::rebuild(gitliteDir);//empty commit-graph and message index
     //init commit
-    Commit initialCommit;
+    Commit initialCommit = Commit::initial(gitliteDir);
     initialCommit.writeCommitFile();
-    Utils::writeContents(".gitlite/branches/master", initialCommit.getHash());
+    Utils::writeContents(Utils::join(gitliteDir, "branches", "master"), initialCommit.getHash());
 }
 
-
 void Repository::add(const std::string& filename){
-    if(!Utils::isFile(filename)){
+    Command command(*this);
+    if(!Utils::isFile(workPath(filename))){
         Utils::exitWithMessage("File does not exist.");
     }
 
+    lockStage();
     Stage stage = getCurrentStage();
 
-    std::vector<unsigned char> blobContent = Utils::readContents(filename);
+    std::vector<unsigned char> blobContent = Utils::readContents(workPath(filename));
     std::string hash = Utils::sha1(blobContent);
-    Blob::createBlob(blobContent);
+    Blob::createBlob(blobContent, gitliteDir);
 
     //get current commit
-    Commit currentCommit = getCurrentCommit();
-    if(currentCommit.in_commit(filename) && currentCommit.getBlob(filename) == hash){//same as current commit
+    std::shared_ptr<const Commit> currentCommit = getCurrentCommit();
+    if(currentCommit->in_commit(filename) && currentCommit->getBlob(filename) == hash){//same as current commit
         if(stage.is_in_add(filename)){
             stage.deleteAdd(filename);
         }
@@ -108,14 +201,16 @@ void Repository::add(const std::string& filename){
     stage.writeStageFile();
 }
 void Repository::rm(const std::string& filename){
+    Command command(*this);
+    lockStage();
     Stage stage = getCurrentStage();
 
     //get current commit
-    Commit currentCommit = getCurrentCommit();
-    if(currentCommit.in_commit(filename)){//in current commit
+    std::shared_ptr<const Commit> currentCommit = getCurrentCommit();
+    if(currentCommit->in_commit(filename)){//in current commit
         if(stage.is_in_add(filename)) stage.deleteAdd(filename);
         stage.rm(filename);
-        Utils::restrictedDelete(filename);
+        Utils::restrictedDelete(filename, root);
     }else if(stage.is_in_add(filename)){
         stage.deleteAdd(filename);
     }else{
@@ -126,13 +221,15 @@ void Repository::rm(const std::string& filename){
 }
 
 void Repository::commit(const std::string& message, bool isMerge, const std::string& mergeParent){
+    Command command(*this);
     if(message.empty()){
         Utils::exitWithMessage("Please enter a commit message.");
     }
+    lockStage();
     //get parent commit from HEAD
     std::string parentHash = getHEAD();
     //construct current from parent
-    Commit commit(parentHash);
+    Commit commit = *Commit::load(parentHash, gitliteDir);
     commit.setMessage(message);
     commit.setTime();
     commit.resetParent(parentHash);
@@ -141,80 +238,158 @@ void Repository::commit(const std::string& message, bool isMerge, const std::str
     }
     //stage
     Stage stage = getCurrentStage();
-    std::map<std::string, std::string> addition = stage.getAdd();
-    std::map<std::string, int> removal = stage.getRm();
+    const Manifest& addition = stage.getAdd();
+    const PathSet& removal = stage.getRm();
     //modify commit
     if(!isMerge && addition.empty() && removal.empty()){
         Utils::exitWithMessage("No changes added to the commit.");
     }
-    commit.addFiles(addition);
-    commit.rmFiles(removal);
-    stage.clear();
+    commit.updateFiles(addition, removal);
     //writefile
     commit.writeCommitFile();
-    //reset HEAD
-    if(Pointers::is_ref()){
-        std::string branch = Pointers::get_ref();
-        //change branch only
-        Utils::writeContents(".gitlite/branches/" + branch, commit.getHash());
-    }else{
-        Utils::writeContents(".gitlite/HEAD", commit.getHash());
-    }
+    //reset HEAD (the branch only, if HEAD is on one); the stage is kept if another process moved it
+    updateHEAD(commit.getHash(), parentHash);
+    stage.clear();
+    maintenancePending = true;
 }
 
 //log
 //helper function to get format time
-static std::string formatTime(time_t timestamp){
+static std::string formatTime(time_t timestamp, const char* format = "%a %b %d %H:%M:%S %Y %z"){
     char buffer[40];
     struct tm timeinfo;
     localtime_r(&timestamp, &timeinfo);
-    std::strftime(buffer, sizeof(buffer), "%a %b %d %H:%M:%S %Y %z", &timeinfo);
+    std::strftime(buffer, sizeof(buffer), format, &timeinfo);
     return std::string(buffer);
 }
 //helper function for format output
-static void formatOutput(const std::string& hash, const Commit& commit){
-    std::string message = commit.getMessage();
-    time_t timestamp = commit.getTimestamp();
+static void formatOutput(std::ostream& out, const std::string& hash, std::string_view message, time_t timestamp, const std::vector<std::string>& parents){
     std::string outputTime = formatTime(timestamp);
-    std::vector<std::string> parents = commit.getParents();
 
-    std::cout << "===\n";
-    std::cout << "commit " << hash << "\n";
+    out << "===\n";
+    out << "commit " << hash << "\n";
     if(parents.size() > 1){
         std::string p1 = parents[0].substr(0, 7);
         std::string p2 = parents[1].substr(0, 7);
-        std::cout << "Merge: " << p1 << " " << p2 << "\n";
+        out << "Merge: " << p1 << " " << p2 << "\n";
     }
-    std::cout << "Date: " << outputTime << "\n";
-    std::cout << message << "\n\n";
+    out << "Date: " << outputTime << "\n";
+    out << message << "\n\n";
+}
+void Repository::formatOutput(const std::string& hash, const Commit& commit){
+    ::formatOutput(out, hash, commit.getMessage(), commit.getTimestamp(), commit.getParents());
+}
+//helper function to get commit-graph rows in hash order (the order of .gitlite/commits)
+static std::vector<size_t> rowsByHash(const CommitGraph& graph){
+    std::vector<size_t> rows(graph.size());
+    std::iota(rows.begin(), rows.end(), 0);
+    std::sort(rows.begin(), rows.end(), [&graph](size_t a, size_t b){
+        return graph.getHash(a) < graph.getHash(b);
+    });
+    return rows;
 }
 //helper function to output branch
-static void outputBranch(const std::string hash){
-    Commit commit(hash);
-    formatOutput(hash, commit);
-    if(commit.getMessage() == "initial commit") return;
-    std::string nextHash = commit.getFirstParent();
-    outputBranch(nextHash);
+void Repository::outputBranch(std::string hash){
+    while(true){
+        std::shared_ptr<const Commit> commit = Commit::load(hash, gitliteDir);
+        formatOutput(hash, *commit);
+        if(commit->getParents().empty()) return;
+        hash = commit->getFirstParent();
+    }
 }
 void Repository::log(){
+    Command command(*this);
     std::string hash = getHEAD();
     outputBranch(hash);
 }
+//log -- path: commits on the first-parent history of HEAD that changed the path
+//commits whose changed-path filter rules the path out are skipped without being read
+void Repository::logPath(const std::string& path, bool stats){
+    Command command(*this);
+    CommitGraph graph = CommitGraph::open(gitliteDir);
+    BloomFilter::Key key = BloomFilter::keyFor(path);
+    size_t checked = 0, skipped = 0, falsePositives = 0;
+    std::string hash = getHEAD();
+    while(true){
+        checked++;
+        size_t row;
+        bool inGraph = graph.findRow(hash, row);
+        std::vector<std::string> parents;
+        if(inGraph && !graph.mayHaveChanged(row, key)){
+            skipped++;
+            parents = graph.getParents(row);
+        }else{
+            std::shared_ptr<const Commit> commit = Commit::load(hash, gitliteDir);
+            parents = commit->getParents();
+            std::vector<std::string> changed = CommitGraph::changedPaths(*commit, gitliteDir);
+            if(std::binary_search(changed.begin(), changed.end(), path)){
+                formatOutput(hash, *commit);
+            }else if(inGraph && graph.hasBloom()){
+                falsePositives++;
+            }
+        }
+        if(parents.empty()) break;
+        hash = parents[0];
+    }
+    if(stats){
+        //false-positive rate: of the commits that did not touch the path, how many the filters let through
+        size_t untouched = skipped + falsePositives;
+        double rate = untouched ? 100.0 * falsePositives / untouched : 0.0;
+        std::ostringstream line;
+        line << "Bloom filters: " << checked << " commits, " << skipped << " skipped, "
+             << falsePositives << " false positives (" << std::fixed << std::setprecision(2) << rate << "%)";
+        if(!graph.hasBloom()) line << ", filters unavailable";
+        out << line.str() << std::endl;
+    }
+}
+//"<commit> (<date> <line number>) <line>" for each line
+void Repository::blame(const std::string& path, bool stats){
+    Command command(*this);
+    std::string hash = getHEAD();
+    std::shared_ptr<const Commit> commit = Commit::load(hash, gitliteDir);
+    ObjectId blob;
+    if(!Tree::lookup(commit->getTree(), path, blob, gitliteDir)){
+        Utils::exitWithMessage("File does not exist in that commit.");
+    }
+    Blame::Stats work;
+    std::shared_ptr<const Blame::Lines> origins = Blame::of(hash, path, work, gitliteDir);
+    std::string content = Blob::readBlobContentsAsString(blob.hex(), gitliteDir);
+    std::vector<std::string_view> lines = Diff::splitLines(content);
+    std::map<std::string, std::string> dates;
+    size_t width = std::to_string(lines.size()).size();
+    std::ostringstream text;
+    for(size_t i = 0; i < lines.size(); i++){
+        std::string origin = (*origins)[i].commit.hex();
+        auto date = dates.find(origin);
+        if(date == dates.end()){
+            date = dates.emplace(origin, formatTime(Commit::load(origin, gitliteDir)->getTimestamp(), "%Y-%m-%d %H:%M:%S %z")).first;
+        }
+        std::string_view line = lines[i];
+        if(!line.empty() && line.back() == '\n') line.remove_suffix(1);
+        text << origin.substr(0, 8) << " (" << date->second << " " << std::setw(width) << i + 1 << ") " << line << "\n";
+    }
+    out << text.str();
+    if(stats){
+        out << "Blame: " << work.walked << " commits walked, " << work.skipped << " skipped, "
+            << work.diffed << " versions diffed, " << work.cached << " from cache" << std::endl;
+    }
+}
 void Repository::globalLog(){
-    std::vector<std::string> hashes = Utils::plainFilenamesIn(".gitlite/commits");
-    for(auto& hash : hashes){
-        Commit commit(hash);
-        formatOutput(hash, commit);
+    Command command(*this);
+    CommitGraph graph = CommitGraph::open(gitliteDir);
+    for(size_t row : rowsByHash(graph)){
+        std::string hash(graph.getHash(row));
+        ::formatOutput(out, hash, graph.getMessage(row), graph.getTimestamp(row), graph.getParents(row));
     }
 }
 
 void Repository::find(const std::string& message){
-    std::vector<std::string> hashes = Utils::plainFilenamesIn(".gitlite/commits");
+    Command command(*this);
+    CommitGraph graph = CommitGraph::open(gitliteDir);
     bool found = false;
-    for(auto& hash : hashes){
-        Commit commit(hash);
-        if(commit.getMessage() == message){
-            std::cout<<hash<<"\n";
+    for(size_t row : rowsByHash(graph)){
+        if(graph.getMessage(row) == message){
+            out<<graph.getHash(row)<<"\n";
             if(!found) found = true;
         }
     }
@@ -222,48 +397,106 @@ void Repository::find(const std::string& message){
         Utils::exitWithMessage("Found no commit with that message.");
     }
 }
+//find commits whose message contains a substring or matches a regex
+//the trigram index narrows the rows to check; each candidate is then verified
+void Repository::findMatching(const std::string& pattern, bool isRegex){
+    Command command(*this);
+    std::regex re;
+    if(isRegex){
+        try{
+            re = std::regex(pattern);
+        }catch(const std::regex_error&){
+            Utils::exitWithMessage("Invalid regular expression.");
+        }
+    }
+    CommitGraph graph = CommitGraph::open(gitliteDir);
+    std::vector<std::string> literals;
+    if(isRegex) literals = MessageIndex::requiredLiterals(pattern);
+    else literals.push_back(pattern);
+    std::vector<uint32_t> rows;
+    if(!MessageIndex::candidates(literals, graph.size(), rows, gitliteDir)){
+        //no index, or nothing long enough to look up: check every row
+        rows.resize(graph.size());
+        std::iota(rows.begin(), rows.end(), 0);
+    }
+    std::vector<std::string> found;
+    for(uint32_t row : rows){
+        std::string_view message = graph.getMessage(row);
+        bool match = isRegex ? std::regex_search(message.begin(), message.end(), re)
+                             : message.find(pattern) != std::string_view::npos;
+        if(match) found.push_back(std::string(graph.getHash(row)));
+    }
+    if(found.empty()){
+        Utils::exitWithMessage("Found no commit with that message.");
+    }
+    std::sort(found.begin(), found.end());
+    for(auto& hash : found){
+        out<<hash<<"\n";
+    }
+}
+//rebuild the commit metadata store from the commit files, for recovery
+void Repository::writeCommitGraph(){
+    Command command(*this);
+    CommitGraph::rebuild(gitliteDir);
+}
+//delete unreachable objects older than expiry seconds, and pack the rest if asked
+//the stage lock keeps commands in this repository from adding objects while gc runs
+void Repository::gc(bool repack, int64_t expiry){
+    Command command(*this);
+    auto start = std::chrono::steady_clock::now();
+    lockStage();
+    GarbageCollector::Result result = GarbageCollector::collect(expiry, repack, gitliteDir);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    out<<"Marked "<<result.reachable<<" reachable objects, removed "<<result.pruned<<" unreachable objects";
+    if(repack) out<<", packed "<<result.packed<<" objects";
+    out<<".\n";
+    uint64_t reclaimed = result.bytesBefore > result.bytesAfter ? result.bytesBefore - result.bytesAfter : 0;
+    out<<"Object storage: "<<result.bytesBefore<<" -> "<<result.bytesAfter<<" bytes ("<<reclaimed<<" reclaimed) in "<<elapsed<<" ms.\n";
+}
 
 
 //checkout
 void Repository::checkoutFile(const std::string& filename){
-    Commit commit = getCurrentCommit();
-    if(!commit.in_commit(filename)){
+    Command command(*this);
+    std::shared_ptr<const Commit> commit = getCurrentCommit();
+    if(!commit->in_commit(filename)){
         Utils::exitWithMessage("File does not exist in that commit.");
     }
-    std::string blob = commit.getBlob(filename);
-    std::vector<unsigned char> content = Blob::readBlobContents(blob);
-    Utils::writeContents(filename, content);
+    std::string blob = commit->getBlob(filename);
+    std::vector<unsigned char> content = Blob::readBlobContents(blob, gitliteDir);
+    Utils::writeContents(workPath(filename), content);
 }
 void Repository::checkoutFileInCommit(const std::string& hash, const std::string& filename){
+    Command command(*this);
     //normal commit id
     if(hash.size() == 40){
         //whether commit exist
-        if(!Utils::isFile(".gitlite/commits/" + hash)){
+        if(!ObjectStore::contains(ObjectStore::COMMIT, hash, gitliteDir)){
             Utils::exitWithMessage("No commit with that id exists.");
         }
         //whether have filename
-        Commit commit(hash);
-        if(!commit.in_commit(filename)){
+        std::shared_ptr<const Commit> commit = Commit::load(hash, gitliteDir);
+        if(!commit->in_commit(filename)){
             Utils::exitWithMessage("File does not exist in that commit.");
         }
-        std::string blob = commit.getBlob(filename);
-        std::vector<unsigned char> content = Blob::readBlobContents(blob);
-        Utils::writeContents(filename, content);
+        std::string blob = commit->getBlob(filename);
+        std::vector<unsigned char> content = Blob::readBlobContents(blob, gitliteDir);
+        Utils::writeContents(workPath(filename), content);
         return;
     }
     //short commit id
-    std::vector<std::string> Hashes = Utils::plainFilenamesIn(".gitlite/commits");
+    std::vector<std::string> Hashes = ObjectStore::list(ObjectStore::COMMIT, gitliteDir);
     size_t length = hash.length();
     bool found = false;
     for(auto& Hash : Hashes){
         std::string shortHash = Hash.substr(0, length);
         if(shortHash == hash){
             if(!found) found = true;
-            Commit commit(Hash);
-            if(commit.in_commit(filename)){
-                std::string blob = commit.getBlob(filename);
-                std::vector<unsigned char> content = Blob::readBlobContents(blob);
-                Utils::writeContents(filename, content);
+            std::shared_ptr<const Commit> commit = Commit::load(Hash, gitliteDir);
+            if(commit->in_commit(filename)){
+                std::string blob = commit->getBlob(filename);
+                std::vector<unsigned char> content = Blob::readBlobContents(blob, gitliteDir);
+                Utils::writeContents(workPath(filename), content);
                 return;
             }
         }
@@ -277,16 +510,17 @@ void Repository::checkoutFileInCommit(const std::string& hash, const std::string
 //helper function to checkout a commit (check untracked file, delete and write, and clear stage)
 void Repository::checkoutCommit(const std::string& hash){
     Stage stage = getCurrentStage();
-    Commit commit(hash);
-    std::map<std::string, std::string> files = commit.getFiles();
-    std::vector<std::string> file_names_in_workdir = Utils::plainFilenamesIn(".");
-    Commit current_commit = getCurrentCommit();
+    std::shared_ptr<const Commit> currentCommit = getCurrentCommit();
+    std::shared_ptr<const Commit> commit = Commit::load(hash, gitliteDir);
+    const Manifest& files = commit->getFiles();
+    const Manifest& tracked = currentCommit->getFiles();
+    WorkingTree& workdir = scanWorkingTree(stage, *currentCommit);
+    SparseCheckout sparse = SparseCheckout::load(worktreeDir);
 
     //check untracked file
-    std::map<std::string,int> untrackedfiles = getUntrackedFiles();
     bool willCover = false;
-    for(auto& file : untrackedfiles){
-        if(commit.in_commit(file.first)){
+    for(auto& work : workdir){
+        if(work.untracked && files.contains(work.name())){
             willCover = true;
             break;
         }
@@ -295,153 +529,257 @@ void Repository::checkoutCommit(const std::string& hash){
         Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
     }
 
-    //delete
-    for(auto& name : file_names_in_workdir){
-        if(untrackedfiles.count(name)) continue;
-        Utils::restrictedDelete(name);
-    }
-    //write
-    for(auto& file : files){
-        std::vector<unsigned char> content = Blob::readBlobContents(file.second);
-        Utils::writeContents(file.first, content);
+    //one pass over the working files and the commit, both sorted by name:
+    //tracked files the commit does not have are deleted, files whose content differs are written
+    //(the scan has no files outside the sparse set, and none are written there)
+    auto work = workdir.begin();
+    auto file = files.begin();
+    while(work != workdir.end() || file != files.end()){
+        if(file == files.end() || (work != workdir.end() && work->name() < file->name())){
+            const std::string& name = work->name();
+            if(!stage.is_in_rm(name) && (stage.is_in_add(name) || tracked.contains(name))) Utils::restrictedDelete(name, root);
+            ++work;
+            continue;
+        }
+        bool inWorkdir = work != workdir.end() && work->name() == file->name();
+        if(inWorkdir ? workdir.idOf(*work) != file->id : sparse.contains(file->name())){
+            std::vector<unsigned char> content = Blob::readBlobContents(file->id.hex(), gitliteDir);
+            Utils::writeContents(workPath(file->name()), content);
+        }
+        if(inWorkdir) ++work;
+        ++file;
     }
 
     stage.clear();
+    dropWorkingTree();
 }
 void Repository::checkoutBranch(const std::string& branchname){
-    if(!Utils::isFile(".gitlite/branches/" + branchname)){
+    Command command(*this);
+    std::string branchPath = Utils::join(gitliteDir, "branches", branchname);
+    if(!Utils::isFile(branchPath)){
         Utils::exitWithMessage("No such branch exists.");
     }
-    if(Pointers::is_ref() && Pointers::get_ref() == branchname){
+    if(Pointers::is_ref(worktreeDir) && Pointers::get_ref(worktreeDir) == branchname){
         Utils::exitWithMessage("No need to checkout the current branch.");
     }
 
-    std::string commithash = Utils::readContentsAsString(".gitlite/branches/" + branchname);
+    LockFile worktrees(Utils::join(gitliteDir, "worktrees"));
+    if(!Worktree::holderOf(branchname, worktreeDir, gitliteDir).empty()){
+        Utils::exitWithMessage("That branch is checked out in another worktree.");
+    }
+    lockStage();
+    std::string commithash = Utils::readContentsAsString(branchPath);
     checkoutCommit(commithash);
-    Pointers::set_ref(branchname);
+    Pointers::set_ref(branchname, worktreeDir);
+    worktrees.release();
 }
 
 
 //status
 void Repository::status(){
+    Command command(*this);
     //branches
-    std::vector<std::string> branches = Pointers::getBranches();//this function returns an ordered vector
+    std::vector<std::string> branches = Pointers::getBranches(gitliteDir);//this function returns an ordered vector
     std::string current = "";
-    if(Pointers::is_ref()){
-        current = Pointers::get_ref();
+    if(Pointers::is_ref(worktreeDir)){
+        current = Pointers::get_ref(worktreeDir);
     }
-    std::cout<<"=== Branches ===\n";
+    out<<"=== Branches ===\n";
     for(auto& branch : branches){
         if(branch == current){
-            std::cout<<"*"<<branch<<"\n";
+            out<<"*"<<branch<<"\n";
         }else{
-            std::cout<<branch<<"\n";
+            out<<branch<<"\n";
         }
     }
-    std::cout<<"\n";
+    out<<"\n";
 
     //stage
     Stage stage = getCurrentStage();
     //staged files
-    std::map<std::string, std::string> addition = stage.getAdd();//map is ordered
-    std::cout<<"=== Staged Files ===\n";
+    const Manifest& addition = stage.getAdd();//sorted by name
+    out<<"=== Staged Files ===\n";
     for(auto& add : addition){
-        std::cout<<add.first<<"\n";
+        out<<add.name()<<"\n";
     }
-    std::cout<<"\n";
+    out<<"\n";
     //removed files
-    std::map<std::string, int> removal = stage.getRm();
-    std::cout<<"=== Removed Files ===\n";
+    const PathSet& removal = stage.getRm();
+    out<<"=== Removed Files ===\n";
     for(auto& rm : removal){
-        std::cout<<rm.first<<"\n";
+        out<<*rm<<"\n";
     }
-    std::cout<<"\n";
+    out<<"\n";
 
     //Modifications Not Staged For Commit
-    Commit commit = getCurrentCommit();
-    std::map<std::string, std::string> files_in_commit = commit.getFiles();//second is hash of content
-    std::vector<std::string> files_names_in_workdir= Utils::plainFilenamesIn(".");
-    std::map<std::string, int> modNotStaged;//0 marks delete, 1 marks modify
-    std::map<std::string, std::string> files_in_workdir;//second is hash of content
-    for(auto& file : files_names_in_workdir){
-        std::vector <unsigned char> content = Utils::readContents(file);
-        files_in_workdir[file] = Utils::sha1(content);
-    }
-    for(auto& file : files_in_commit){
-        std::string name = file.first;
-        if(files_in_workdir.count(name) && files_in_workdir[name] != files_in_commit[name] && !stage.is_in_add(name)){
-            modNotStaged[name] = 1;
-        }
-        if(!files_in_workdir.count(name) && !stage.is_in_rm(name)){
-            modNotStaged[name] = 0;
-        }
-    }
-    for(auto& file : addition){
-        std::string name = file.first;
-        if(files_in_workdir.count(name)){
-            if(file.second != files_in_workdir[name]){
-                modNotStaged[name] = 1;
-            }
-        }else{
-            modNotStaged[name] = 0;
-        }
+    std::shared_ptr<const Commit> commit = getCurrentCommit();
+    const Manifest& files_in_commit = commit->getFiles();
+    WorkingTree& workdir = scanWorkingTree(stage, *commit);
+    //files outside the sparse set are not in the working directory, and not deleted
+    SparseCheckout sparse = SparseCheckout::load(worktreeDir);
+    //id is hash of content, from the stat cache for unchanged files; only tracked files are needed
+    Manifest files_in_workdir;
+    for(auto& file : workdir){
+        if(!file.untracked) files_in_workdir.append(file.path, workdir.idOf(file), workdir.pathRefs());
     }
-    std::cout<<"=== Modifications Not Staged For Commit ===\n";
+    workdir.saveCache();
+    typedef std::pair<const std::string*, int> Modification;//0 marks delete, 1 marks modify
+    std::vector<Modification> fromCommit, fromStage;
+    Manifest::mergeJoin(files_in_commit, files_in_workdir, [&](const std::string* name, const ObjectId* committed, const ObjectId* working){
+        if(!committed) return;
+        if(working && *working != *committed && !stage.is_in_add(*name)){
+            fromCommit.push_back({name, 1});
+        }
+        if(!working && !stage.is_in_rm(*name) && sparse.contains(*name)){
+            fromCommit.push_back({name, 0});
+        }
+    });
+    Manifest::mergeJoin(addition, files_in_workdir, [&](const std::string* name, const ObjectId* staged, const ObjectId* working){
+        if(!staged) return;
+        if(!working){
+            if(sparse.contains(*name)) fromStage.push_back({name, 0});
+        }
+        else if(*working != *staged) fromStage.push_back({name, 1});
+    });
+    //both lists are sorted; a name in both has the same mark
+    std::vector<Modification> modNotStaged;
+    auto byName = [](const Modification& a, const Modification& b){ return *a.first < *b.first; };
+    std::merge(fromCommit.begin(), fromCommit.end(), fromStage.begin(), fromStage.end(), std::back_inserter(modNotStaged), byName);
+    modNotStaged.erase(std::unique(modNotStaged.begin(), modNotStaged.end(), [](const Modification& a, const Modification& b){
+        return a.first == b.first;
+    }), modNotStaged.end());
+    out<<"=== Modifications Not Staged For Commit ===\n";
     for(auto& file : modNotStaged){
-        std::cout<<file.first;
+        out<<*file.first;
         if(file.second == 0){
-            std::cout<<" (deleted)\n";
+            out<<" (deleted)\n";
         }else{
-            std::cout<<" (modified)\n";
+            out<<" (modified)\n";
         }
     }
-    std::cout<<"\n";
+    out<<"\n";
 
     //Untracked Files
-    std::map<std::string, int> untrackedFiles = getUntrackedFiles();
-    std::cout<<"=== Untracked Files ===\n";
+    PathSet untrackedFiles = getUntrackedFiles();
+    out<<"=== Untracked Files ===\n";
     for(auto& untrackedFile : untrackedFiles){
-        std::cout<<untrackedFile.first<<"\n";
+        out<<*untrackedFile<<"\n";
+    }
+}
+//the commit a branch name, a commit id or a unique abbreviation of one names
+std::string Repository::resolveCommit(const std::string& rev) const{
+    std::string branchPath = Utils::join(gitliteDir, "branches", rev);
+    if(!rev.empty() && Utils::isFile(branchPath)) return Utils::readContentsAsString(branchPath);
+    if(rev.size() == Utils::UID_LENGTH && ObjectStore::contains(ObjectStore::COMMIT, rev, gitliteDir)) return rev;
+    std::string found;
+    if(!rev.empty() && rev.size() < Utils::UID_LENGTH){
+        for(auto& hash : ObjectStore::list(ObjectStore::COMMIT, gitliteDir)){
+            if(hash.compare(0, rev.size(), rev) != 0) continue;
+            if(!found.empty()) Utils::exitWithMessage("That commit id is ambiguous.");
+            found = hash;
+        }
+    }
+    if(found.empty()) Utils::exitWithMessage("No commit with that id exists.");
+    return found;
+}
+//only paths whose blob ids differ are diffed; between two commits, subtrees with the same id are
+//not even read (see Tree::diff)
+void Repository::diff(const std::string& from, const std::string& to, bool stat){
+    Command command(*this);
+    std::vector<Diff::File> files;
+    auto change = [&](const std::string& name, const ObjectId* before, const ObjectId* after){
+        Diff::File file;
+        if(before){
+            file.oldPath = name;
+            file.oldId = *before;
+        }
+        if(after){
+            file.newPath = name;
+            file.newId = *after;
+        }
+        files.push_back(std::move(file));
+    };
+    Diff::Reader readBlob = [&](const std::string&, const ObjectId& id){
+        return Blob::readBlobContentsAsString(id.hex(), gitliteDir);
+    };
+    if(!to.empty()){
+        std::shared_ptr<const Commit> before = Commit::load(resolveCommit(from), gitliteDir);
+        std::shared_ptr<const Commit> after = Commit::load(resolveCommit(to), gitliteDir);
+        Tree::diff(before->getTree(), after->getTree(), change, gitliteDir);
+        Diff::write(out, std::move(files), readBlob, readBlob, stat);
+        return;
+    }
+
+    Stage stage = getCurrentStage();
+    std::shared_ptr<const Commit> commit = getCurrentCommit();
+    Manifest base;
+    if(from.empty()){
+        //the stage: HEAD with the staged changes applied
+        base = commit->getFiles();
+        for(auto& add : stage.getAdd()) base.set(add.name(), add.id);
+        for(auto& rm : stage.getRm()) base.erase(*rm);
+    }else{
+        base = Commit::load(resolveCommit(from), gitliteDir)->getFiles();
+    }
+    WorkingTree& workdir = scanWorkingTree(stage, *commit);
+    SparseCheckout sparse = SparseCheckout::load(worktreeDir);
+    Manifest working;
+    for(auto& file : workdir){
+        if(!file.untracked) working.append(file.path, workdir.idOf(file), workdir.pathRefs());
     }
+    workdir.saveCache();
+    Manifest::mergeJoin(base, working, [&](const std::string* name, const ObjectId* before, const ObjectId* after){
+        if(before && after && *before == *after) return;
+        //files outside the sparse set are not in the working directory, and not deleted
+        if(!after && !sparse.contains(*name)) return;
+        change(*name, before, after);
+    });
+    Diff::write(out, std::move(files), readBlob, [&](const std::string& path, const ObjectId&){
+        return Utils::readContentsAsString(workPath(path));
+    }, stat);
 }
 
 
 void Repository::branch(const std::string& branchname){
-    std::string path = Utils::join(".gitlite/branches/", branchname);
+    Command command(*this);
+    std::string path = Utils::join(gitliteDir, "branches", branchname);
     if(Utils::isFile(path)){
         Utils::exitWithMessage("A branch with that name already exists.");
     }
     std::string hash = getHEAD();
-    Utils::writeContents(path, hash);
+    Pointers::updateRef("branches/" + branchname, hash, "", gitliteDir);
 }
 void Repository::rmBranch(const std::string& branchname){
-    std::string path = Utils::join(".gitlite/branches/", branchname);
+    Command command(*this);
+    std::string path = Utils::join(gitliteDir, "branches", branchname);
     if(!Utils::isFile(path)){
         Utils::exitWithMessage("A branch with that name does not exist.");
     }
-    if(Pointers::is_ref() && Pointers::get_ref() == branchname){
+    if(Pointers::is_ref(worktreeDir) && Pointers::get_ref(worktreeDir) == branchname){
         Utils::exitWithMessage("Cannot remove the current branch.");
     }
-    Utils::simpleDelete(path);
+    LockFile worktrees(Utils::join(gitliteDir, "worktrees"));
+    if(!Worktree::holderOf(branchname, worktreeDir, gitliteDir).empty()){
+        Utils::exitWithMessage("That branch is checked out in another worktree.");
+    }
+    Pointers::deleteRef("branches/" + branchname, Utils::readContentsAsString(path), gitliteDir);
+    worktrees.release();
 }
 void Repository::reset(const std::string& hash){
-    std::string commit_path = Utils::join(".gitlite/commits/", hash);
-    if(!Utils::isFile(commit_path)){
+    Command command(*this);
+    if(!ObjectStore::contains(ObjectStore::COMMIT, hash, gitliteDir)){
         Utils::exitWithMessage("No commit with that id exists.");
     }
+    lockStage();
+    std::string old = getHEAD();
     checkoutCommit(hash);
-    if(Pointers::is_ref()){
-        std::string ref = Pointers::get_ref();
-        Utils::writeContents(".gitlite/branches/" + ref, hash);
-        return;
-    }
-    Utils::writeContents(".gitlite/HEAD", hash);
+    updateHEAD(hash, old);
 }
 
 
 //merge
 //helper function to get LCA
-static Commit getLCA(const Commit& current, const Commit& given){
+static Commit getLCA(const Commit& current, const Commit& given, const std::string& repoPath){
     std::map<std::string, int> ancestors;
     std::queue<std::pair<std::string, int>> q;
     q.push({current.getHash(), 1});
@@ -452,35 +790,20 @@ static Commit getLCA(const Commit& current, const Commit& given){
         q.pop();
         if(ancestors.count(hash)){
             if(ancestors[hash] == side) continue;
-            else return Commit(hash);
+            else return *Commit::load(hash, repoPath);
         }
         ancestors.insert({hash, side});
-        Commit c(hash);
-        std::vector<std::string> parents = c.getParents();
+        std::shared_ptr<const Commit> c = Commit::load(hash, repoPath);
+        const std::vector<std::string>& parents = c->getParents();
         for(auto& parent : parents){
             q.push({parent, side});
         }
     }
+    //both histories end at a shallow boundary before they meet
+    Utils::exitWithMessage("No common ancestor found; fetch more history with --depth.");
 }
-//helper function to compare changes of a commit with LCA
-static void compare(std::map<std::string, std::string>& LCA_files, const Commit& commit, std::map<std::string, std::string>& modify, std::map<std::string, std::string>& same, std::map<std::string, std::string>& notin, std::map<std::string, std::string>& newin){
-    std::map<std::string, std::string> commit_files = commit.getFiles();
-    for(auto& file : commit_files){
-        std::string name = file.first;
-        std::string blobHash = file.second;
-        if(LCA_files.count(name)){//in LCA
-            if(blobHash == LCA_files[name]) same[name] = blobHash;//same as LCA
-            else modify[name] = blobHash;//modified
-        }else{//new in the commit
-            newin[name] = blobHash;
-        }
-    }
-    for(auto& file : LCA_files){//check for LCA files that are not in the commit
-        if(!commit_files.count(file.first)) notin[file.first] = file.second;
-    }
-}
-//helper function to write conflict file
-static void writeConflict(const std::string& filepath, const std::string& current_content, const std::string& given_content){
+//helper function to build the content of a conflict file
+static std::string conflictContent(const std::string& current_content, const std::string& given_content){
     std::string content;
     content += "<<<<<<< HEAD\n";
     content += current_content;
@@ -493,223 +816,383 @@ static void writeConflict(const std::string& filepath, const std::string& curren
         content += "\n";
     }
     content += ">>>>>>>\n";
-    Utils::writeContents(filepath, content);
+    return content;
 }
 void Repository::merge(const std::string& branchname){
+    Command command(*this);
+    lockStage();
     Stage stage = getCurrentStage();
-    std::map<std::string, std::string> addition = stage.getAdd();
-    std::map<std::string, int> removal = stage.getRm();
+    const Manifest& addition = stage.getAdd();
+    const PathSet& removal = stage.getRm();
     if(!addition.empty() || !removal.empty()){
         Utils::exitWithMessage("You have uncommitted changes.");
     }
-    std::string branchPath = Utils::join(".gitlite/branches/", branchname);
+    std::string branchPath = Utils::join(gitliteDir, "branches", branchname);
     if(!Utils::isFile(branchPath)){
         Utils::exitWithMessage("A branch with that name does not exist.");
     }
-    std::string current_branch = Pointers::get_ref();
+    std::string current_branch = Pointers::get_ref(worktreeDir);
     if(branchname == current_branch){
         Utils::exitWithMessage("Cannot merge a branch with itself.");
     }
 
     std::string given_commit_hash = Utils::readContentsAsString(branchPath);
-    Commit current = getCurrentCommit();
-    Commit given(given_commit_hash);
-    Commit LCA = getLCA(current, given);
+    std::shared_ptr<const Commit> currentPtr = getCurrentCommit();
+    std::shared_ptr<const Commit> givenPtr = Commit::load(given_commit_hash, gitliteDir);
+    const Commit& current = *currentPtr;
+    const Commit& given = *givenPtr;
+    Commit LCA = getLCA(current, given, gitliteDir);
 
     if(LCA.getHash() == given.getHash()) Utils::exitWithMessage("Given branch is an ancestor of the current branch.");
     if(LCA.getHash() == current.getHash()){
         checkoutCommit(given_commit_hash);
-        Utils::writeContents(".gitlite/branches/" + current_branch, given_commit_hash);
+        Pointers::updateRef("branches/" + current_branch, given_commit_hash, current.getHash(), gitliteDir);
         Utils::exitWithMessage("Current branch fast-forwarded.");
     }
 
-//compare current and given with LCA
-    std::map<std::string, std::string> LCA_files = LCA.getFiles();
-    std::map<std::string, std::string> modify_in_current, same_in_current, not_in_current, new_in_current;
-    std::map<std::string, std::string> modify_in_given, same_in_given, not_in_given, new_in_given;
-    compare(LCA_files, current, modify_in_current, same_in_current, not_in_current, new_in_current);
-    compare(LCA_files, given, modify_in_given, same_in_given, not_in_given, new_in_given);
+//paths where given differs from LCA; all other paths keep the current version
+    //subtrees given shares with LCA are skipped whole, and current is looked up path by path
+    struct Change{
+        std::string name;
+        bool inLCA, inGiven, inCurrent;
+        ObjectId lca, given, current;
+    };
+    std::vector<Change> changes;
+    ObjectId currentTree = current.getTree();
+    Tree::diff(LCA.getTree(), given.getTree(), [&](const std::string& name, const ObjectId* inLCA, const ObjectId* inGiven){
+        Change change{name, inLCA != nullptr, inGiven != nullptr, false, ObjectId(), ObjectId(), ObjectId()};
+        if(inLCA) change.lca = *inLCA;
+        if(inGiven) change.given = *inGiven;
+        change.inCurrent = Tree::lookup(currentTree, name, change.current, gitliteDir);
+        changes.push_back(change);
+    }, gitliteDir);
 
     bool conflict = false;
 //cases (2 3 4 7 are doing nothing)
-    std::map<std::string, int> untrackedFiles = getUntrackedFiles();
+    //in LCA: same or modified in current, modified or deleted in given
+    //not in LCA: new in given, maybe also new in current
+    PathSet untrackedFiles = getUntrackedFiles();
     //check for cover of untracked files
-    for(auto& file : LCA_files){
-        std::string name = file.first;
-        if(modify_in_given.count(name) && same_in_current.count(name)){//case 1
-            if(untrackedFiles.count(name)) Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
-        }else if(same_in_current.count(name) && not_in_given.count(name)){//case 6
-            if(untrackedFiles.count(name)) Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+    for(auto& change : changes){
+        bool same_in_current = change.inLCA && change.inCurrent && change.current == change.lca;
+        bool only_in_given = !change.inLCA && !change.inCurrent;
+        if(same_in_current || only_in_given){//case 1, 6 and 5
+            if(untrackedFiles.contains(change.name)) Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
         }
     }
-    for(auto& file : new_in_given){
-        std::string name = file.first;
-        if(!new_in_current.count(name)){//case 5
-            if(untrackedFiles.count(name)) Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+    //outside the sparse set the given version, or the conflict file, is staged without being written
+    SparseCheckout sparse = SparseCheckout::load(worktreeDir);
+    auto takeGiven = [&](const Change& change){
+        if(sparse.contains(change.name)){
+            checkoutFileInCommit(given_commit_hash, change.name);
+            add(change.name);
+            return;
         }
-    }
-    //for files in LCA
-    for(auto& file : LCA_files){
-        std::string name = file.first;
-        if(modify_in_given.count(name) && same_in_current.count(name)){//case 1
-            checkoutFileInCommit(given_commit_hash, name);//may cause cover of untracked files
-            add(name);
-        }else if(same_in_current.count(name) && not_in_given.count(name)){//case 6
-            rm(name);//may cause cover of untracked files
-        }else if(modify_in_current.count(name) && modify_in_given.count(name)){//conflicts
-            std::string current_blob_hash = modify_in_current[name];
-            std::string given_blob_hash = modify_in_given[name];
-            if(current_blob_hash == given_blob_hash) continue;
-            conflict = true;
-            std::string current_content = Blob::readBlobContentsAsString(current_blob_hash);
-            std::string given_content = Blob::readBlobContentsAsString(given_blob_hash);
-            writeConflict(name, current_content, given_content);
-            add(name);
-        }else if(modify_in_current.count(name) && not_in_given.count(name)){
-            conflict = true;
-            std::string current_blob_hash = modify_in_current[name];
-            std::string current_content = Blob::readBlobContentsAsString(current_blob_hash);
-            std::string given_content = "";
-            writeConflict(name, current_content, given_content);
-            add(name);
-        }else if(modify_in_given.count(name) && not_in_current.count(name)){
-            conflict = true;
-            std::string current_content = "";
-            std::string given_blob_hash = modify_in_given[name];
-            std::string given_content = Blob::readBlobContentsAsString(given_blob_hash);
-            writeConflict(name, current_content, given_content);
-            add(name);
+        Stage staged = getCurrentStage();
+        staged.add(change.name, change.given.hex());
+        staged.writeStageFile();
+    };
+    for(auto& change : changes){
+        const std::string& name = change.name;
+        if(!change.inLCA && !change.inCurrent){//case 5
+            takeGiven(change);//may cause cover of untracked files
+            continue;
         }
-    }
-    //for new files
-    for(auto& file : new_in_given){
-        std::string name = file.first;
-        if(!new_in_current.count(name)){//case 5
-            checkoutFileInCommit(given_commit_hash, name);//may cause cover of untracked files
-            add(name);
-        }else{//conflict
-            std::string current_blob_hash = new_in_current[name];
-            std::string given_blob_hash = new_in_given[name];
-            if(current_blob_hash == given_blob_hash) continue;
-            conflict = true;
-            std::string current_content = Blob::readBlobContentsAsString(current_blob_hash);
-            std::string given_content = Blob::readBlobContentsAsString(given_blob_hash);
-            writeConflict(name, current_content, given_content);
+        if(change.inLCA && change.inCurrent && change.current == change.lca){
+            if(change.inGiven){//case 1
+                takeGiven(change);//may cause cover of untracked files
+            }else{//case 6
+                rm(name);//may cause cover of untracked files
+            }
+            continue;
+        }
+        //current and given both changed the file: deleted in both, or changed the same way, is no conflict
+        if(change.inCurrent == change.inGiven && (!change.inCurrent || change.current == change.given)) continue;
+        conflict = true;
+        std::string current_content = change.inCurrent ? Blob::readBlobContentsAsString(change.current.hex(), gitliteDir) : "";
+        std::string given_content = change.inGiven ? Blob::readBlobContentsAsString(change.given.hex(), gitliteDir) : "";
+        std::string content = conflictContent(current_content, given_content);
+        if(sparse.contains(name)){
+            Utils::writeContents(workPath(name), content);
             add(name);
+            continue;
         }
+        std::vector<unsigned char> blobContent(content.begin(), content.end());
+        Blob::createBlob(blobContent, gitliteDir);
+        Stage staged = getCurrentStage();
+        staged.add(name, Utils::sha1(blobContent));
+        staged.writeStageFile();
     }
 
 //commit
     std::string current_commit_hash = getHEAD();
-    std::string message = "Merged " + branchname + " into " + Pointers::get_ref() + ".";
+    std::string message = "Merged " + branchname + " into " + Pointers::get_ref(worktreeDir) + ".";
     commit(message, true, given_commit_hash);
 
     if(conflict){
-        Utils::message("Encountered a merge conflict.");
+        out << "Encountered a merge conflict." << std::endl;
     }
 }
 
 
 
 //remote
-//helper function to get all commits needed to copy
-static bool getFutureCommits(const std::string& current_commit_hash, const std::string& history_commit_hash, std::map<std::string, int>& futureCommits, const std::string& repoPath){
-    Commit current(current_commit_hash, repoPath);
-    std::vector<std::string> parents = current.getParents();
-    bool found = false;
-    for(auto& parent : parents){
-        if(parent == history_commit_hash){
-            found = true;
-            futureCommits[current_commit_hash] = 1;
-        }
-        if(getFutureCommits(parent, history_commit_hash, futureCommits, repoPath)){
-            futureCommits[current_commit_hash] = 1;
-        }
-    }
-    return found;
-}
-//helper function to copy commit files and blob files
-static void copy_files(const std::map<std::string, int>& commits, const std::string& from, const std::string& to){
-    for(auto& single_commit : commits){
-        std::string commit_hash = single_commit.first;
-        std::string from_commit_path = Utils::join(from, "commits", commit_hash);
-        std::string to_commit_path = Utils::join(to, "commits", commit_hash);
-        std::filesystem::copy_file(from_commit_path, to_commit_path, std::filesystem::copy_options::skip_existing);
-        Commit commit(commit_hash, from);
-        std::map<std::string, std::string> files_in_commit = commit.getFiles();
-        for(auto& file : files_in_commit){
-            std::string blob_hash = file.second;
-            std::string from_blob_path = Utils::join(from, "blobs", blob_hash);
-            std::string to_blob_path = Utils::join(to, "blobs", blob_hash);
-            std::filesystem::copy_file(from_blob_path, to_blob_path, std::filesystem::copy_options::skip_existing);
-        }
-    }
-}
 void Repository::addRemote(const std::string& remotename, const std::string& remotepath){
-    std::string remote = Utils::join(".gitlite/remotes/", remotename);
+    Command command(*this);
+    std::string remote = Utils::join(gitliteDir, "remotes", remotename);
     if(Utils::isFile(remote)) Utils::exitWithMessage("A remote with that name already exists.");
     Utils::writeContents(remote, remotepath);
 }
 void Repository::rmRemote(const std::string& remotename){
-    std::string remote = Utils::join(".gitlite/remotes/", remotename);
+    Command command(*this);
+    std::string remote = Utils::join(gitliteDir, "remotes", remotename);
     if(!Utils::isFile(remote)) Utils::exitWithMessage("A remote with that name does not exist.");
     Utils::simpleDelete(remote);
 }
 void Repository::push(const std::string& remotename, const std::string& branchname){
-    std::string remote = Utils::join(".gitlite/remotes/", remotename);
-    std::string remotepath = Utils::readContentsAsString(remote);
-    if(!Utils::isDirectory(remotepath)) Utils::exitWithMessage("Remote directory not found.");
-    std::string remoteBranchPath = Utils::join(remotepath, "branches", branchname);
-    if(Utils::isFile(remoteBranchPath)){
-        std::map<std::string, int> futureCommits;
-        std::string remoteBranchHead = Utils::readContentsAsString(remoteBranchPath);
-        std::string current_commit_hash = getHEAD();
-
-        getFutureCommits(current_commit_hash, remoteBranchHead, futureCommits, ".gitlite");
-        if(futureCommits.empty()){
+    Command command(*this);
+    if(!Pointers::isValidName(branchname)) Utils::exitWithMessage("Invalid branch name.");
+    std::string remotepath = remotePath(remotename);
+    if(!isExtAddress(remotepath) && !Utils::isDirectory(remotepath)) Utils::exitWithMessage("Remote directory not found.");
+    Transport transport(remotepath, "receive-pack", root);
+    std::string current_commit_hash = getHEAD();
+    std::string remoteBranchHead;
+    auto remoteBranch = transport.getRefs().find(branchname);
+    if(remoteBranch != transport.getRefs().end()){
+        remoteBranchHead = remoteBranch->second;
+        //a remote branch we do not have cannot be behind ours
+        if(current_commit_hash == remoteBranchHead || !ObjectStore::contains(ObjectStore::COMMIT, remoteBranchHead, gitliteDir)
+           || !Reachability::isAncestor(remoteBranchHead, current_commit_hash, gitliteDir)){
             Utils::exitWithMessage("Please pull down remote changes before pushing.");
         }
+    }
+    //the remote has everything its branches reach
+    std::vector<std::string> haves;
+    for(auto& ref : transport.getRefs()){
+        if(ObjectStore::contains(ObjectStore::COMMIT, ref.second, gitliteDir)) haves.push_back(ref.second);
+    }
+    transport.push(branchname, remoteBranchHead, current_commit_hash, haves, gitliteDir, progress ? &out : nullptr);
+}
+void Repository::fetch(const std::string& remotename, const std::string& branchname, int depth){
+    Command command(*this);
+    if(!Pointers::isValidName(branchname)) Utils::exitWithMessage("Invalid branch name.");
+    std::string remotepath = remotePath(remotename);
+    if(!isExtAddress(remotepath) && !Utils::isDirectory(remotepath)) Utils::exitWithMessage("Remote directory not found.");
+    Transport transport(remotepath, "upload-pack", root);
+    auto remoteBranch = transport.getRefs().find(branchname);
+    if(remoteBranch == transport.getRefs().end()) Utils::exitWithMessage("That remote does not have that branch.");
 
-        copy_files(futureCommits, ".gitlite", remotepath);
+    //the remote-tracking branch as it was before this fetch
+    std::string ref = Utils::join("branches", remotename, branchname);
+    std::string branch = Utils::join(gitliteDir, ref);
+    std::string old = Utils::isFile(branch) ? Utils::readContentsAsString(branch) : "";
 
-        Utils::writeContents(remoteBranchPath, current_commit_hash);
-        Pointers::set_ref(branchname, remotepath);
+    //the remote leaves out what our branches already reach; a commit we have (an alternate's,
+    //say) needs no transfer unless the history is to be deepened
+    if(depth > 0 || !ObjectStore::contains(ObjectStore::COMMIT, remoteBranch->second, gitliteDir)){
+        transport.fetch({remoteBranch->second}, Reachability::refTips(gitliteDir), gitliteDir, depth, progress ? &out : nullptr);
+    }
+
+    Pointers::updateRef(ref, remoteBranch->second, old, gitliteDir);
+    maintenancePending = true;
+}
+//fetch --all: one connection per remote, each asked once for everything its branches reach
+//that is missing here; the transfers run on up to FETCH_WORKERS threads, and the remote-tracking
+//branches move together once all of them have succeeded
+void Repository::fetchAll(const std::string& remotename){
+    Command command(*this);
+    std::vector<std::string> remotes;
+    if(remotename.empty()){
+        remotes = Utils::plainFilenamesIn(Utils::join(gitliteDir, "remotes"));
     }else{
-        std::map<std::string, int> futureCommits;
-        Commit initialCommit;//initialCommit have a fixed hash
-        std::string history_commit_hash = initialCommit.getHash();
-        std::string current_commit_hash = getHEAD();
+        if(!Utils::isFile(Utils::join(gitliteDir, "remotes", remotename))) Utils::exitWithMessage("A remote with that name does not exist.");
+        remotes.push_back(remotename);
+    }
+    //connections are opened (and their servers started) before any worker thread starts
+    std::vector<std::unique_ptr<Transport>> transports;
+    for(auto& name : remotes){
+        std::string remotepath = remotePath(name);
+        if(!isExtAddress(remotepath) && !Utils::isDirectory(remotepath)) Utils::exitWithMessage("Remote directory not found.");
+        transports.emplace_back(new Transport(remotepath, "upload-pack", root));
+    }
 
-        getFutureCommits(current_commit_hash, history_commit_hash, futureCommits, ".gitlite");
+    std::vector<Pointers::RefUpdate> updates;
+    std::vector<std::vector<std::string>> wants(remotes.size());
+    std::unordered_set<std::string> wanted;//a commit two remotes have is asked of the first
+    for(size_t i = 0; i < remotes.size(); i++){
+        for(auto& remoteBranch : transports[i]->getRefs()){
+            std::string ref = Utils::join("branches", remotes[i], remoteBranch.first);
+            std::string branch = Utils::join(gitliteDir, ref);
+            std::string old = Utils::isFile(branch) ? Utils::readContentsAsString(branch) : "";
+            if(old != remoteBranch.second) updates.push_back({ref, remoteBranch.second, old});
+            if(!ObjectStore::contains(ObjectStore::COMMIT, remoteBranch.second, gitliteDir)
+               && wanted.insert(remoteBranch.second).second){
+                wants[i].push_back(remoteBranch.second);
+            }
+        }
+    }
 
-        copy_files(futureCommits, ".gitlite", remotepath);
+    std::vector<std::string> haves = Reachability::refTips(gitliteDir);
+    std::vector<std::string> errors(remotes.size());
+    std::atomic<size_t> next{0};
+    auto work = [&](){
+        for(size_t i; (i = next++) < transports.size();){
+            if(wants[i].empty()) continue;
+            try{
+                //the progress lines of transfers side by side would write over one another
+                transports[i]->fetch(wants[i], haves, gitliteDir, 0, progress && transports.size() == 1 ? &out : nullptr);
+            }catch(const std::exception& e){
+                errors[i] = e.what();
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for(size_t i = 1; i < std::min<size_t>(FETCH_WORKERS, transports.size()); i++) workers.emplace_back(work);
+    work();
+    for(auto& worker : workers) worker.join();
+    transports.clear();
+    for(auto& error : errors){
+        if(!error.empty()) Utils::exitWithMessage(error);
+    }
+    Pointers::updateRefs(updates, gitliteDir);
+    maintenancePending = true;
+}
+void Repository::clone(const std::string& source, const std::string& reference){
+    Command command(*this);
+    if(!isExtAddress(source) && !Utils::isDirectory(source)) Utils::exitWithMessage("Remote directory not found.");
+    if(!reference.empty() && !Utils::isDirectory(Utils::join(reference, "commits"))){
+        Utils::exitWithMessage("Reference repository not found.");
+    }
+    Utils::createDirectories(root);
+    init();
+    //both paths are kept absolute, so they hold wherever the clone is used from
+    char resolved[PATH_MAX];
+    if(!reference.empty()){
+        if(!realpath(reference.c_str(), resolved)) Utils::exitWithMessage("Reference repository not found.");
+        Utils::writeContents(Utils::join(gitliteDir, "alternates"), std::string(resolved) + "\n");
+        CommitGraph::rebuild(gitliteDir);//the commits of the reference are ours to read now
+    }
+    std::string remotepath = source;
+    if(!isExtAddress(source) && realpath(source.c_str(), resolved)) remotepath = resolved;
+    Utils::writeContents(Utils::join(gitliteDir, "remotes", "origin"), remotepath);
+    fetchAll("origin");
+    std::string master = Utils::join(gitliteDir, "branches", "origin/master");
+    if(Utils::isFile(master)) reset(Utils::readContentsAsString(master));
+}
+void Repository::worktreeAdd(const std::string& path, const std::string& branchname){
+    Command command(*this);
+    if(!Utils::isFile(Utils::join(gitliteDir, "branches", branchname))){
+        Utils::exitWithMessage("No such branch exists.");
+    }
+    std::string dir = Utils::join(path, ".gitlite");
+    if(Utils::exists(dir)) Utils::exitWithMessage("A Gitlite version-control system already exists in that directory.");
+    //the tree starts at the initial commit, which has no files, so checking out the branch
+    //writes every file of it
+    Worktree::add(dir, Commit::initial(gitliteDir).getHash(), gitliteDir);
+    Repository tree(path, out);
+    try{
+        tree.checkoutBranch(branchname);
+    }catch(const GitliteException&){
+        Worktree::remove(dir, gitliteDir);
+        throw;
+    }
+}
+void Repository::pull(const std::string& remotename, const std::string& branchname){
+    Command command(*this);
+    fetch(remotename, branchname);
+    std::string mergeBranch = Utils::join(remotename, branchname);
+    merge(mergeBranch);
+}
 
-        Utils::writeContents(remoteBranchPath, current_commit_hash);
-        Pointers::set_ref(branchname, remotepath);
+//run maintenance now, or show the report of the last run
+void Repository::maintenance(const std::string& action){
+    Command command(*this);
+    if(action == "run"){
+        out<<Maintenance::run("manual", gitliteDir);
+    }else if(action == "status"){
+        std::string report = Maintenance::lastReport(gitliteDir);
+        if(report.empty()) out<<"No maintenance has run.\n";
+        else out<<report;
+        std::string reason = Maintenance::due(gitliteDir);
+        if(!reason.empty()) out<<"Due: "<<reason<<".\n";
+    }else{
+        Utils::exitWithMessage("Incorrect operands.");
+    }
+}
+void Repository::scheduleMaintenance(){
+    if(!maintenancePending) return;
+    maintenancePending = false;
+    out.flush();
+    try{
+        Maintenance::schedule(gitliteDir);
+    }catch(const std::exception&){//maintenance is only an optimization
     }
 }
-void Repository::fetch(const std::string& remotename, const std::string& branchname){
-    std::string remote = Utils::join(".gitlite/remotes/", remotename);
-    std::string remotepath = Utils::readContentsAsString(remote);
-    if(!Utils::isDirectory(remotepath)) Utils::exitWithMessage("Remote directory not found.");
+void Repository::showProgress(bool show){
+    progress = show;
+}
+bool Repository::showsProgress() const{
+    return progress;
+}
 
-    std::string remoteBranchPath = Utils::join(remotepath, "branches", branchname);
-    if(!Utils::isFile(remoteBranchPath)) Utils::exitWithMessage("That remote does not have that branch.");
+//show the sparse set, or change it (see SparseCheckout) and bring the working directory in line:
+//files leaving the set are deleted and files entering it are written
+void Repository::sparseCheckout(const std::string& action, const std::vector<std::string>& dirs){
+    Command command(*this);
+    SparseCheckout current = SparseCheckout::load(worktreeDir);
+    if(action == "list" && dirs.empty()){
+        if(!current.full()) out<<current.text();
+        return;
+    }
+    if(action != "set" && (action != "disable" || !dirs.empty())) Utils::exitWithMessage("Incorrect operands.");
+    std::string text;
+    for(auto& dir : dirs) text += dir + "\n";
+    SparseCheckout next = action == "set" ? SparseCheckout(text) : SparseCheckout();
 
-    Commit initialCommit;
-    std::string history_commit_hash = initialCommit.getHash();
-    std::string current_commit_hash = Utils::readContentsAsString(remoteBranchPath);
-    std::map<std::string, int> futureCommits;
-    
-    getFutureCommits(current_commit_hash, history_commit_hash, futureCommits, remotepath);
+    lockStage();
+    Stage stage = getCurrentStage();
+    if(!stage.getAdd().empty() || !stage.getRm().empty()){
+        Utils::exitWithMessage("You have uncommitted changes.");
+    }
+    std::shared_ptr<const Commit> commit = getCurrentCommit();
+    const Manifest& files = commit->getFiles();
+    WorkingTree& workdir = scanWorkingTree(stage, *commit);
+    //nothing is changed until every file is known to be safe to delete or write
+    std::vector<const WorkingTree::File*> leaving;
+    for(auto& work : workdir){
+        if(work.untracked || next.contains(work.name())) continue;
+        const Manifest::Entry* committed = files.find(work.name());
+        if(committed && workdir.idOf(work) != committed->id) Utils::exitWithMessage("You have uncommitted changes.");
+        leaving.push_back(&work);
+    }
+    std::vector<const Manifest::Entry*> entering;
+    for(auto& file : files){
+        if(current.contains(file.name()) || !next.contains(file.name())) continue;
+        if(Utils::exists(workPath(file.name()))){
+            Utils::exitWithMessage("There is an untracked file in the way; delete it, or add and commit it first.");
+        }
+        entering.push_back(&file);
+    }
 
-    copy_files(futureCommits, remotepath, ".gitlite");
+    std::string path = Utils::join(worktreeDir, "sparse-checkout");
+    if(next.full()) Utils::simpleDelete(path);
+    else Utils::writeContentsAtomically(path, next.text());
+    for(auto work : leaving) Utils::restrictedDelete(work->name(), root);
+    for(auto file : entering){
+        Utils::writeContents(workPath(file->name()), Blob::readBlobContents(file->id.hex(), gitliteDir));
+    }
+    dropWorkingTree();
+}
 
-    std::string branch = Utils::join(".gitlite/branches", remotename, branchname);
-    Utils::writeContents(branch, current_commit_hash);
+//start or stop the file system monitor of this working directory
+void Repository::fsmonitor(const std::string& action){
+    Command command(*this);
+    if(action == "start"){
+        out.flush();
+        FsMonitor::start(root);
+    }else if(action == "stop"){
+        FsMonitor::stop(root);
+    }else{
+        Utils::exitWithMessage("Incorrect operands.");
+    }
 }
-void Repository::pull(const std::string& remotename, const std::string& branchname){
-    fetch(remotename, branchname);
-    std::string mergeBranch = Utils::join(remotename, branchname);
-    merge(mergeBranch);
-}
\ No newline at end of file
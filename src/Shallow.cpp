@@ -0,0 +1,80 @@
+#include "../include/Utils.h"
+#include "../include/Shallow.h"
+#include "../include/Commit.h"
+#include "../include/CommitGraph.h"
+#include "../include/BitmapIndex.h"
+#include "../include/ObjectStore.h"
+#include "../include/LockFile.h"
+#include "../include/Blame.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <mutex>
+#include <cstdio>
+#include <sys/stat.h>
+
+static std::mutex cacheLock;
+static std::map<std::string, std::pair<int64_t, std::shared_ptr<const Shallow::Commits>>> cache;
+
+std::shared_ptr<const Shallow::Commits> Shallow::commits(const std::string& repoPath){
+    static const std::shared_ptr<const Commits> none = std::make_shared<const Commits>();
+    std::string path = Utils::join(repoPath, "shallow");
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return none;
+    int64_t mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    {
+        std::lock_guard<std::mutex> guard(cacheLock);
+        auto it = cache.find(repoPath);
+        if(it != cache.end() && it->second.first == mtime) return it->second.second;
+    }
+    auto commits = std::make_shared<Commits>();
+    std::string content;
+    try{
+        content = Utils::readContentsAsString(path);
+    }catch(const std::invalid_argument&){//removed just now
+        return none;
+    }
+    for(size_t pos = 0; pos + Utils::UID_LENGTH <= content.size(); pos += Utils::UID_LENGTH + 1){
+        commits->insert(content.substr(pos, Utils::UID_LENGTH));
+    }
+    std::lock_guard<std::mutex> guard(cacheLock);
+    cache[repoPath] = {mtime, commits};
+    return commits;
+}
+
+bool Shallow::contains(const std::string& hash, const std::string& repoPath){
+    return commits(repoPath)->count(hash) > 0;
+}
+
+void Shallow::update(const std::vector<std::string>& added, const std::vector<std::string>& removed, const std::string& repoPath){
+    if(added.empty() && removed.empty()) return;
+    std::string path = Utils::join(repoPath, "shallow");
+    LockFile lock(path);
+    std::set<std::string> commits;
+    if(Utils::isFile(path)){
+        std::string content = Utils::readContentsAsString(path);
+        for(size_t pos = 0; pos + Utils::UID_LENGTH <= content.size(); pos += Utils::UID_LENGTH + 1){
+            commits.insert(content.substr(pos, Utils::UID_LENGTH));
+        }
+    }
+    commits.insert(added.begin(), added.end());
+    for(auto& hash : removed) commits.erase(hash);
+    std::string content;
+    for(auto& hash : commits) content += hash + "\n";
+    if(commits.empty()) lock.remove();
+    else lock.commit(content);
+    {
+        //the next read sees the new file even within the same mtime tick
+        std::lock_guard<std::mutex> guard(cacheLock);
+        cache.erase(repoPath);
+    }
+
+    Commit::clearCache();
+    CommitGraph::rebuild(repoPath);
+    if(removed.empty()) return;
+    for(auto& pack : ObjectStore::packFiles(repoPath)){
+        std::remove(BitmapIndex::pathOf(pack).c_str());
+    }
+    Blame::clearCache(repoPath);
+}
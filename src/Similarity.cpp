@@ -0,0 +1,82 @@
+#include "../include/Similarity.h"
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <limits>
+
+static uint64_t mix(uint64_t x){
+    //splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+static uint64_t hashLine(std::string_view line){
+    //FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for(unsigned char c : line){
+        h ^= c;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+Similarity::Sketch Similarity::sketch(std::string_view content){
+    Sketch sketch;
+    for(size_t pos = 0; pos < content.size();){
+        size_t eol = content.find('\n', pos);
+        if(eol == std::string_view::npos) eol = content.size();
+        sketch.lines.push_back(hashLine(content.substr(pos, eol - pos)));
+        pos = eol + 1;
+    }
+    std::sort(sketch.lines.begin(), sketch.lines.end());
+    sketch.signature.fill(std::numeric_limits<uint64_t>::max());
+    for(size_t i = 0; i < sketch.lines.size(); i++){
+        if(i > 0 && sketch.lines[i] == sketch.lines[i - 1]) continue;
+        for(int h = 0; h < HASHES; h++){
+            uint64_t value = mix(sketch.lines[i] ^ (0x5bd1e9955bd1e995ULL * (h + 1)));
+            if(value < sketch.signature[h]) sketch.signature[h] = value;
+        }
+    }
+    return sketch;
+}
+
+int Similarity::score(const Sketch& a, const Sketch& b){
+    size_t longer = std::max(a.lines.size(), b.lines.size());
+    if(longer == 0) return 100;
+    //size of the multiset intersection, by a merge of the sorted hashes
+    size_t common = 0;
+    for(size_t i = 0, j = 0; i < a.lines.size() && j < b.lines.size();){
+        if(a.lines[i] < b.lines[j]) i++;
+        else if(b.lines[j] < a.lines[i]) j++;
+        else{
+            common++;
+            i++;
+            j++;
+        }
+    }
+    return static_cast<int>(common * 100 / longer);
+}
+
+std::vector<std::pair<size_t, size_t>> Similarity::candidates(const std::vector<const Sketch*>& sources, const std::vector<const Sketch*>& targets){
+    const int rows = HASHES / BANDS;
+    auto bandKey = [&](const Sketch& sketch, int band){
+        uint64_t key = mix(band);
+        for(int r = 0; r < rows; r++) key = mix(key ^ sketch.signature[band * rows + r]);
+        return key;
+    };
+    std::vector<std::pair<size_t, size_t>> pairs;
+    for(int band = 0; band < BANDS; band++){
+        std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+        for(size_t s = 0; s < sources.size(); s++) buckets[bandKey(*sources[s], band)].push_back(s);
+        for(size_t t = 0; t < targets.size(); t++){
+            auto bucket = buckets.find(bandKey(*targets[t], band));
+            if(bucket == buckets.end()) continue;
+            for(size_t s : bucket->second) pairs.push_back({s, t});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end());
+    pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+    return pairs;
+}
@@ -0,0 +1,50 @@
+#include "../include/Utils.h"
+#include "../include/SparseCheckout.h"
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+SparseCheckout SparseCheckout::load(const std::string& dir){
+    std::string path = Utils::join(dir, "sparse-checkout");
+    if(!Utils::isFile(path)) return SparseCheckout();
+    return SparseCheckout(Utils::readContentsAsString(path));
+}
+
+SparseCheckout::SparseCheckout(const std::string& text) : all(false) {
+    std::istringstream lines(text);
+    std::string line;
+    while(std::getline(lines, line)){
+        while(!line.empty() && (line.back() == ' ' || line.back() == '\r' || line.back() == '/')) line.pop_back();
+        size_t start = line.find_first_not_of(" /");
+        if(start == std::string::npos || line[start] == '#') continue;
+        dirs.push_back(line.substr(start) + "/");
+    }
+    //a directory inside another listed one adds nothing
+    std::sort(dirs.begin(), dirs.end());
+    std::vector<std::string> outer;
+    for(auto& dir : dirs){
+        if(outer.empty() || dir.compare(0, outer.back().size(), outer.back()) != 0) outer.push_back(dir);
+    }
+    dirs = std::move(outer);
+}
+
+std::string SparseCheckout::text() const{
+    std::string content;
+    for(auto& dir : dirs) content += dir.substr(0, dir.size() - 1) + "\n";
+    return content;
+}
+
+bool SparseCheckout::contains(const std::string& path) const{
+    if(all || path.find('/') == std::string::npos) return true;
+    //listed directories never nest, so only the last one sorting before the path can hold it
+    auto dir = std::upper_bound(dirs.begin(), dirs.end(), path);
+    return dir != dirs.begin() && path.compare(0, (dir - 1)->size(), *(dir - 1)) == 0;
+}
+
+bool SparseCheckout::reaches(const std::string& dir) const{
+    if(all || contains(dir)) return true;
+    //a directory above a listed one
+    auto below = std::lower_bound(dirs.begin(), dirs.end(), dir);
+    return below != dirs.end() && below->compare(0, dir.size(), dir) == 0;
+}
@@ -2,69 +2,225 @@
 #include "../include/Stage.h"
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
+//file format (integers in host byte order):
+//base    "GLSTAGE1", uint32 additions, uint32 removals, each addition as uint32 length, path and
+//        20-byte blob id, each removal as uint32 length and path, both sorted by path; then the
+//        CRC-32 of everything before it
+//journal records of one op byte, uint32 length and path, and for ADD the 20-byte blob id
+static const char MAGIC[] = "GLSTAGE1";
+static const size_t MAGIC_SIZE = 8;
+static const char ADD = 'a';
+static const char RM = 'r';
+static const char DELETE_ADD = 'A';
+static const char DELETE_RM = 'R';
+
+struct Record{
+    char op;
+    std::string_view path;
+    ObjectId id;
+};
+
+static void putU32(std::string& out, uint32_t value){
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+static bool readU32(const std::string& in, size_t& pos, uint32_t& value){
+    if(in.size() - pos < sizeof(value)) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+static bool readBytes(const std::string& in, size_t& pos, size_t n, std::string_view& out){
+    if(in.size() - pos < n) return false;
+    out = std::string_view(in).substr(pos, n);
+    pos += n;
+    return true;
+}
+static ObjectId rawId(std::string_view bytes){
+    ObjectId id;
+    std::memcpy(id.bytes.data(), bytes.data(), id.bytes.size());
+    return id;
+}
+
+//fold journal records into the base in one merge: the records for a path are applied in the
+//order they were written, starting from what the base says about it
+static void replay(std::vector<Record>& records, Manifest& addition, PathSet& removal){
+    std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b){ return a.path < b.path; });
+    Manifest added;
+    PathSet removed;
+    added.reserve(addition.size() + records.size());
+    auto a = addition.begin();
+    auto r = removal.begin();
+    for(size_t i = 0; i < records.size();){
+        std::string_view path = records[i].path;
+        for(; a != addition.end() && std::string_view(a->name()) < path; ++a) added.append(a->path, a->id, addition.pathRefs());
+        for(; r != removal.end() && std::string_view(**r) < path; ++r) removed.insert(**r);
+        bool inAdd = a != addition.end() && a->name() == path;
+        bool inRm = r != removal.end() && **r == path;
+        ObjectId id = inAdd ? a->id : ObjectId();
+        if(inAdd) ++a;
+        if(inRm) ++r;
+        for(; i < records.size() && records[i].path == path; i++){
+            switch(records[i].op){
+                case ADD: inAdd = true; id = records[i].id; break;
+                case DELETE_ADD: inAdd = false; break;
+                case RM: inRm = true; break;
+                case DELETE_RM: inRm = false; break;
+            }
+        }
+        if(inAdd) added.append(path, id);
+        if(inRm) removed.insert(path);
+    }
+    for(; a != addition.end(); ++a) added.append(a->path, a->id, addition.pathRefs());
+    for(; r != removal.end(); ++r) removed.insert(**r);
+    addition = std::move(added);
+    removal = std::move(removed);
+}
 
 //constructor
-Stage::Stage(const std::string& str) : stageContent{str} {
-    std::istringstream stream(str);
-    std::string first;
-    while(stream >> first){
-        if(first[0] == '-'){//removal
-            removal[first.substr(1)] = 1;
-        }else{//addition
-            std::string second;
-            stream >> second;
-            addition[first] = second;
+Stage::Stage(const std::string& str, const std::string& repoPath)
+    : stagePath{Utils::join(repoPath, "stage")}, appendable{false}, baseSize{0}, journalSize{0} {
+    if(str.compare(0, MAGIC_SIZE, MAGIC) != 0){
+        //the old text format: "<path> <blob id>" and "-<path>" separated by whitespace
+        std::istringstream stream(str);
+        std::string first;
+        while(stream >> first){
+            if(first[0] == '-'){//removal
+                removal.insert(first.substr(1));
+            }else{//addition
+                std::string second;
+                stream >> second;
+                addition.set(first, ObjectId::fromHex(second));
+            }
         }
+        return;
+    }
+    size_t pos = MAGIC_SIZE;
+    uint32_t adds = 0, rms = 0, length, crc;
+    std::string_view path, id;
+    bool ok = readU32(str, pos, adds) && readU32(str, pos, rms);
+    addition.reserve(adds);
+    for(uint32_t i = 0; ok && i < adds; i++){
+        ok = readU32(str, pos, length) && readBytes(str, pos, length, path) && readBytes(str, pos, 20, id);
+        if(ok) addition.append(path, rawId(id));
     }
+    for(uint32_t i = 0; ok && i < rms; i++){
+        ok = readU32(str, pos, length) && readBytes(str, pos, length, path);
+        if(ok) removal.insert(path);
+    }
+    size_t end = pos;
+    if(!ok || !readU32(str, pos, crc) || crc != Utils::crc32(str.data(), end)){
+        Utils::exitWithMessage("The stage file is corrupt.");
+    }
+    baseSize = pos;
+
+    //a record cut short by an interrupted write is dropped, and the next write starts a new base
+    std::vector<Record> records;
+    size_t valid = pos;
+    while(pos < str.size()){
+        char op = str[pos++];
+        if(op != ADD && op != RM && op != DELETE_ADD && op != DELETE_RM) break;
+        if(!readU32(str, pos, length) || !readBytes(str, pos, length, path)) break;
+        if(op == ADD && !readBytes(str, pos, 20, id)) break;
+        records.push_back(Record{op, path, op == ADD ? rawId(id) : ObjectId()});
+        valid = pos;
+    }
+    journalSize = valid - baseSize;
+    appendable = valid == str.size();
+    if(!records.empty()) replay(records, addition, removal);
 }
 
-std::map<std::string, std::string> Stage::getAdd(){
+const Manifest& Stage::getAdd() const{
     return addition;
 }
-std::map<std::string, int> Stage::getRm(){
+const PathSet& Stage::getRm() const{
     return removal;
 }
 
 
-bool Stage::is_in_add(const std::string& filename){
-    if(addition.count(filename)) return true;
+bool Stage::is_in_add(const std::string& filename) const{
+    if(addition.contains(filename)) return true;
     return false;
 }
-bool Stage::is_in_rm(const std::string& filename){
-    if(removal.count(filename)) return true;
+bool Stage::is_in_rm(const std::string& filename) const{
+    if(removal.contains(filename)) return true;
     return false;
 }
 
+void Stage::record(char op, const std::string& filename, const ObjectId* id){
+    journal += op;
+    putU32(journal, static_cast<uint32_t>(filename.size()));
+    journal += filename;
+    if(id) journal.append(reinterpret_cast<const char*>(id->bytes.data()), id->bytes.size());
+}
+
 void Stage::add(const std::string& filename, const std::string& hash){
-    addition[filename] = hash;
+    ObjectId id = ObjectId::fromHex(hash);
+    addition.set(filename, id);
+    record(ADD, filename, &id);
 }
 void Stage::rm(const std::string& filename){
-    removal[filename] = 1;
+    removal.insert(filename);
+    record(RM, filename, nullptr);
 }
 
 void Stage::deleteAdd(const std::string& filename){
-    addition.erase(filename);
+    if(addition.erase(filename)) record(DELETE_ADD, filename, nullptr);
 }
 void Stage::deleteRm(const std::string& filename){
-    removal.erase(filename);
+    if(removal.erase(filename)) record(DELETE_RM, filename, nullptr);
 }
 
 
+//append the new records, or write a new base once the journal would outgrow the current one,
+//so a change costs I/O in proportion to its records and loading stays linear in the stage size
 void Stage::writeStageFile(){
-    std::string newContent;
+    if(journal.empty()) return;
+    if(!appendable || journalSize + journal.size() > std::max(COMPACT_MIN, baseSize)){
+        writeBase();
+        return;
+    }
+    std::ofstream file(stagePath, std::ios::binary | std::ios::app);
+    file.write(journal.data(), journal.size());
+    journalSize += journal.size();
+    journal.clear();
+}
+
+void Stage::writeBase(){
+    std::string content(MAGIC, MAGIC_SIZE);
+    putU32(content, static_cast<uint32_t>(addition.size()));
+    putU32(content, static_cast<uint32_t>(removal.size()));
     for(auto& add : addition){
-        newContent += (add.first + " " + add.second + "\n");
+        putU32(content, static_cast<uint32_t>(add.name().size()));
+        content += add.name();
+        content.append(reinterpret_cast<const char*>(add.id.bytes.data()), add.id.bytes.size());
     }
     for(auto& rm : removal){
-        newContent += ("-" + rm.first + "\n");
+        putU32(content, static_cast<uint32_t>(rm->size()));
+        content += *rm;
     }
-    stageContent = newContent;
-    std::vector<unsigned char> content = Utils::serialize(stageContent);
-    Utils::writeContents(".gitlite/stage", content);
+    putU32(content, Utils::crc32(content.data(), content.size()));
+    std::string tmp = stagePath + ".tmp";
+    Utils::writeContents(tmp, content);
+    std::rename(tmp.c_str(), stagePath.c_str());
+    appendable = true;
+    baseSize = content.size();
+    journalSize = 0;
+    journal.clear();
 }
 
 void Stage::clear(){
-    Utils::writeContents(".gitlite/stage", "");
-}
\ No newline at end of file
+    addition.clear();
+    removal.clear();
+    journal.clear();
+    appendable = false;
+    baseSize = journalSize = 0;
+    Utils::writeContents(stagePath, "");
+}
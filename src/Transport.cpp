@@ -0,0 +1,759 @@
+#include "../include/Utils.h"
+#include "../include/Transport.h"
+#include "../include/ObjectStore.h"
+#include "../include/Pack.h"
+#include "../include/Delta.h"
+#include "../include/Commit.h"
+#include "../include/CommitGraph.h"
+#include "../include/Tree.h"
+#include "../include/Pointers.h"
+#include "../include/Worktree.h"
+#include "../include/LockFile.h"
+#include "../include/Shallow.h"
+#include "../include/GitliteException.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const char MAGIC[] = "GLSTRM2\n";
+static const size_t MAGIC_SIZE = 8;
+static const char JOURNAL_MAGIC[] = "GLJRNL1\n";
+static const char HAD = 'h';
+static const size_t ID_SIZE = 20;
+static const size_t BUFFER_SIZE = 65536;
+static const char FULL = 'f';
+static const char DELTA = 'd';
+
+//buffered reads and writes on a connection; either side going away is a GitliteException
+struct Transport::Connection{
+    int in, out;
+    std::string input;
+    size_t pos;
+    std::string output;
+
+    Connection(int in, int out) : in{in}, out{out}, pos{0} {}
+
+    [[noreturn]] static void hungUp(){
+        Utils::exitWithMessage("The remote end hung up unexpectedly.");
+    }
+    void flush(){
+        for(size_t sent = 0; sent < output.size();){
+            ssize_t n = send(out, output.data() + sent, output.size() - sent, MSG_NOSIGNAL);
+            //stdout of upload-pack run by hand may be a pipe
+            if(n < 0 && errno == ENOTSOCK) n = ::write(out, output.data() + sent, output.size() - sent);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) hungUp();
+            sent += n;
+        }
+        output.clear();
+    }
+    void write(std::string_view data){
+        output.append(data.data(), data.size());
+        if(output.size() >= BUFFER_SIZE) flush();
+    }
+    void writeLine(const std::string& line){
+        write(line);
+        write("\n");
+    }
+    //the next n bytes; the view is valid until the next read
+    std::string_view read(size_t n){
+        if(!fill(n)) hungUp();
+        std::string_view data(input.data() + pos, n);
+        pos += n;
+        return data;
+    }
+    std::string readLine(){
+        std::string line;
+        if(!readLine(line)) hungUp();
+        return line;
+    }
+    //false if the other side closed the connection before sending anything more
+    bool readLine(std::string& line){
+        size_t eol;
+        for(size_t from = pos; (eol = input.find('\n', from)) == std::string::npos;){
+            from = input.size() - pos;
+            if(!fill(from + 1)){
+                if(from == 0) return false;
+                hungUp();
+            }
+            from += pos;
+        }
+        line = input.substr(pos, eol - pos);
+        pos = eol + 1;
+        return true;
+    }
+private:
+    //read until n bytes past pos are buffered, false at the end of the input
+    bool fill(size_t n){
+        if(input.size() - pos < n && pos > 0){
+            input.erase(0, pos);
+            pos = 0;
+        }
+        char buffer[BUFFER_SIZE];
+        while(input.size() - pos < n){
+            ssize_t got = ::read(in, buffer, sizeof(buffer));
+            if(got < 0 && errno == EINTR) continue;
+            if(got <= 0) return false;
+            input.append(buffer, got);
+        }
+        return true;
+    }
+};
+
+static std::string objectKey(ObjectStore::Kind kind, const std::string& hash){
+    return static_cast<char>(kind) + hash;
+}
+static void putU32(std::string& out, uint32_t value){
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+static uint32_t getU32(std::string_view in){
+    uint32_t value;
+    std::memcpy(&value, in.data(), sizeof(value));
+    return value;
+}
+static void putId(std::string& out, const std::string& hash){
+    ObjectId id = ObjectId::fromHex(hash);
+    out.append(reinterpret_cast<const char*>(id.bytes.data()), id.bytes.size());
+}
+static std::string hexOf(std::string_view bytes){
+    ObjectId id;
+    std::memcpy(id.bytes.data(), bytes.data(), id.bytes.size());
+    return id.hex();
+}
+
+//progress of a transfer on out, if there is one: objects done of all, bytes and rate
+struct Progress{
+    std::ostream* out;
+    const char* title;
+    uint32_t total;
+    uint32_t done;
+    uint64_t bytes;
+    bool shown;
+    std::chrono::steady_clock::time_point start, last;
+
+    Progress(std::ostream* out, const char* title, uint32_t total, uint32_t done)
+        : out{out}, title{title}, total{total}, done{done}, bytes{0}, shown{out && total > 0},
+          start{std::chrono::steady_clock::now()}, last{start} {}
+    void add(size_t size){
+        done++;
+        bytes += size;
+        if(!shown) return;
+        auto now = std::chrono::steady_clock::now();
+        if(now - last < std::chrono::milliseconds(100) && done < total) return;
+        last = now;
+        print();
+    }
+    void print(){
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double mib = bytes / 1048576.0;
+        char line[128];
+        std::snprintf(line, sizeof(line), "\r%s: %3u%% (%u/%u), %.2f MiB | %.2f MiB/s", title,
+                      total ? static_cast<unsigned>(100.0 * done / total) : 100u, done, total, mib,
+                      seconds > 0 ? mib / seconds : 0.0);
+        *out << line << std::flush;
+    }
+    void finish(){
+        if(!shown) return;
+        print();
+        *out << ", done." << std::endl;
+    }
+};
+
+//the objects received so far in one transfer, in .gitlite/transfers/<SHA-1 of the request>, so
+//that the same request after an interruption resumes after them: "GLJRNL1\n", the 20-byte id of
+//the stream, then a record for each object as soon as it is verified: kind byte, 20-byte id, and
+//'h' for an object the repository already has, or 'f', uint32 length and the content
+//records are only appended, so an interrupted transfer leaves at most its last one torn; that
+//one is dropped and the one before it checked again, the others are taken as they are
+struct Transport::Journal{
+    std::string path;
+    std::unique_ptr<LockFile> lock;
+    std::string streamId;//hex, empty without a journal
+    uint32_t count;//records
+    std::vector<Reachability::Object> fresh;//objects of the 'f' records, in stream order
+    std::unordered_map<std::string, std::string> contents;//their content by object key
+    int fd;
+
+    Journal(const std::string& repoPath, const std::string& request) : count{0}, fd{-1} {
+        std::string dir = Utils::join(repoPath, "transfers");
+        Utils::createDirectories(dir);
+        path = Utils::join(dir, Utils::sha1(request));
+        try{
+            lock.reset(new LockFile(path, 0));
+        }catch(const GitliteException&){//the same transfer is running in another process
+            path.clear();
+            return;
+        }
+        if(Utils::isFile(path)) load();
+    }
+    ~Journal(){
+        if(fd >= 0) close(fd);
+    }
+    //what the sender needs to skip the objects received already
+    std::string resumeLine() const{
+        return streamId.empty() ? "resume - 0" : "resume " + streamId + " " + std::to_string(count);
+    }
+    //a stream with this id starting at object first; a stream from the start replaces the journal
+    bool start(const std::string& id, uint32_t first){
+        if(first > 0) return id == streamId && first == count;
+        fresh.clear();
+        contents.clear();
+        count = 0;
+        streamId = id;
+        if(path.empty()) return true;
+        if(fd >= 0) close(fd);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        std::string header(JOURNAL_MAGIC, MAGIC_SIZE);
+        putId(header, id);
+        write(header);
+        return true;
+    }
+    void append(ObjectStore::Kind kind, const std::string& hash, const std::string* content){
+        count++;
+        if(fd < 0) return;
+        std::string record(1, static_cast<char>(kind));
+        putId(record, hash);
+        if(!content){
+            record += HAD;
+        }else{
+            record += FULL;
+            putU32(record, static_cast<uint32_t>(content->size()));
+            record += *content;
+        }
+        write(record);
+    }
+    //the objects are in the repository: the journal is no longer needed
+    void finish(){
+        if(path.empty()) return;
+        if(fd >= 0) close(fd);
+        fd = -1;
+        lock->remove();
+    }
+private:
+    void write(const std::string& data){
+        for(size_t done = 0; fd >= 0 && done < data.size();){
+            ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0){//without room for the journal the transfer just cannot resume
+                close(fd);
+                fd = -1;
+                return;
+            }
+            done += n;
+        }
+    }
+    void load(){
+        std::string data = Utils::readContentsAsString(path);
+        if(data.size() < MAGIC_SIZE + ID_SIZE || data.compare(0, MAGIC_SIZE, JOURNAL_MAGIC) != 0) return;
+        std::string id = hexOf(std::string_view(data).substr(MAGIC_SIZE, ID_SIZE));
+        size_t pos = MAGIC_SIZE + ID_SIZE, valid = pos, last = pos;
+        uint32_t records = 0;
+        std::vector<Reachability::Object> objects;
+        std::vector<std::pair<size_t, size_t>> spans;//content of each object
+        while(data.size() - pos >= 2 + ID_SIZE){
+            ObjectStore::Kind kind = static_cast<ObjectStore::Kind>(data[pos]);
+            std::string hash = hexOf(std::string_view(data).substr(pos + 1, ID_SIZE));
+            char flag = data[pos + 1 + ID_SIZE];
+            size_t next = pos + 2 + ID_SIZE;
+            if(flag == FULL){
+                if(data.size() - next < 4) break;
+                uint32_t length = getU32(std::string_view(data).substr(next, 4));
+                next += 4;
+                if(data.size() - next < length) break;
+                objects.push_back({kind, hash});
+                spans.push_back({next, length});
+                next += length;
+            }else if(flag != HAD){
+                break;
+            }
+            records++;
+            last = pos;
+            pos = valid = next;
+        }
+        //the last whole record is the one an interruption may have left half-written on disk
+        if(records > 0 && data[last + 1 + ID_SIZE] == FULL
+           && Utils::sha1(data.substr(spans.back().first, spans.back().second)) != objects.back().hash){
+            objects.pop_back();
+            spans.pop_back();
+            records--;
+            valid = last;
+        }
+        if(truncate(path.c_str(), static_cast<off_t>(valid)) != 0) return;
+        fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+        if(fd < 0) return;
+        streamId = id;
+        count = records;
+        for(size_t i = 0; i < objects.size(); i++){
+            contents[objectKey(objects[i].kind, objects[i].hash)] = data.substr(spans[i].first, spans[i].second);
+        }
+        fresh = std::move(objects);
+    }
+};
+
+//helper function to order objects so that each comes after those it refers to: blobs, then
+//trees with their subtrees first, then commits with their parents first
+static std::vector<Reachability::Object> writeOrder(const std::vector<Reachability::Object>& objects, const std::string& repoPath){
+    std::vector<Reachability::Object> ordered;
+    std::unordered_set<std::string> trees, commits;
+    for(auto& object : objects){
+        if(object.kind == ObjectStore::BLOB) ordered.push_back(object);
+        else if(object.kind == ObjectStore::TREE) trees.insert(object.hash);
+        else commits.insert(object.hash);
+    }
+    std::vector<std::pair<std::string, bool>> stack;//object, whether its children are done
+    for(auto& object : objects){
+        if(object.kind == ObjectStore::BLOB) continue;
+        bool isTree = object.kind == ObjectStore::TREE;
+        std::unordered_set<std::string>& pending = isTree ? trees : commits;
+        stack.push_back({object.hash, false});
+        while(!stack.empty()){
+            std::string hash = stack.back().first;
+            bool done = stack.back().second;
+            if(!pending.count(hash)){
+                stack.pop_back();
+                continue;
+            }
+            if(done){
+                stack.pop_back();
+                pending.erase(hash);
+                ordered.push_back({object.kind, hash});
+                continue;
+            }
+            stack.back().second = true;
+            if(isTree){
+                for(auto& entry : *Tree::load(ObjectId::fromHex(hash), repoPath)){
+                    if(entry.isTree) stack.push_back({entry.id.hex(), false});
+                }
+            }else{
+                for(auto& parent : Commit::load(hash, repoPath)->getParents()) stack.push_back({parent, false});
+            }
+        }
+    }
+    return ordered;
+}
+
+//helper function to pair the trees of a commit and its first parent: a tree or blob that
+//changed at a path gets the parent's version there as its delta base
+static void pairTrees(const ObjectId& old, const ObjectId& now, const std::unordered_set<std::string>& sending, std::unordered_map<std::string, std::string>& bases, const std::string& repoPath){
+    if(old.isNull() || now.isNull() || old == now) return;
+    std::string key = objectKey(ObjectStore::TREE, now.hex());
+    if(!sending.count(key) || bases.count(key)) return;
+    bases[key] = old.hex();
+    std::shared_ptr<const Tree::Entries> before = Tree::load(old, repoPath);
+    std::unordered_map<std::string_view, const Tree::Entry*> byName;
+    for(auto& entry : *before) byName[entry.name] = &entry;
+    for(auto& entry : *Tree::load(now, repoPath)){
+        auto it = byName.find(entry.name);
+        if(it == byName.end() || it->second->isTree != entry.isTree || it->second->id == entry.id) continue;
+        if(entry.isTree){
+            pairTrees(it->second->id, entry.id, sending, bases, repoPath);
+            continue;
+        }
+        std::string blobKey = objectKey(ObjectStore::BLOB, entry.id.hex());
+        if(sending.count(blobKey) && !bases.count(blobKey)) bases[blobKey] = it->second->id.hex();
+    }
+}
+
+void Transport::advertise(Connection& connection, const std::string& repoPath){
+    for(auto& branch : Pointers::getBranches(repoPath)){
+        connection.writeLine(Utils::readContentsAsString(Utils::join(repoPath, "branches", branch)) + " " + branch);
+    }
+    //a client pushing leaves out what the alternates have
+    for(auto& alternate : ObjectStore::alternates(repoPath)){
+        for(auto& tip : Reachability::refTips(alternate)) connection.writeLine(tip + " .have");
+    }
+    connection.writeLine("");
+    connection.flush();
+}
+
+//objects go oldest first, so the version a changed object is sent as a delta against has
+//usually been sent already; a base the other side neither has nor has been sent is not used
+//the parents of a commit in shallow are not sent, so its trees have no base
+//the stream id is the SHA-1 of the object list; resume ("<id> <count>") skips the objects the
+//other side received of the same stream before, which it keeps as delta bases
+void Transport::sendObjects(Connection& connection, std::vector<Reachability::Object> objects, const std::string& repoPath, const std::string& resume, std::ostream* progress, const std::vector<std::string>& shallow){
+    std::reverse(objects.begin(), objects.end());
+    objects = writeOrder(objects, repoPath);
+    std::unordered_set<std::string> sending, sent;
+    std::string keys;
+    for(auto& object : objects){
+        std::string key = objectKey(object.kind, object.hash);
+        keys += key;
+        sending.insert(std::move(key));
+    }
+    std::string streamId = Utils::sha1(keys);
+    uint32_t first = 0;
+    size_t space = resume.find(' ');
+    if(space != std::string::npos && resume.substr(0, space) == streamId){
+        first = static_cast<uint32_t>(std::min<unsigned long>(std::strtoul(resume.c_str() + space + 1, nullptr, 10), objects.size()));
+    }
+    std::unordered_map<std::string, std::string> bases;//base hash by object key
+    std::unordered_set<std::string> boundary(shallow.begin(), shallow.end());
+    for(auto& object : objects){
+        if(object.kind != ObjectStore::COMMIT || boundary.count(object.hash)) continue;
+        std::shared_ptr<const Commit> commit = Commit::load(object.hash, repoPath);
+        if(commit->getParents().empty()) continue;
+        pairTrees(Commit::load(commit->getFirstParent(), repoPath)->getTree(), commit->getTree(), sending, bases, repoPath);
+    }
+
+    uint32_t crc = 0;
+    auto put = [&](std::string_view data){
+        crc = Utils::crc32(data.data(), data.size(), crc);
+        connection.write(data);
+    };
+    std::string header(MAGIC, MAGIC_SIZE);
+    putId(header, streamId);
+    putU32(header, static_cast<uint32_t>(objects.size()));
+    putU32(header, first);
+    put(header);
+    Progress shown(progress, "Writing objects", static_cast<uint32_t>(objects.size()), first);
+    for(uint32_t i = 0; i < first; i++) sent.insert(objectKey(objects[i].kind, objects[i].hash));
+    for(size_t i = first; i < objects.size(); i++){
+        const Reachability::Object& object = objects[i];
+        std::string key = objectKey(object.kind, object.hash);
+        std::string content = ObjectStore::read(object.kind, object.hash, repoPath);
+        std::string delta;
+        auto base = bases.find(key);
+        if(base != bases.end()){
+            std::string baseKey = objectKey(object.kind, base->second);
+            if(!sending.count(baseKey) || sent.count(baseKey)){
+                delta = Delta::create(ObjectStore::read(object.kind, base->second, repoPath), content);
+            }
+        }
+        header.assign(1, static_cast<char>(object.kind));
+        putId(header, object.hash);
+        //a delta is only worth it well below the size of the object
+        bool useDelta = !delta.empty() && delta.size() < content.size() / 2;
+        if(useDelta){
+            header += DELTA;
+            putId(header, base->second);
+        }else{
+            header += FULL;
+        }
+        const std::string& payload = useDelta ? delta : content;
+        putU32(header, static_cast<uint32_t>(payload.size()));
+        put(header);
+        put(payload);
+        sent.insert(key);
+        shown.add(header.size() + payload.size());
+    }
+    std::string trailer;
+    putU32(trailer, crc);
+    connection.write(trailer);
+    connection.flush();
+    shown.finish();
+}
+
+//nothing is written to the repository before the whole stream has arrived intact; a short
+//stream is written as loose objects, a long one as a pack under the packs lock. Received objects
+//stay in memory for the length of the stream, blobs and trees also as delta bases for the objects
+//after them, and go to the journal as they arrive
+void Transport::receiveObjects(Connection& connection, const std::string& repoPath, Journal& journal, std::ostream* progress){
+    uint32_t crc = 0;
+    auto get = [&](size_t n){
+        std::string data(connection.read(n));
+        crc = Utils::crc32(data.data(), data.size(), crc);
+        return data;
+    };
+    auto corrupt = [](){ Utils::exitWithMessage("The remote sent a corrupt object stream."); };
+    if(get(MAGIC_SIZE) != std::string(MAGIC, MAGIC_SIZE)) corrupt();
+    std::string streamId = hexOf(get(ID_SIZE));
+    uint32_t count = getU32(get(4));
+    uint32_t first = getU32(get(4));
+    if(first > count || !journal.start(streamId, first)) corrupt();
+    std::unordered_map<std::string, std::string> contents = std::move(journal.contents);//by object key
+    std::vector<Reachability::Object> received = std::move(journal.fresh);
+    Progress shown(progress, "Receiving objects", count, first);
+    for(uint32_t i = first; i < count; i++){
+        std::string header = get(2 + ID_SIZE);
+        ObjectStore::Kind kind = static_cast<ObjectStore::Kind>(header[0]);
+        if(kind != ObjectStore::BLOB && kind != ObjectStore::TREE && kind != ObjectStore::COMMIT) corrupt();
+        std::string hash = hexOf(std::string_view(header).substr(1, ID_SIZE));
+        char encoding = header[1 + ID_SIZE];
+        if(encoding != FULL && encoding != DELTA) corrupt();
+        std::string baseHash = encoding == DELTA ? hexOf(get(ID_SIZE)) : "";
+        std::string payload = get(getU32(get(4)));
+        shown.add(header.size() + payload.size());
+        std::string content;
+        if(encoding == DELTA){
+            auto base = contents.find(objectKey(kind, baseHash));
+            std::string baseContent;
+            if(base == contents.end()){
+                try{
+                    baseContent = ObjectStore::read(kind, baseHash, repoPath);
+                }catch(const std::invalid_argument&){
+                    corrupt();
+                }
+            }
+            if(!Delta::apply(base == contents.end() ? baseContent : base->second, payload, content)) corrupt();
+        }else{
+            content = std::move(payload);
+        }
+        if(Utils::sha1(content) != hash) corrupt();
+        if(ObjectStore::contains(kind, hash, repoPath)){
+            journal.append(kind, hash, nullptr);
+            continue;
+        }
+        journal.append(kind, hash, &content);
+        received.push_back({kind, hash});
+        contents[objectKey(kind, hash)] = std::move(content);
+    }
+    uint32_t expected = getU32(connection.read(4));
+    if(expected != crc) corrupt();
+    shown.finish();
+
+    {
+        //streams received side by side (fetch --all) are written one at a time, so an object two
+        //of them carry is written, and its commit recorded, once
+        static std::mutex writing;
+        std::lock_guard<std::mutex> guard(writing);
+        std::vector<Reachability::Object> fresh;
+        for(auto& object : received){
+            if(!ObjectStore::contains(object.kind, object.hash, repoPath)) fresh.push_back(object);
+        }
+        if(fresh.size() >= UNPACK_LIMIT){
+            std::string packsDir = Utils::join(repoPath, "packs");
+            LockFile packLock(packsDir);
+            Pack::Writer writer(packsDir);
+            for(auto& object : fresh){
+                writer.add(object.kind, ObjectId::fromHex(object.hash), contents[objectKey(object.kind, object.hash)]);
+            }
+            writer.finish();
+        }else{
+            for(auto& object : fresh){
+                ObjectStore::write(object.kind, object.hash, contents[objectKey(object.kind, object.hash)], repoPath);
+            }
+        }
+        //in stream order, so parents are recorded first
+        for(auto& object : fresh){
+            if(object.kind == ObjectStore::COMMIT) CommitGraph::append(*Commit::load(object.hash, repoPath), repoPath);
+        }
+    }
+    journal.finish();
+}
+
+Transport::Transport(const std::string& address, const std::string& service, const std::string& root) : child{-1} {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) Utils::exitWithMessage("Cannot connect to the remote.");
+    bool ext = address.compare(0, 5, "ext::") == 0;
+    std::string command = ext ? address.substr(5) : "";
+    for(size_t at = command.find("%s"); at != std::string::npos; at = command.find("%s", at + service.size())){
+        command.replace(at, 2, service);
+    }
+    if(ext){
+        //the child only execs: a forked copy of a process with other threads may find a lock
+        //(malloc's, a cache's) held by a thread that is not there, so it runs no library code
+        child = fork();
+        if(child < 0){
+            close(fds[0]);
+            close(fds[1]);
+            Utils::exitWithMessage("Cannot connect to the remote.");
+        }
+        if(child == 0){
+            //dup2 leaves the new descriptors open across exec
+            dup2(fds[1], 0);
+            dup2(fds[1], 1);
+            if(chdir(root.c_str()) == 0) execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char*>(nullptr));
+            std::_Exit(127);
+        }
+        close(fds[1]);
+    }else{
+        int fd = fds[1];
+        try{
+            server = std::thread([fd, service, address](){
+                try{
+                    if(service == "upload-pack") uploadPack(fd, fd, address);
+                    else receivePack(fd, fd, address);
+                }catch(const std::exception&){//the client sees the connection close
+                }
+                close(fd);
+            });
+        }catch(const std::system_error&){
+            close(fds[0]);
+            close(fds[1]);
+            Utils::exitWithMessage("Cannot connect to the remote.");
+        }
+    }
+    connection.reset(new Connection(fds[0], fds[0]));
+    try{
+        for(std::string line = connection->readLine(); !line.empty(); line = connection->readLine()){
+            if(line.size() <= Utils::UID_LENGTH + 1 || line[Utils::UID_LENGTH] != ' ') Connection::hungUp();
+            std::string name = line.substr(Utils::UID_LENGTH + 1);
+            if(name == ".have") alternateTips.push_back(line.substr(0, Utils::UID_LENGTH));
+            //a branch whose name is no safe path here is never fetched
+            else if(Pointers::isValidName(name)) refs[name] = line.substr(0, Utils::UID_LENGTH);
+        }
+    }catch(...){
+        shutdown(fds[0], SHUT_RDWR);
+        close(fds[0]);
+        finish();
+        throw;
+    }
+}
+
+//the ext:: commands of connections opened later may hold copies of this socket (forked before
+//their exec), so closing it is not enough for the remote side to see the end of the input
+Transport::~Transport(){
+    shutdown(connection->in, SHUT_RDWR);
+    close(connection->in);
+    finish();
+}
+void Transport::finish(){
+    if(server.joinable()) server.join();
+    if(child > 0) waitpid(child, nullptr, 0);
+}
+
+void Transport::fetch(const std::vector<std::string>& wants, const std::vector<std::string>& haves, const std::string& repoPath, int depth, std::ostream* progress){
+    std::string request;
+    for(auto& want : wants) request += "want " + want + "\n";
+    for(auto& have : haves) request += "have " + have + "\n";
+    //what the alternates reach is here too
+    for(auto& alternate : ObjectStore::alternates(repoPath)){
+        for(auto& tip : Reachability::refTips(alternate)) request += "have " + tip + "\n";
+    }
+    if(depth > 0) request += "deepen " + std::to_string(depth) + "\n";
+    std::shared_ptr<const Shallow::Commits> shallow = Shallow::commits(repoPath);
+    for(auto& hash : *shallow) request += "shallow " + hash + "\n";
+    //the same request after an interruption gets the same stream
+    Journal journal(repoPath, request);
+    connection->write(request);
+    connection->writeLine(journal.resumeLine());
+    connection->writeLine("");
+    connection->flush();
+    std::vector<std::string> added, removed;
+    for(std::string line = connection->readLine(); !line.empty(); line = connection->readLine()){
+        std::string hash = line.substr(line.find(' ') + 1);
+        if(hash.size() != Utils::UID_LENGTH) Connection::hungUp();
+        if(line.compare(0, 8, "shallow ") == 0) added.push_back(hash);
+        else if(line.compare(0, 10, "unshallow ") == 0) removed.push_back(hash);
+        else Connection::hungUp();
+    }
+    receiveObjects(*connection, repoPath, journal, progress);
+    //the boundary moves only once the objects below it are in
+    Shallow::update(added, removed, repoPath);
+}
+
+void Transport::push(const std::string& branch, const std::string& expected, const std::string& value, const std::vector<std::string>& haves, const std::string& repoPath, std::ostream* progress){
+    connection->writeLine("update " + (expected.empty() ? "-" : expected) + " " + value + " " + branch);
+    connection->writeLine("");
+    connection->flush();
+    std::string resume = connection->readLine();
+    if(resume.compare(0, 6, "error ") == 0) Utils::exitWithMessage(resume.substr(6));
+    if(resume.compare(0, 7, "resume ") != 0) Connection::hungUp();
+    std::vector<std::string> known = haves;
+    for(auto& tip : alternateTips){
+        if(ObjectStore::contains(ObjectStore::COMMIT, tip, repoPath)) known.push_back(tip);
+    }
+    std::vector<Reachability::Object> objects = Reachability::missing({value}, known, repoPath);
+    //the parents of a shallow commit are neither here nor there
+    std::shared_ptr<const Shallow::Commits> shallow = Shallow::commits(repoPath);
+    for(auto& object : objects){
+        if(object.kind == ObjectStore::COMMIT && shallow->count(object.hash)){
+            Utils::exitWithMessage("Cannot push history below a shallow commit.");
+        }
+    }
+    sendObjects(*connection, std::move(objects), repoPath, resume.substr(7), progress);
+    std::string reply = connection->readLine();
+    if(reply == "ok") return;
+    if(reply.compare(0, 6, "error ") == 0) Utils::exitWithMessage(reply.substr(6));
+    Connection::hungUp();
+}
+
+void Transport::uploadPack(int in, int out, const std::string& dir){
+    std::string repoPath = Worktree::commonDir(dir);//a linked worktree serves what it shares
+    Connection connection(in, out);
+    advertise(connection, repoPath);
+    std::vector<std::string> wants, haves;
+    Reachability::Limits limits{0, {}, {}, {}};
+    std::string resume;
+    std::string line;
+    //a client that only wanted the branches hangs up here
+    if(!connection.readLine(line)) return;
+    for(; !line.empty(); line = connection.readLine()){
+        if(line.compare(0, 7, "deepen ") == 0){
+            limits.depth = std::atoi(line.c_str() + 7);
+            continue;
+        }
+        if(line.compare(0, 8, "shallow ") == 0){
+            limits.shallow.insert(line.substr(8));
+            continue;
+        }
+        if(line.compare(0, 7, "resume ") == 0){
+            resume = line.substr(7);
+            continue;
+        }
+        std::string hash = line.substr(5);
+        bool known = hash.size() == Utils::UID_LENGTH && ObjectStore::contains(ObjectStore::COMMIT, hash, repoPath);
+        if(line.compare(0, 5, "want ") == 0){
+            if(!known) Utils::exitWithMessage("No commit with that id exists.");
+            wants.push_back(hash);
+        }else if(line.compare(0, 5, "have ") == 0){
+            //what the client has and this side does not cannot help
+            if(known) haves.push_back(hash);
+        }else{
+            Connection::hungUp();
+        }
+    }
+    std::vector<Reachability::Object> objects = Reachability::missing(wants, haves, repoPath, limits);
+    for(auto& hash : limits.boundary) connection.writeLine("shallow " + hash);
+    for(auto& hash : limits.deepened) connection.writeLine("unshallow " + hash);
+    connection.writeLine("");
+    sendObjects(connection, std::move(objects), repoPath, resume, nullptr, limits.boundary);
+}
+
+void Transport::receivePack(int in, int out, const std::string& dir){
+    std::string repoPath = Worktree::commonDir(dir);//a linked worktree serves what it shares
+    Connection connection(in, out);
+    advertise(connection, repoPath);
+    std::string update;
+    if(!connection.readLine(update)) return;
+    size_t first = update.find(' ', 7);
+    if(update.compare(0, 7, "update ") != 0 || first == std::string::npos || !connection.readLine().empty()) Connection::hungUp();
+    std::string expected = update.substr(7, first - 7);
+    std::string value = update.substr(first + 1, Utils::UID_LENGTH);
+    std::string branch = update.size() > first + Utils::UID_LENGTH + 2 ? update.substr(first + Utils::UID_LENGTH + 2) : "";
+    if(expected == "-") expected.clear();
+    //the branch becomes a path in this repository, whatever the client sent
+    if(!Pointers::isValidName(branch)){
+        connection.writeLine("error Invalid branch name.");
+        connection.flush();
+        return;
+    }
+    //a push of the same update after an interruption resumes where the last one stopped
+    Journal journal(repoPath, update);
+    connection.writeLine(journal.resumeLine());
+    connection.flush();
+    receiveObjects(connection, repoPath, journal, nullptr);
+    try{
+        if(!ObjectStore::contains(ObjectStore::COMMIT, value, repoPath)){
+            Utils::exitWithMessage("The pushed objects are incomplete.");
+        }
+        //a push racing this one, or a commit in this repository, fails the update
+        Pointers::updateRef("branches/" + branch, value, expected, repoPath);
+        //HEAD follows the push unless a linked worktree has the branch checked out
+        LockFile worktrees(Utils::join(repoPath, "worktrees"));
+        if(Worktree::holderOf(branch, repoPath, repoPath).empty()) Pointers::set_ref(branch, repoPath);
+        worktrees.release();
+        connection.writeLine("ok");
+    }catch(const GitliteException& e){
+        connection.writeLine(std::string("error ") + e.what());
+    }
+    connection.flush();
+}
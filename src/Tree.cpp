@@ -0,0 +1,183 @@
+#include "../include/Utils.h"
+#include "../include/Tree.h"
+#include "../include/ObjectStore.h"
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <algorithm>
+
+//trees kept by Tree::load; the cache is simply dropped when it grows past this
+static const size_t TREE_CACHE_CAPACITY = 1 << 16;
+
+bool Tree::entryLess(const Entry& a, const Entry& b){
+    //compare as if directory names ended in '/', which keeps full paths in byte order
+    size_t n = std::min(a.name.size(), b.name.size());
+    int c = a.name.compare(0, n, b.name, 0, n);
+    if(c != 0) return c < 0;
+    unsigned char x = a.name.size() > n ? a.name[n] : (a.isTree ? '/' : 0);
+    unsigned char y = b.name.size() > n ? b.name[n] : (b.isTree ? '/' : 0);
+    if(x != y) return x < y;
+    if(a.name.size() != b.name.size()) return a.name.size() < b.name.size();
+    return !a.isTree && b.isTree;
+}
+
+//helper function to parse "blob|tree <hash> <name>" lines
+static Tree::Entries parseTree(const std::string& content){
+    Tree::Entries entries;
+    size_t pos = 0;
+    while(pos < content.size()){
+        size_t eol = content.find('\n', pos);
+        if(eol == std::string::npos) eol = content.size();
+        //"blob " + 40 hex digits + " " is 46 bytes
+        if(eol - pos > 46){
+            Tree::Entry entry;
+            entry.isTree = content.compare(pos, 5, "tree ") == 0;
+            entry.id = ObjectId::fromHex(std::string_view(content).substr(pos + 5, 40));
+            entry.name = content.substr(pos + 46, eol - pos - 46);
+            entries.push_back(std::move(entry));
+        }
+        pos = eol + 1;
+    }
+    return entries;
+}
+
+std::shared_ptr<const Tree::Entries> Tree::load(const ObjectId& id, const std::string& repoPath){
+    static const std::shared_ptr<const Entries> empty = std::make_shared<const Entries>();
+    if(id.isNull()) return empty;
+    static std::mutex lock;
+    static std::unordered_map<std::string, std::shared_ptr<const Entries>> cache;
+    std::string hash = id.hex();
+    std::string key = repoPath + '\0' + hash;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = cache.find(key);
+        if(it != cache.end()) return it->second;
+    }
+    std::shared_ptr<const Entries> entries = std::make_shared<const Entries>(
+        parseTree(ObjectStore::read(ObjectStore::TREE, hash, repoPath)));
+    std::lock_guard<std::mutex> guard(lock);
+    if(cache.size() >= TREE_CACHE_CAPACITY) cache.clear();
+    cache[key] = entries;
+    return entries;
+}
+
+ObjectId Tree::write(Entries entries, const std::string& repoPath){
+    if(entries.empty()) return ObjectId();
+    std::sort(entries.begin(), entries.end(), entryLess);
+    std::string content;
+    for(auto& entry : entries){
+        content += entry.isTree ? "tree " : "blob ";
+        content += entry.id.hex();
+        content += ' ';
+        content += entry.name;
+        content += '\n';
+    }
+    std::string hash = Utils::sha1(content);
+    //written unless there is already a same tree
+    ObjectStore::write(ObjectStore::TREE, hash, content, repoPath);
+    return ObjectId::fromHex(hash);
+}
+
+//one staged change: the new blob id, or nullptr for a removal
+typedef std::pair<std::string_view, const ObjectId*> Change;
+
+//helper function to rewrite one directory; changes are sorted and all start with the
+//directory's path, which is prefixLength bytes long
+static ObjectId updateDir(const ObjectId& id, std::vector<Change>::const_iterator begin, std::vector<Change>::const_iterator end,
+                          size_t prefixLength, const std::string& repoPath){
+    //entries by name, directories with a trailing '/'
+    std::map<std::string, Tree::Entry> byName;
+    for(auto& entry : *Tree::load(id, repoPath)){
+        byName[entry.isTree ? entry.name + "/" : entry.name] = entry;
+    }
+    auto change = begin;
+    while(change != end){
+        std::string_view rest = change->first.substr(prefixLength);
+        size_t slash = rest.find('/');
+        if(slash == std::string_view::npos){//a file in this directory
+            std::string name(rest);
+            if(change->second) byName[name] = Tree::Entry{false, *change->second, name};
+            else byName.erase(name);
+            ++change;
+            continue;
+        }
+        //every change below the same subdirectory is contiguous
+        std::string_view dirPath = change->first.substr(0, prefixLength + slash + 1);
+        auto last = change;
+        while(last != end && last->first.substr(0, dirPath.size()) == dirPath) ++last;
+        std::string name(rest.substr(0, slash));
+        auto it = byName.find(name + "/");
+        ObjectId sub = updateDir(it == byName.end() ? ObjectId() : it->second.id, change, last, dirPath.size(), repoPath);
+        if(sub.isNull()) byName.erase(name + "/");//nothing left below it
+        else byName[name + "/"] = Tree::Entry{true, sub, name};
+        change = last;
+    }
+    Tree::Entries entries;
+    entries.reserve(byName.size());
+    for(auto& item : byName){
+        entries.push_back(std::move(item.second));
+    }
+    return Tree::write(std::move(entries), repoPath);
+}
+
+ObjectId Tree::update(const ObjectId& root, const Manifest& addition, const PathSet& removal, const std::string& repoPath){
+    //merge both sorted lists into one; a path both added and removed ends up removed
+    std::vector<Change> changes;
+    changes.reserve(addition.size() + removal.size());
+    auto add = addition.begin();
+    auto rm = removal.begin();
+    while(add != addition.end() || rm != removal.end()){
+        if(rm == removal.end() || (add != addition.end() && add->name() < **rm)){
+            changes.push_back({add->name(), &add->id});
+            ++add;
+        }else{
+            if(add != addition.end() && add->name() == **rm) ++add;
+            changes.push_back({**rm, nullptr});
+            ++rm;
+        }
+    }
+    if(changes.empty()) return root;
+    return updateDir(root, changes.begin(), changes.end(), 0, repoPath);
+}
+
+ObjectId Tree::build(const Manifest& files, const std::string& repoPath){
+    return update(ObjectId(), files, PathSet(), repoPath);
+}
+
+bool Tree::lookup(const ObjectId& root, std::string_view path, ObjectId& id, const std::string& repoPath){
+    ObjectId dir = root;
+    while(true){
+        size_t slash = path.find('/');
+        Entry probe{slash != std::string_view::npos, ObjectId(), std::string(path.substr(0, slash))};
+        std::shared_ptr<const Entries> entries = load(dir, repoPath);
+        auto it = std::lower_bound(entries->begin(), entries->end(), probe, entryLess);
+        if(it == entries->end() || it->isTree != probe.isTree || it->name != probe.name) return false;
+        if(!probe.isTree){
+            id = it->id;
+            return true;
+        }
+        dir = it->id;
+        path = path.substr(slash + 1);
+    }
+}
+
+//helper function to append the files below a directory
+static void flattenDir(const ObjectId& id, std::string& prefix, Manifest& files, const std::string& repoPath){
+    size_t length = prefix.size();
+    for(auto& entry : *Tree::load(id, repoPath)){
+        prefix += entry.name;
+        if(entry.isTree){
+            prefix += '/';
+            flattenDir(entry.id, prefix, files, repoPath);
+        }else{
+            files.append(prefix, entry.id);
+        }
+        prefix.resize(length);
+    }
+}
+void Tree::flatten(const ObjectId& root, Manifest& files, const std::string& repoPath){
+    std::string prefix;
+    flattenDir(root, prefix, files, repoPath);
+}
@@ -0,0 +1,77 @@
+#include "../include/Utils.h"
+#include "../include/UntrackedCache.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <sys/stat.h>
+
+//file format: a header "untracked-cache <ignore hash> <tracked key>", then for each directory
+//a "D <mtime> <prefix>" line followed by "d <name>" (subdirectory), "p <name>" (ignored
+//subdirectory) and "<flag> <name>" (file) lines
+UntrackedCache::UntrackedCache(const std::string& repoPath, const std::string& ignoreHash, const std::string& trackedKey)
+    : path(Utils::join(repoPath, "untracked-cache")), ignoreHash(ignoreHash), trackedKey(trackedKey), sameTracked(false), writtenAt(0) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return;
+    writtenAt = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    std::string content = Utils::readContentsAsString(path);
+    size_t eol = content.find('\n');
+    if(eol == std::string::npos) return;
+    std::string header = content.substr(0, eol);
+    std::string expected = "untracked-cache " + ignoreHash + " ";
+    if(header.compare(0, expected.size(), expected) != 0) return;//other ignore rules: nothing is reusable
+    sameTracked = header.substr(expected.size()) == trackedKey;
+    Dir* dir = nullptr;
+    for(size_t pos = eol + 1; pos < content.size(); pos = eol + 1){
+        eol = content.find('\n', pos);
+        if(eol == std::string::npos) break;
+        if(eol - pos < 2) continue;
+        char kind = content[pos];
+        std::string rest = content.substr(pos + 2, eol - pos - 2);
+        if(kind == 'D'){
+            size_t space = rest.find(' ');
+            if(space == std::string::npos) break;
+            dir = &dirs[rest.substr(space + 1)];
+            dir->mtime = std::strtoll(rest.c_str(), nullptr, 10);
+        }else if(!dir){
+            break;
+        }else if(kind == 'd'){
+            dir->subdirs.push_back(rest);
+        }else if(kind == 'p'){
+            dir->pruned.push_back(rest);
+        }else{
+            dir->files.push_back({rest, kind});
+        }
+    }
+}
+
+const UntrackedCache::Dir* UntrackedCache::lookup(const std::string& prefix, int64_t mtime) const{
+    auto it = dirs.find(prefix);
+    if(it == dirs.end() || it->second.mtime != mtime) return nullptr;
+    //a directory changed in the same timestamp tick as the cache was written may have changed again
+    if(mtime >= writtenAt) return nullptr;
+    return &it->second;
+}
+
+const UntrackedCache::Dir* UntrackedCache::find(const std::string& prefix) const{
+    auto it = dirs.find(prefix);
+    return it == dirs.end() ? nullptr : &it->second;
+}
+
+void UntrackedCache::save(const std::vector<std::pair<std::string, Dir>>& scanned) const{
+    std::string content = "untracked-cache " + ignoreHash + " " + trackedKey + "\n";
+    for(auto& item : scanned){
+        const Dir& dir = item.second;
+        content += "D " + std::to_string(dir.mtime) + " " + item.first + "\n";
+        for(auto& name : dir.subdirs){
+            content += "d " + name + "\n";
+        }
+        for(auto& name : dir.pruned){
+            content += "p " + name + "\n";
+        }
+        for(auto& file : dir.files){
+            content += file.second;
+            content += " " + file.first + "\n";
+        }
+    }
+    Utils::writeContentsAtomically(path, content);
+}
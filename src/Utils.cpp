@@ -1,8 +1,12 @@
 #include "../include/Utils.h"
+#include "../include/GitliteException.h"
 #include <cstdlib>
 #include <iostream>
 #include <sys/stat.h>
 #include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <filesystem>
 
 /** Assorted utilities.
  *
@@ -111,7 +115,8 @@ namespace SHA1 {
         return ss.str();
     }
     
-    SHA sha;
+    // one hasher per thread, so repositories can be used from several threads
+    thread_local SHA sha;
     
     std::string sha1(std::string message) {
         return sha.sha(message);
@@ -148,25 +153,66 @@ std::string Utils::sha1(const std::vector<unsigned char>& data) {
     return SHA1::sha1(str);
 }
 
+uint32_t Utils::crc32(const void* data, size_t size, uint32_t crc) {
+    static uint32_t table[256];
+    static bool ready = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)ready;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
 /* FILE DELETION */
 /** Deletes FILE if it exists and is not a directory.  Returns true
 *  if FILE was deleted, and false otherwise.  Refuses to delete FILE
-*  and throws IllegalArgumentException unless the directory designated by
-*  FILE also contains a directory named .gitlite. */
-bool Utils::restrictedDelete(const std::string& filepath) {
-    // Extract parent directory
-    size_t pos = filepath.find_last_of("/\\");
-    std::string parentDir = (pos == std::string::npos) ? "." : filepath.substr(0, pos);
-    std::string gitliteDir = parentDir + "/.gitlite";
+*  and throws IllegalArgumentException unless FILE is inside a working
+*  directory: a relative path below ROOT, which holds .gitlite, or a
+*  path whose directory holds .gitlite.  Directories left empty by the
+*  deletion are removed as well, up to ROOT. */
+bool Utils::restrictedDelete(const std::string& filepath, const std::string& root) {
+    bool inWorkdir = !filepath.empty() && filepath[0] != '/'
+                     && ("/" + filepath + "/").find("/../") == std::string::npos;
+    std::string gitliteDir;
+    std::string path = filepath;
+    if (inWorkdir) {
+        gitliteDir = root == "." ? ".gitlite" : join(root, ".gitlite");
+        if (root != ".") path = join(root, filepath);
+    } else {
+        size_t pos = filepath.find_last_of("/\\");
+        std::string parentDir = (pos == std::string::npos) ? "." : filepath.substr(0, pos);
+        gitliteDir = parentDir + "/.gitlite";
+    }
 
     if (!isDirectory(gitliteDir)) {
         throw std::invalid_argument("not .gitlite working directory");
     }
     
-    if (isFile(filepath)) {
-        return remove(filepath.c_str()) == 0;
+    if (!isFile(path) || remove(path.c_str()) != 0) {
+        return false;
     }
-    return false;
+    if (inWorkdir) {
+        // rmdir fails on the first directory that still has entries
+        std::string dir = filepath;
+        size_t pos;
+        while ((pos = dir.find_last_of('/')) != std::string::npos && pos > 0) {
+            dir.resize(pos);
+            std::string dirPath = root == "." ? dir : join(root, dir);
+            if (rmdir(dirPath.c_str()) != 0) break;
+        }
+    }
+    return true;
 }
 /** Deletes FILE if it exists and is not a directory.  Returns true
 *  if FILE was deleted, and false otherwise. */
@@ -245,6 +291,45 @@ void Utils::writeContents(const std::string& filepath, const std::vector<unsigne
     file.write(reinterpret_cast<const char*>(content.data()), content.size());
 }
 
+/** A temporary name next to FILEPATH, unique to this process and call. */
+static std::string temporaryPath(const std::string& filepath) {
+    static std::atomic<unsigned> counter{0};
+    return filepath + ".tmp-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+}
+
+/** Writes CONTENT to a temporary file and renames it to FILEPATH: objects
+ *  are read without locks, so a reader must never see a partial file. */
+void Utils::writeContentsAtomically(const std::string& filepath, const std::string& content) {
+    std::string tmp = temporaryPath(filepath);
+    writeContents(tmp, content);
+    if (std::rename(tmp.c_str(), filepath.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::invalid_argument("cannot create file");
+    }
+}
+
+void Utils::writeContentsAtomically(const std::string& filepath, const std::vector<unsigned char>& content) {
+    std::string tmp = temporaryPath(filepath);
+    writeContents(tmp, content);
+    if (std::rename(tmp.c_str(), filepath.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::invalid_argument("cannot create file");
+    }
+}
+
+bool Utils::copyFileAtomically(const std::string& from, const std::string& to) {
+    if (isFile(to)) {
+        return false;
+    }
+    std::string tmp = temporaryPath(to);
+    std::filesystem::copy_file(from, tmp);
+    if (std::rename(tmp.c_str(), to.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::invalid_argument("cannot create file");
+    }
+    return true;
+}
+
 /** Returns a list of the names of all plain files in the directory DIR, in
 *  order as C++ Strings.  Returns null if DIR does
 *  not denote a directory. */
@@ -315,15 +400,10 @@ std::vector<unsigned char> Utils::serialize(const std::string& obj) {
     return std::vector<unsigned char>(obj.begin(), obj.end());
 }
 
-/** Print a message composed from MSG and ARGS as for the String.format
- *  method, followed by a newline. */
-void Utils::message(const std::string& msg) {
-    std::cout << msg << std::endl;
-}
-
+/** Ends the current command with MSG: main prints it (as the command's
+ *  error result in --batch mode) instead of the process exiting here. */
 void Utils::exitWithMessage(const std::string& msg) {
-    message(msg);
-    std::exit(0);
+    throw GitliteException(msg);
 }
 
 /** Returns true if PATH exists as a file or directory. */
@@ -0,0 +1,529 @@
+#include "../include/Utils.h"
+#include "../include/WorkingTree.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//patterns from .gitliteignore, one per line; later lines win
+//"#" starts a comment, "!" negates, a trailing "/" matches directories only,
+//and a pattern with a "/" is matched against the whole path instead of the name
+class IgnoreRules{
+    struct Pattern{
+        std::string glob;
+        bool negate;
+        bool dirOnly;
+        bool anchored;
+    };
+    std::vector<Pattern> patterns;
+
+public:
+    explicit IgnoreRules(const std::string& text){
+        std::istringstream lines(text);
+        std::string line;
+        while(std::getline(lines, line)){
+            while(!line.empty() && (line.back() == ' ' || line.back() == '\r')) line.pop_back();
+            if(line.empty() || line[0] == '#') continue;
+            Pattern p{line, false, false, false};
+            if(p.glob[0] == '!'){
+                p.negate = true;
+                p.glob.erase(0, 1);
+            }
+            if(!p.glob.empty() && p.glob.back() == '/'){
+                p.dirOnly = true;
+                p.glob.pop_back();
+            }
+            if(p.glob.find('/') != std::string::npos){
+                p.anchored = true;
+                if(p.glob[0] == '/') p.glob.erase(0, 1);
+            }
+            if(!p.glob.empty()) patterns.push_back(p);
+        }
+    }
+    bool empty() const { return patterns.empty(); }
+    bool ignored(const std::string& path, const char* name, bool isDir) const{
+        bool result = false;
+        for(auto& p : patterns){
+            if(p.dirOnly && !isDir) continue;
+            bool match = p.anchored ? fnmatch(p.glob.c_str(), path.c_str(), FNM_PATHNAME) == 0
+                                    : fnmatch(p.glob.c_str(), name, 0) == 0;
+            if(match) result = !p.negate;
+        }
+        return result;
+    }
+};
+
+static int64_t mtimeOf(const struct stat& st){
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+bool WorkingTree::TrackedFiles::isTracked(const std::string& path) const{
+    return !removed.contains(path) && (added.contains(path) || committed.contains(path));
+}
+
+//file found by a scan thread, before its path is interned
+struct FoundFile{
+    std::string path;
+    int64_t mtime;
+    uint64_t size;
+    uint64_t ino;
+    bool untracked;
+};
+//what the file system monitor reported changed since the caches were saved; every other
+//directory still has its cached listing and every other file the stat data in the stat cache
+struct MonitorReport{
+    std::unordered_set<std::string> paths;
+    std::unordered_set<std::string> dirs;//"" or "dir/", whose entries may have changed
+    const std::unordered_map<std::string, WorkingTree::CacheEntry>& statCache;
+};
+//a directory still to be read: it is opened by path from the root only while it is read, so a
+//walk holds one directory fd per thread however many directories are queued
+struct DirTask{
+    int fd;//-1 until read
+    std::string prefix;//path of the directory with a trailing '/', empty for the root
+};
+struct Worker{
+    std::mutex lock;
+    std::deque<DirTask> tasks;//the owner takes from the back, thieves from the front
+    std::vector<FoundFile> found;
+    std::vector<std::string> pruned;//ignored directories, "dir/"
+    std::vector<std::pair<std::string, UntrackedCache::Dir>> listings;
+    bool changed = false;//some listing was read or reflagged instead of reused as it was
+};
+
+//directory walk over a work-stealing pool: each worker pushes the subdirectories it finds
+//onto its own deque, and an idle worker steals the oldest (usually largest) task of another
+class Walker{
+    const IgnoreRules& rules;
+    const SparseCheckout& sparse;
+    const WorkingTree::TrackedFiles& tracked;
+    const UntrackedCache& cache;
+    const MonitorReport* report;//null without a monitor
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> pending;//tasks queued or being read
+    int rootFd;
+    std::mutex failureLock;
+    std::string failure;//a directory that could not be opened for want of fds, "" for none
+
+    static std::string pathOf(const DirTask& dir){
+        return dir.prefix.empty() ? "." : dir.prefix.substr(0, dir.prefix.size() - 1);
+    }
+    void fail(const DirTask& dir){
+        std::lock_guard<std::mutex> guard(failureLock);
+        if(failure.empty()) failure = pathOf(dir);
+    }
+    //a directory that cannot be opened because it went away, or is no longer a directory, is
+    //left out; running out of fds is not taken for that
+    bool openDir(DirTask& dir){
+        dir.fd = openat(rootFd, pathOf(dir).c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if(dir.fd >= 0) return true;
+        if(errno == EMFILE || errno == ENFILE) fail(dir);
+        return false;
+    }
+
+    void push(size_t self, DirTask task){
+        pending++;
+        std::lock_guard<std::mutex> guard(workers[self]->lock);
+        workers[self]->tasks.push_back(std::move(task));
+    }
+    bool pop(size_t self, DirTask& task){
+        {
+            std::lock_guard<std::mutex> guard(workers[self]->lock);
+            if(!workers[self]->tasks.empty()){
+                task = std::move(workers[self]->tasks.back());
+                workers[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        for(size_t i = 1; i < workers.size(); i++){
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if(!victim.tasks.empty()){
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+    void file(size_t self, const DirTask& dir, const std::string& name, char flag, const struct stat* st);
+    void subdir(size_t self, const DirTask& dir, const std::string& name);
+    void entry(size_t self, const DirTask& dir, const char* name, unsigned char type, UntrackedCache::Dir& listing);
+    void readEntries(size_t self, const DirTask& dir, UntrackedCache::Dir& listing);
+    void read(size_t self, DirTask dir);
+
+public:
+    Walker(const IgnoreRules& rules, const SparseCheckout& sparse, const WorkingTree::TrackedFiles& tracked,
+           const UntrackedCache& cache, const MonitorReport* report, size_t threads)
+        : rules(rules), sparse(sparse), tracked(tracked), cache(cache), report(report), pending(0), rootFd(-1) {
+        for(size_t i = 0; i < threads; i++){
+            workers.push_back(std::make_unique<Worker>());
+        }
+    }
+    void run(size_t self){
+        while(pending.load() > 0){
+            DirTask task;
+            if(pop(self, task)){
+                read(self, task);
+                pending--;
+            }else{
+                std::this_thread::yield();
+            }
+        }
+    }
+    void walk(int fd){
+        rootFd = fd;
+        push(0, DirTask{-1, ""});
+        //read the top directory alone; threads only start if it has subdirectories
+        DirTask top;
+        pop(0, top);
+        read(0, top);
+        pending--;
+        if(pending.load() == 0) return;
+        std::vector<std::thread> threads;
+        for(size_t i = 1; i < workers.size(); i++){
+            threads.emplace_back(&Walker::run, this, i);
+        }
+        run(0);
+        for(auto& t : threads){
+            t.join();
+        }
+    }
+    const std::vector<std::unique_ptr<Worker>>& results() const { return workers; }
+    const std::string& failed() const { return failure; }
+};
+
+//record a file; only tracked files are stat'ed
+void Walker::file(size_t self, const DirTask& dir, const std::string& name, char flag, const struct stat* st){
+    std::string path = dir.prefix + name;
+    if(flag == UntrackedCache::UNTRACKED){
+        workers[self]->found.push_back(FoundFile{path, 0, 0, 0, true});
+        return;
+    }
+    //an ignored file is still checked if it is tracked
+    if(flag == UntrackedCache::IGNORED && !tracked.isTracked(path)) return;
+    if(report && !st && !report->paths.count(path)){
+        auto it = report->statCache.find(path);
+        if(it != report->statCache.end()){
+            const WorkingTree::CacheEntry& e = it->second;
+            workers[self]->found.push_back(FoundFile{path, e.mtime, e.size, e.ino, false});
+            return;
+        }
+    }
+    struct stat own;
+    if(!st){
+        if(fstatat(dir.fd, name.c_str(), &own, AT_SYMLINK_NOFOLLOW) != 0 || !S_ISREG(own.st_mode)) return;
+        st = &own;
+    }
+    workers[self]->found.push_back(FoundFile{path, mtimeOf(*st), static_cast<uint64_t>(st->st_size), static_cast<uint64_t>(st->st_ino), false});
+}
+
+void Walker::subdir(size_t self, const DirTask& dir, const std::string& name){
+    push(self, DirTask{-1, dir.prefix + name + "/"});
+}
+
+void Walker::entry(size_t self, const DirTask& dir, const char* name, unsigned char type, UntrackedCache::Dir& listing){
+    if(name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) return;
+    if(dir.prefix.empty() && std::string_view(name) == ".gitlite") return;
+    std::string path = dir.prefix + name;
+    struct stat st;
+    bool statted = false;
+    if(type == DT_UNKNOWN){
+        if(fstatat(dir.fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return;
+        statted = true;
+        type = S_ISREG(st.st_mode) ? DT_REG : S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN;
+    }
+    //paths outside the sparse set are not listed at all
+    if(type == DT_REG){
+        if(!sparse.contains(path)) return;
+        char flag = !rules.empty() && rules.ignored(path, name, false) ? UntrackedCache::IGNORED
+                  : tracked.isTracked(path) ? UntrackedCache::TRACKED : UntrackedCache::UNTRACKED;
+        listing.files.push_back({name, flag});
+        file(self, dir, name, flag, statted ? &st : nullptr);
+    }else if(type == DT_DIR){
+        if(!sparse.reaches(path + "/")) return;
+        if(!rules.empty() && rules.ignored(path, name, true)){
+            listing.pruned.push_back(name);
+            workers[self]->pruned.push_back(path + "/");
+            return;
+        }
+        //nested repositories are listed too, in case their .gitlite goes away
+        listing.subdirs.push_back(name);
+        subdir(self, dir, name);
+    }
+}
+
+#ifdef SYS_getdents64
+//record layout returned by getdents64
+struct LinuxDirent64{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+void Walker::readEntries(size_t self, const DirTask& dir, UntrackedCache::Dir& listing){
+    alignas(8) char buffer[32768];
+    while(true){
+        long n = syscall(SYS_getdents64, dir.fd, buffer, sizeof(buffer));
+        if(n <= 0) break;
+        for(long pos = 0; pos < n;){
+            LinuxDirent64* d = reinterpret_cast<LinuxDirent64*>(buffer + pos);
+            entry(self, dir, d->d_name, d->d_type, listing);
+            pos += d->d_reclen;
+        }
+    }
+}
+#else
+//no getdents64: the portable readdir interface on a copy of the fd
+void Walker::readEntries(size_t self, const DirTask& dir, UntrackedCache::Dir& listing){
+    int fd = dup(dir.fd);
+    DIR* d = fd < 0 ? nullptr : fdopendir(fd);
+    if(d == nullptr){
+        if(fd >= 0) close(fd);
+        fail(dir);
+        return;
+    }
+    struct dirent* e;
+    while((e = readdir(d)) != nullptr){
+        entry(self, dir, e->d_name, e->d_type, listing);
+    }
+    closedir(d);
+}
+#endif
+
+//read one directory, or replay its cached listing if the directory has not changed since
+void Walker::read(size_t self, DirTask dir){
+    if(!openDir(dir)) return;
+    //a nested repository belongs to itself
+    struct stat gitlite;
+    if(!dir.prefix.empty() && fstatat(dir.fd, ".gitlite", &gitlite, 0) == 0 && S_ISDIR(gitlite.st_mode)){
+        close(dir.fd);
+        return;
+    }
+    Worker& worker = *workers[self];
+    UntrackedCache::Dir listing;
+    const UntrackedCache::Dir* cached = nullptr;
+    if(report && !report->dirs.count(dir.prefix)) cached = cache.find(dir.prefix);
+    if(cached){
+        listing.mtime = cached->mtime;
+    }else{
+        struct stat st;
+        listing.mtime = fstat(dir.fd, &st) == 0 ? mtimeOf(st) : -1;
+        cached = cache.lookup(dir.prefix, listing.mtime);
+    }
+    if(cached){
+        listing.subdirs = cached->subdirs;
+        listing.pruned = cached->pruned;
+        for(auto& name : cached->subdirs){
+            subdir(self, dir, name);
+        }
+        for(auto& name : cached->pruned){
+            worker.pruned.push_back(dir.prefix + name + "/");
+        }
+        if(!cache.flagsValid()) worker.changed = true;
+        listing.files.reserve(cached->files.size());
+        for(auto& f : cached->files){
+            char flag = f.second;
+            //the stage or HEAD moved since: only the names can be trusted
+            if(flag != UntrackedCache::IGNORED && !cache.flagsValid()){
+                flag = tracked.isTracked(dir.prefix + f.first) ? UntrackedCache::TRACKED : UntrackedCache::UNTRACKED;
+            }
+            listing.files.push_back({f.first, flag});
+            file(self, dir, f.first, flag, nullptr);
+        }
+    }else{
+        worker.changed = true;
+        readEntries(self, dir, listing);
+    }
+    worker.listings.push_back({dir.prefix, std::move(listing)});
+    close(dir.fd);
+}
+
+static std::string readIgnoreFile(const std::string& root){
+    std::string ignorePath = Utils::join(root, ".gitliteignore");
+    return Utils::isFile(ignorePath) ? Utils::readContentsAsString(ignorePath) : "";
+}
+WorkingTree::WorkingTree(const std::string& root, const TrackedFiles& tracked)
+    : WorkingTree(root, readIgnoreFile(root), tracked) {}
+
+//the listings depend on the ignore rules and the sparse set
+static std::string rulesHash(const std::string& ignoreText, const SparseCheckout& sparse){
+    if(sparse.full()) return ignoreText.empty() ? "-" : Utils::sha1(ignoreText);
+    return Utils::sha1(ignoreText, "sparse\n" + sparse.text());
+}
+WorkingTree::WorkingTree(const std::string& root, const std::string& ignoreText, const TrackedFiles& tracked)
+    : root(root), cacheLoaded(false), cacheDirty(false), cacheTime(0),
+      sparse(SparseCheckout::load(Utils::join(root, ".gitlite"))),
+      untrackedCache(Utils::join(root, ".gitlite"), rulesHash(ignoreText, sparse), tracked.key),
+      listingsDirty(false), tokenDirty(false) {
+    //the caches saved last were valid for this token, so only what changed since needs a look
+    std::string tokenPath = Utils::join(root, ".gitlite/fsmonitor-token");
+    std::string saved = Utils::isFile(tokenPath) ? Utils::readContentsAsString(tokenPath) : "";
+    FsMonitor::Changes changes;
+    bool monitored = FsMonitor::query(root, saved, changes);
+    if(monitored){
+        monitorToken = changes.token;
+        tokenDirty = monitorToken != saved;
+        //caches written without the monitor may be older than the new token
+        if(changes.full) listingsDirty = cacheDirty = true;
+    }
+    scan(tracked, ignoreText, monitored && !changes.full ? &changes : nullptr);
+}
+
+void WorkingTree::scan(const TrackedFiles& tracked, const std::string& ignoreText, const FsMonitor::Changes* changes){
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0){
+        if(errno == EMFILE || errno == ENFILE) Utils::exitWithMessage("Unable to read " + root + ": too many open files.");
+        return;
+    }
+    IgnoreRules rules(ignoreText);
+    std::unique_ptr<MonitorReport> report;
+    if(changes){
+        loadCache();
+        report.reset(new MonitorReport{{}, {}, statCache});
+        for(auto& path : changes->paths){
+            report->paths.insert(path);
+            report->dirs.insert(path.substr(0, path.rfind('/') + 1));
+            report->dirs.insert(path + "/");//it may be a directory removed and created again
+            //the stat data cached for a changed file may be out of date
+            if(statCache.count(path)) cacheDirty = true;
+        }
+    }
+    size_t threads = std::min<size_t>(MAX_THREADS, std::max(1u, std::thread::hardware_concurrency()));
+    Walker walker(rules, sparse, tracked, untrackedCache, report.get(), threads);
+    walker.walk(fd);
+    close(fd);
+    if(!walker.failed().empty()){
+        std::string dir = walker.failed() == "." ? root : Utils::join(root, walker.failed());
+        Utils::exitWithMessage("Unable to read " + dir + ": too many open files.");
+    }
+    std::vector<std::string> prunedDirs;
+    for(auto& worker : walker.results()){
+        for(auto& f : worker->found){
+            files.push_back(File{PathPool::intern(f.path, refs), f.mtime, f.size, f.ino, f.untracked});
+        }
+        prunedDirs.insert(prunedDirs.end(), worker->pruned.begin(), worker->pruned.end());
+        for(auto& listing : worker->listings){
+            listings.push_back(std::move(listing));
+        }
+        if(worker->changed) listingsDirty = true;
+    }
+    auto byPath = [](const File& a, const File& b){ return *a.path < *b.path; };
+    std::sort(files.begin(), files.end(), byPath);
+    if(prunedDirs.empty()) return;
+
+    //tracked files in ignored directories, which the walk did not enter
+    std::sort(prunedDirs.begin(), prunedDirs.end());
+    size_t scanned = files.size();
+    for(const Manifest* manifest : {&tracked.committed, &tracked.added}){
+        for(auto& entry : *manifest){
+            const std::string& path = entry.name();
+            //pruned directories never nest, so only the last one sorting before the path can hold it
+            auto dir = std::upper_bound(prunedDirs.begin(), prunedDirs.end(), path);
+            if(dir == prunedDirs.begin() || path.compare(0, (dir - 1)->size(), *(dir - 1)) != 0) continue;
+            if(!tracked.isTracked(path) || !sparse.contains(path) || find(path)) continue;
+            struct stat st;
+            if(lstat(Utils::join(root, path).c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            files.push_back(File{entry.path, mtimeOf(st), static_cast<uint64_t>(st.st_size), static_cast<uint64_t>(st.st_ino), false});
+        }
+    }
+    if(files.size() != scanned) std::sort(files.begin(), files.end(), byPath);
+}
+
+const WorkingTree::File* WorkingTree::find(std::string_view path) const{
+    auto it = std::lower_bound(files.begin(), files.end(), path, [](const File& f, std::string_view p){
+        return std::string_view(*f.path) < p;
+    });
+    if(it == files.end() || *it->path != path) return nullptr;
+    return &*it;
+}
+
+//stat-cache format: a "stat-cache" line and then "<blobhash> <mtime> <size> <ino> <path>" lines
+void WorkingTree::loadCache(){
+    cacheLoaded = true;
+    std::string path = Utils::join(root, ".gitlite/stat-cache");
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return;
+    cacheTime = mtimeOf(st);
+    std::string content = Utils::readContentsAsString(path);
+    size_t eol = content.find('\n');
+    if(eol == std::string::npos || content.compare(0, eol, "stat-cache") != 0) return;
+    statCache.reserve(files.size());
+    for(size_t pos = eol + 1; pos < content.size(); pos = eol + 1){
+        eol = content.find('\n', pos);
+        if(eol == std::string::npos) break;
+        if(eol - pos < 41) continue;
+        CacheEntry entry;
+        entry.id = ObjectId::fromHex(std::string_view(content).substr(pos, 40));
+        char* end = nullptr;
+        entry.mtime = std::strtoll(content.c_str() + pos + 41, &end, 10);
+        entry.size = std::strtoull(end, &end, 10);
+        entry.ino = std::strtoull(end, &end, 10);
+        if(*end != ' ' || end >= content.c_str() + eol) continue;
+        size_t start = end + 1 - content.c_str();
+        statCache.emplace(content.substr(start, eol - start), entry);
+    }
+}
+
+ObjectId WorkingTree::idOf(const File& file){
+    if(!cacheLoaded) loadCache();
+    auto it = statCache.find(file.name());
+    if(it != statCache.end()){
+        const CacheEntry& cached = it->second;
+        //a file modified in the same timestamp tick as the cache was written may have changed again
+        if(cached.mtime == file.mtime && cached.size == file.size && cached.ino == file.ino && file.mtime < cacheTime){
+            return cached.id;
+        }
+    }
+    ObjectId id = ObjectId::fromHex(Utils::sha1(Utils::readContents(Utils::join(root, file.name()))));
+    statCache[file.name()] = CacheEntry{file.mtime, file.size, file.ino, id};
+    cacheDirty = true;
+    return id;
+}
+
+void WorkingTree::saveCache(){
+    std::string gitliteDir = Utils::join(root, ".gitlite");
+    if(!Utils::isDirectory(gitliteDir)) return;
+    //the token is only written alongside caches valid for it
+    std::string tokenPath = Utils::join(gitliteDir, "fsmonitor-token");
+    if(tokenDirty) Utils::simpleDelete(tokenPath);
+    if(listingsDirty){
+        untrackedCache.save(listings);
+        listingsDirty = false;
+    }
+    if(cacheDirty) saveStatCache();
+    if(tokenDirty){
+        Utils::writeContentsAtomically(tokenPath, monitorToken);
+        tokenDirty = false;
+    }
+}
+
+void WorkingTree::saveStatCache(){
+    if(!cacheLoaded) loadCache();
+    std::string content = "stat-cache\n";
+    //only entries still matching a tracked file in the working directory are kept
+    for(auto& file : files){
+        auto it = statCache.find(file.name());
+        if(it == statCache.end() || file.untracked) continue;
+        const CacheEntry& e = it->second;
+        if(e.mtime != file.mtime || e.size != file.size || e.ino != file.ino) continue;
+        content += e.id.hex() + " " + std::to_string(e.mtime) + " " + std::to_string(e.size) + " "
+                   + std::to_string(e.ino) + " " + file.name() + "\n";
+    }
+    std::string path = Utils::join(root, ".gitlite/stat-cache");
+    Utils::writeContentsAtomically(path, content);
+    cacheDirty = false;
+}
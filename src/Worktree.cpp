@@ -0,0 +1,72 @@
+#include "../include/Utils.h"
+#include "../include/Worktree.h"
+#include "../include/Pointers.h"
+#include <string>
+#include <vector>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+//helper function to get the absolute path of an existing directory ("" if it does not exist)
+static std::string absolute(const std::string& path){
+    char resolved[PATH_MAX];
+    if(!realpath(path.c_str(), resolved)) return "";
+    return resolved;
+}
+
+std::string Worktree::commonDir(const std::string& dir){
+    std::string path = Utils::join(dir, "commondir");
+    if(!Utils::isFile(path)) return dir;
+    return Utils::readContentsAsString(path);
+}
+
+std::vector<std::string> Worktree::linked(const std::string& repoPath){
+    std::vector<std::string> dirs;
+    std::string registry = Utils::join(repoPath, "worktrees");
+    for(auto& name : Utils::plainFilenamesIn(registry)){
+        if(name.find(".lock") != std::string::npos) continue;
+        std::string dir = Utils::readContentsAsString(Utils::join(registry, name));
+        //a working tree deleted by hand is skipped
+        if(Utils::isFile(Utils::join(dir, "HEAD"))) dirs.push_back(dir);
+    }
+    return dirs;
+}
+
+std::string Worktree::holderOf(const std::string& branch, const std::string& self, const std::string& repoPath){
+    std::string me = absolute(self);
+    std::vector<std::string> dirs = linked(repoPath);
+    dirs.insert(dirs.begin(), repoPath);
+    for(auto& dir : dirs){
+        if(absolute(dir) == me) continue;
+        if(Pointers::is_ref(dir) && Pointers::get_ref(dir) == branch) return dir;
+    }
+    return "";
+}
+
+void Worktree::add(const std::string& dir, const std::string& hash, const std::string& repoPath){
+    Utils::createDirectories(dir);
+    Utils::writeContents(Utils::join(dir, "commondir"), absolute(repoPath));
+    Utils::writeContents(Utils::join(dir, "HEAD"), hash);
+    Utils::writeContents(Utils::join(dir, "stage"), "");
+    //named after the directory of the tree, with a number added if another tree has the name
+    std::string registry = Utils::join(repoPath, "worktrees");
+    Utils::createDirectories(registry);
+    std::string path = absolute(Utils::join(dir, ".."));
+    std::string base = path.substr(path.find_last_of('/') + 1);
+    if(base.empty()) base = "worktree";
+    std::string name = base;
+    for(int i = 1; Utils::exists(Utils::join(registry, name)); i++) name = base + std::to_string(i);
+    Utils::writeContents(Utils::join(registry, name), absolute(dir));
+}
+
+void Worktree::remove(const std::string& dir, const std::string& repoPath){
+    std::string self = absolute(dir);
+    std::string registry = Utils::join(repoPath, "worktrees");
+    for(auto& name : Utils::plainFilenamesIn(registry)){
+        std::string path = Utils::join(registry, name);
+        if(Utils::readContentsAsString(path) == self) std::remove(path.c_str());
+    }
+    for(auto& name : Utils::plainFilenamesIn(dir)) std::remove(Utils::join(dir, name).c_str());
+    rmdir(dir.c_str());
+}
@@ -0,0 +1,467 @@
+"""Usage: python3 bench.py [--commits=N] [--reps=R] [--progdir=DIR] SCENARIO ...
+
+Builds a synthetic repository in a temporary directory and times gitlite
+commands against it.  Commit files are written directly (the same format
+Commit::writeCommitFile uses), so large histories are cheap to set up.
+
+   SCENARIO is one of:
+       find      find --substring/--grep with the trigram index versus a
+                 linear scan of every message (index file removed)
+       log-path  log -- <file> with changed-path Bloom filters versus
+                 reading every commit (filters removed); prints the
+                 filters' false-positive rate
+       commit    commit of one changed file in a tree of N files (N is
+                 --commits) spread over 100 directories, versus the first
+                 commit that writes every tree
+       status    status over N tracked files (N is --commits) in 100
+                 directories plus N/10 untracked ones, first with cold caches,
+                 then warm, then with only the untracked cache dropped, then
+                 with the file system monitor running
+       batch     per-command latency of small commands (status, branch,
+                 checkout of one file, rm-branch) over a history of N
+                 commits, one process per command versus one --batch session
+       bitmaps   gc --repack over a history of N commits (with trees and
+                 blobs) walking the history versus reusing the reachability
+                 bitmaps of the last repack, and fetch and push of 10 new
+                 commits with and without bitmaps (try --commits=100000)
+       fetch-all 40 branches of 5 commits each on top of a history of N
+                 commits, fetched into an empty repository by one fetch per
+                 branch versus one fetch --all
+       sparse    status and reset between two commits that change every one
+                 of N files in 100 directories, with the whole tree checked
+                 out versus a sparse checkout of one directory
+       diff      diff --stat and the full patch between two commits that
+                 move N files (N is --commits) to another directory, once
+                 unchanged (renames found by blob id) and once with one line
+                 of each edited (renames found by similarity), and the same
+                 for N/4 files to show how rename detection scales
+       blame     blame of a 1000-line file edited by every 10th of N commits,
+                 with an empty blame cache, with the cache of the last blame,
+                 and after one more commit that edits the file
+"""
+
+import sys, time, hashlib, random, statistics
+from subprocess import check_output, Popen, PIPE, DEVNULL
+from os.path import abspath, dirname, join
+from os import makedirs, remove, listdir
+from getopt import getopt, GetoptError
+from tempfile import mkdtemp
+from shutil import rmtree, copy
+
+WORDS = ["fix", "add", "remove", "parser", "lexer", "crash", "refactor", "docs",
+         "test", "merge", "cleanup", "update", "network", "storage", "cache",
+         "config", "build", "release", "typo", "perf"]
+
+def write_commit(repo, message, timestamp, parents, files):
+    content = "message: {}\ntimestamp: {}\n".format(message, timestamp)
+    for p in parents:
+        content += "parent: {}\n".format(p)
+    for name in sorted(files):
+        content += "{} {}\n".format(name, files[name])
+    h = hashlib.sha1(content.encode()).hexdigest()
+    with open(join(repo, ".gitlite", "commits", h), "w") as f:
+        f.write(content)
+    return h
+
+def make_history(root, commits, seed=1):
+    """A linear history of COMMITS commits on master; returns the commit ids,
+    oldest first."""
+    rng = random.Random(seed)
+    g = join(root, ".gitlite")
+    for d in ["branches", "commits", "blobs", "remotes"]:
+        makedirs(join(g, d))
+    with open(join(g, "HEAD"), "w") as f:
+        f.write("ref: .gitlite/branches/master")
+    open(join(g, "stage"), "w").close()
+    ids = [write_commit(root, "initial commit", 0, [], {})]
+    files = {}
+    for i in range(commits):
+        msg = " ".join(rng.choice(WORDS) for _ in range(4)) + " #{}".format(i)
+        files["f{}.txt".format(rng.randrange(50))] = hashlib.sha1(str(i).encode()).hexdigest()
+        ids.append(write_commit(root, msg, 1700000000 + i, [ids[-1]], files))
+    with open(join(g, "branches", "master"), "w") as f:
+        f.write(ids[-1])
+    return ids
+
+def write_object(repo, kind, content):
+    h = hashlib.sha1(content.encode()).hexdigest()
+    with open(join(repo, ".gitlite", kind, h), "w") as f:
+        f.write(content)
+    return h
+
+def add_tree_commits(root, parent, files, first, count, seed=1):
+    """COUNT commits on top of PARENT, each changing one of 50 files, written
+    as blobs, one flat tree and a commit with a tree line; returns the tip."""
+    rng = random.Random(seed + first)
+    for i in range(first, first + count):
+        files["f{}.txt".format(rng.randrange(50))] = write_object(root, "blobs", "rev {}\n".format(i))
+        tree = write_object(root, "trees", "".join(
+            "blob {} {}\n".format(files[name], name) for name in sorted(files)))
+        content = "message: change #{}\ntimestamp: {}\nparent: {}\ntree: {}\n".format(
+            i, 1700000000 + i, parent, tree)
+        parent = write_object(root, "commits", content)
+    return parent
+
+def make_tree_history(root, commits):
+    """A linear history of COMMITS commits on master in the tree format;
+    returns the tip and the files of its tree."""
+    g = join(root, ".gitlite")
+    for d in ["branches", "commits", "blobs", "trees", "remotes"]:
+        makedirs(join(g, d))
+    with open(join(g, "HEAD"), "w") as f:
+        f.write("ref: .gitlite/branches/master")
+    open(join(g, "stage"), "w").close()
+    files = {}
+    tip = add_tree_commits(root, write_commit(root, "initial commit", 0, [], {}), files, 0, commits)
+    with open(join(g, "branches", "master"), "w") as f:
+        f.write(tip)
+    return tip, files
+
+def timed(prog, root, args, reps):
+    samples = []
+    for _ in range(reps):
+        start = time.perf_counter()
+        check_output([prog] + args, cwd=root, stderr=DEVNULL)
+        samples.append(time.perf_counter() - start)
+    return statistics.median(samples)
+
+def report(label, seconds):
+    print("{:<44} {:>10.2f} ms".format(label, seconds * 1000))
+
+def bench_find(prog, root, commits, reps):
+    make_history(root, commits)
+    check_output([prog, "commit-graph", "write"], cwd=root)
+    queries = [["--substring", "parser crash"], ["--substring", "#{}".format(commits // 2)],
+               ["--grep", "^fix .*(lexer|parser)"], ["--grep", "typo perf"]]
+    indexed = [timed(prog, root, ["find"] + q, reps) for q in queries]
+    remove(join(root, ".gitlite", "commit-graph", "trigram-index"))
+    linear = [timed(prog, root, ["find"] + q, reps) for q in queries]
+    for q, a, b in zip(queries, indexed, linear):
+        report("find {} (indexed)".format(" ".join(q)), a)
+        report("find {} (linear)".format(" ".join(q)), b)
+
+def bench_log_path(prog, root, commits, reps):
+    make_history(root, commits)
+    check_output([prog, "commit-graph", "write"], cwd=root)
+    args = ["log", "--stats", "--", "f7.txt"]
+    stats = check_output([prog] + args, cwd=root, universal_newlines=True).splitlines()[-1]
+    filtered = timed(prog, root, args, reps)
+    remove(join(root, ".gitlite", "commit-graph", "bloom-data"))
+    unfiltered = timed(prog, root, args, reps)
+    report("log -- f7.txt (Bloom filters)", filtered)
+    report("log -- f7.txt (no filters)", unfiltered)
+    print(stats)
+
+def write_stage(root, files):
+    with open(join(root, ".gitlite", "stage"), "w") as f:
+        for name in sorted(files):
+            f.write("{} {}\n".format(name, files[name]))
+
+def bench_commit(prog, root, files, reps):
+    make_history(root, 0)
+    makedirs(join(root, ".gitlite", "trees"))
+    staged = {"d{}/f{}.txt".format(i % 100, i): hashlib.sha1(str(i).encode()).hexdigest()
+              for i in range(files)}
+    write_stage(root, staged)
+    start = time.perf_counter()
+    check_output([prog, "commit", "all files"], cwd=root)
+    report("commit {} new files".format(files), time.perf_counter() - start)
+    samples = []
+    for r in range(reps):
+        write_stage(root, {"d7/f7.txt": hashlib.sha1("rev{}".format(r).encode()).hexdigest()})
+        start = time.perf_counter()
+        check_output([prog, "commit", "change {}".format(r)], cwd=root)
+        samples.append(time.perf_counter() - start)
+    report("commit 1 changed file of {}".format(files), statistics.median(samples))
+
+def bench_status(prog, root, files, reps):
+    make_history(root, 0)
+    makedirs(join(root, ".gitlite", "trees"))
+    staged = {}
+    for i in range(files):
+        name = "d{}/f{}.txt".format(i % 100, i)
+        content = "file {}\n".format(i).encode()
+        makedirs(join(root, "d{}".format(i % 100)), exist_ok=True)
+        with open(join(root, name), "wb") as f:
+            f.write(content)
+        staged[name] = hashlib.sha1(content).hexdigest()
+    write_stage(root, staged)
+    check_output([prog, "commit", "all files"], cwd=root)
+    makedirs(join(root, "out"))
+    for i in range(files // 10):
+        with open(join(root, "out", "u{}.o".format(i)), "w") as f:
+            f.write("untracked {}\n".format(i))
+    time.sleep(0.1)  # age the files past the caches' racy window
+    cold = timed(prog, root, ["status"], 1)
+    time.sleep(0.1)
+    warm = timed(prog, root, ["status"], reps)
+    remove(join(root, ".gitlite", "untracked-cache"))
+    no_untracked_cache = timed(prog, root, ["status"], 1)
+    check_output([prog, "fsmonitor", "start"], cwd=root)
+    try:
+        check_output([prog, "status"], cwd=root)  # first answer asks for a full scan
+        time.sleep(0.1)
+        monitored = timed(prog, root, ["status"], reps)
+    finally:
+        check_output([prog, "fsmonitor", "stop"], cwd=root)
+    report("status, {} files (cold caches)".format(files), cold)
+    report("status, {} files (warm caches)".format(files), warm)
+    report("status, {} files (no untracked cache)".format(files), no_untracked_cache)
+    report("status, {} files (fsmonitor)".format(files), monitored)
+
+def bench_batch(prog, root, commits, reps):
+    make_history(root, commits)
+    with open(join(root, "g.txt"), "w") as f:
+        f.write("new file\n")
+    commands = [["status"], ["branch", "tmp"], ["add", "g.txt"], ["rm-branch", "tmp"]]
+    rounds = reps * 20
+    execs = {c[0]: [] for c in commands}
+    for _ in range(rounds):
+        for c in commands:
+            start = time.perf_counter()
+            check_output([prog] + c, cwd=root, stderr=DEVNULL)
+            execs[c[0]].append(time.perf_counter() - start)
+    batched = {c[0]: [] for c in commands}
+    session = Popen([prog, "--batch"], cwd=root, stdin=PIPE, stdout=PIPE)
+    try:
+        for _ in range(rounds):
+            for c in commands:
+                start = time.perf_counter()
+                session.stdin.write((" ".join(c) + "\n").encode())
+                session.stdin.flush()
+                status, length = session.stdout.readline().split()
+                session.stdout.read(int(length))
+                batched[c[0]].append(time.perf_counter() - start)
+    finally:
+        session.stdin.close()
+        session.wait()
+    for c in commands:
+        report("{} (process per command)".format(c[0]), statistics.median(execs[c[0]]))
+        report("{} (--batch)".format(c[0]), statistics.median(batched[c[0]]))
+
+def bench_bitmaps(prog, root, commits, reps):
+    tip, files = make_tree_history(root, commits)
+    g = join(root, ".gitlite")
+    start = time.perf_counter()
+    check_output([prog, "gc", "--repack", "--prune=now"], cwd=root)
+    first = time.perf_counter() - start
+    reused = timed(prog, root, ["gc", "--repack", "--prune=now"], reps)
+    pack = [n for n in listdir(join(g, "packs")) if n.endswith(".pack")][0]
+    bitmap = join(g, "packs", pack[:-5] + ".bitmap")
+    saved = bitmap + ".saved"
+    copy(bitmap, saved)
+    remove(bitmap)
+    walked = timed(prog, root, ["gc", "--repack", "--prune=now"], 1)
+    copy(saved, bitmap)
+    report("gc --repack, {} commits (first)".format(commits), first)
+    report("gc --repack, {} commits (walking)".format(commits), walked)
+    report("gc --repack, {} commits (bitmaps)".format(commits), reused)
+
+    # two copies of the repository as it was, each to fetch into and push to
+    peers = []
+    for name in ["with", "without"]:
+        peer = join(root, name)
+        for d in ["branches", "commits", "blobs", "trees", "remotes", "packs"]:
+            makedirs(join(peer, ".gitlite", d))
+        copy(join(g, "packs", pack), join(peer, ".gitlite", "packs", pack))
+        with open(join(peer, ".gitlite", "HEAD"), "w") as f:
+            f.write("ref: .gitlite/branches/master")
+        open(join(peer, ".gitlite", "stage"), "w").close()
+        with open(join(peer, ".gitlite", "branches", "master"), "w") as f:
+            f.write(tip)
+        with open(join(peer, ".gitlite", "remotes", "origin"), "w") as f:
+            f.write(g)
+        with open(join(g, "remotes", name), "w") as f:
+            f.write(join(peer, ".gitlite"))
+        peers.append(peer)
+    new_tip = add_tree_commits(root, tip, files, commits, 10)
+    with open(join(g, "branches", "master"), "w") as f:
+        f.write(new_tip)
+    fetches, pushes = [], []
+    for peer in peers:
+        if peer.endswith("without"):
+            remove(bitmap)
+        start = time.perf_counter()
+        check_output([prog, "fetch", "origin", "master"], cwd=peer)
+        fetches.append(time.perf_counter() - start)
+        start = time.perf_counter()
+        check_output([prog, "push", peer.rsplit("/", 1)[1], "master"], cwd=root)
+        pushes.append(time.perf_counter() - start)
+    report("fetch of 10 new commits (bitmaps)", fetches[0])
+    report("fetch of 10 new commits (walking)", fetches[1])
+    report("push of 10 new commits (bitmaps)", pushes[0])
+    report("push of 10 new commits (walking)", pushes[1])
+
+def bench_fetch_all(prog, root, commits, reps):
+    origin = join(root, "origin")
+    tip, files = make_tree_history(origin, commits)
+    branches = []
+    for b in range(40):
+        name = "b{}".format(b)
+        branch_tip = add_tree_commits(origin, tip, dict(files), commits + 5 * b, 5, seed=b)
+        with open(join(origin, ".gitlite", "branches", name), "w") as f:
+            f.write(branch_tip)
+        branches.append(name)
+    clients = []
+    for name in ["each", "all"]:
+        client = join(root, name)
+        makedirs(client)
+        check_output([prog, "init"], cwd=client)
+        check_output([prog, "add-remote", "origin", join(origin, ".gitlite")], cwd=client)
+        clients.append(client)
+    start = time.perf_counter()
+    for name in branches:
+        check_output([prog, "fetch", "origin", name], cwd=clients[0])
+    each = time.perf_counter() - start
+    start = time.perf_counter()
+    check_output([prog, "fetch", "--all"], cwd=clients[1])
+    together = time.perf_counter() - start
+    report("fetch of 40 branches, one process each", each)
+    report("fetch --all of 40 branches", together)
+
+def bench_sparse(prog, root, files, reps):
+    make_history(root, 0)
+    makedirs(join(root, ".gitlite", "trees"))
+    for i in range(100):
+        makedirs(join(root, "d{}".format(i)))
+    tips = []
+    for version in range(2):
+        staged = {}
+        for i in range(files):
+            name = "d{}/f{}.txt".format(i % 100, i)
+            content = "file {} version {}\n".format(i, version)
+            with open(join(root, name), "w") as f:
+                f.write(content)
+            write_object(root, "blobs", content)
+            staged[name] = hashlib.sha1(content.encode()).hexdigest()
+        write_stage(root, staged)
+        check_output([prog, "commit", "version {}".format(version)], cwd=root)
+        with open(join(root, ".gitlite", "branches", "master")) as f:
+            tips.append(f.read())
+    for label, sparse in [("whole tree", None), ("sparse, 1 of 100 dirs", "d7")]:
+        if sparse:
+            check_output([prog, "sparse-checkout", "set", sparse], cwd=root)
+        time.sleep(0.1)  # age the files past the caches' racy window
+        check_output([prog, "status"], cwd=root)
+        status = timed(prog, root, ["status"], reps)
+        samples = []
+        for r in range(reps):
+            start = time.perf_counter()
+            check_output([prog, "reset", tips[r % 2]], cwd=root)
+            samples.append(time.perf_counter() - start)
+        check_output([prog, "reset", tips[1]], cwd=root)
+        report("status, {} files ({})".format(files, label), status)
+        report("reset changing {} files ({})".format(files, label), statistics.median(samples))
+
+def bench_diff(prog, root, files, reps):
+    make_history(root, 0)
+    makedirs(join(root, ".gitlite", "trees"))
+    for d in ["old", "new"]:
+        makedirs(join(root, d))
+    def commit(staged, message):
+        write_stage(root, staged)
+        check_output([prog, "commit", message], cwd=root)
+        with open(join(root, ".gitlite", "branches", "master")) as f:
+            return f.read()
+    for count in [files // 4, files]:
+        for label, edit in [("exact", False), ("edited", True)]:
+            versions = []
+            for version in range(2):
+                staged = {}
+                for i in range(count):
+                    lines = ["{} {} line {}\n".format(label, i, j) for j in range(20)]
+                    if version and edit:
+                        lines[10] = "edited\n"
+                    content = "".join(lines)
+                    staged["{}/f{}.txt".format(["old", "new"][version], i)] = write_object(root, "blobs", content)
+                versions.append(commit(staged, "{} {} {}".format(label, count, version)))
+            report("diff --stat, {} renames ({})".format(count, label), timed(prog, root, ["diff", "--stat"] + versions, reps))
+            report("diff, {} renames ({})".format(count, label), timed(prog, root, ["diff"] + versions, reps))
+
+def bench_blame(prog, root, commits, reps):
+    g = join(root, ".gitlite")
+    for d in ["branches", "commits", "blobs", "trees", "remotes"]:
+        makedirs(join(g, d))
+    with open(join(g, "HEAD"), "w") as f:
+        f.write("ref: .gitlite/branches/master")
+    open(join(g, "stage"), "w").close()
+    rng = random.Random(1)
+    config = ["setting{} = 0\n".format(j) for j in range(1000)]
+    files = {}
+    parent = write_commit(root, "initial commit", 0, [], {})
+    for i in range(commits):
+        if i % 10 == 0:
+            config[rng.randrange(len(config))] = "setting = {}\n".format(i)
+            files["config.txt"] = write_object(root, "blobs", "".join(config))
+        else:
+            files["f{}.txt".format(rng.randrange(50))] = write_object(root, "blobs", "rev {}\n".format(i))
+        tree = write_object(root, "trees", "".join(
+            "blob {} {}\n".format(files[name], name) for name in sorted(files)))
+        parent = write_object(root, "commits", "message: change #{}\ntimestamp: {}\nparent: {}\ntree: {}\n".format(
+            i, 1700000000 + i, parent, tree))
+    with open(join(g, "branches", "master"), "w") as f:
+        f.write(parent)
+    check_output([prog, "commit-graph", "write"], cwd=root)
+    check_output([prog, "reset", parent], cwd=root)
+    cache = join(g, "blame-cache")
+    samples = []
+    for _ in range(reps):
+        rmtree(cache, ignore_errors=True)
+        start = time.perf_counter()
+        check_output([prog, "blame", "config.txt"], cwd=root)
+        samples.append(time.perf_counter() - start)
+    report("blame, {} versions (no cache)".format(commits // 10), statistics.median(samples))
+    report("blame, {} versions (cached)".format(commits // 10), timed(prog, root, ["blame", "config.txt"], reps))
+    samples = []
+    for r in range(reps):
+        with open(join(root, "config.txt"), "a") as f:
+            f.write("added = {}\n".format(r))
+        check_output([prog, "add", "config.txt"], cwd=root)
+        check_output([prog, "commit", "edit {}".format(r)], cwd=root)
+        start = time.perf_counter()
+        check_output([prog, "blame", "config.txt"], cwd=root)
+        samples.append(time.perf_counter() - start)
+    report("blame after one new commit (cached)", statistics.median(samples))
+    print(check_output([prog, "blame", "--stats", "config.txt"], cwd=root).decode().splitlines()[-1])
+
+SCENARIOS = {
+    "find": bench_find,
+    "log-path": bench_log_path,
+    "commit": bench_commit,
+    "status": bench_status,
+    "batch": bench_batch,
+    "bitmaps": bench_bitmaps,
+    "fetch-all": bench_fetch_all,
+    "sparse": bench_sparse,
+    "diff": bench_diff,
+    "blame": bench_blame,
+}
+
+def main():
+    try:
+        opts, scenarios = getopt(sys.argv[1:], '', ['commits=', 'reps=', 'progdir='])
+    except GetoptError:
+        print(__doc__, file=sys.stderr)
+        sys.exit(1)
+    commits, reps = 10000, 5
+    prog = join(dirname(dirname(abspath(__file__))), 'build', 'gitlite')
+    for opt, val in opts:
+        if opt == '--commits':
+            commits = int(val)
+        elif opt == '--reps':
+            reps = int(val)
+        elif opt == '--progdir':
+            prog = join(abspath(val), 'gitlite')
+    if not scenarios or any(s not in SCENARIOS for s in scenarios):
+        print(__doc__, file=sys.stderr)
+        sys.exit(1)
+    for scenario in scenarios:
+        root = mkdtemp(prefix="gitlite-bench-")
+        try:
+            print("== {} ({} commits)".format(scenario, commits))
+            SCENARIOS[scenario](prog, root, commits, reps)
+        finally:
+            rmtree(root)
+
+if __name__ == "__main__":
+    main()
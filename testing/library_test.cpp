@@ -0,0 +1,102 @@
+//Test of gitlite_core used as a library: two Repository instances in one process, each used
+//from its own thread, print only to the stream they were given and report errors by throwing
+//GitliteException, after which they stay usable.
+//Build and run with: cmake -S . -B build && cmake --build build && ctest --test-dir build
+#include "../include/Repository.h"
+#include "../include/Utils.h"
+#include "../include/GitliteException.h"
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what){
+    if(ok) return;
+    std::fprintf(stderr, "FAILED: %s\n", what.c_str());
+    failures++;
+}
+static bool contains(const std::string& text, const std::string& part){
+    return text.find(part) != std::string::npos;
+}
+//the message of the GitliteException f throws, "" if it throws none
+template <typename F>
+static std::string errorOf(F f){
+    try{
+        f();
+    }catch(const GitliteException& e){
+        return e.what();
+    }
+    return "";
+}
+
+//a few commits in repo, one file each, named after tag
+static void commitFiles(Repository& repo, const std::string& root, const std::string& tag){
+    for(int i = 0; i < 5; i++){
+        std::string name = tag + std::to_string(i) + ".txt";
+        Utils::writeContents(Utils::join(root, name), tag + " file " + std::to_string(i) + "\n");
+        repo.add(name);
+        repo.commit("add " + name);
+    }
+}
+
+int main(){
+    char pattern[] = "/tmp/gitlite-library-test-XXXXXX";
+    if(!mkdtemp(pattern)){
+        std::perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = pattern;
+    std::string rootA = Utils::join(dir, "a"), rootB = Utils::join(dir, "b");
+    Utils::createDirectories(rootA);
+    Utils::createDirectories(rootB);
+
+    //nothing may reach the process's stdout
+    std::ostringstream stray;
+    std::streambuf* saved = std::cout.rdbuf(stray.rdbuf());
+    {
+        std::ostringstream outA, outB;
+        Repository a(rootA, outA), b(rootB, outB);
+        a.init();
+        b.init();
+
+        //two instances, each on its own thread
+        std::thread threadA([&](){ commitFiles(a, rootA, "alpha"); });
+        std::thread threadB([&](){ commitFiles(b, rootB, "beta"); });
+        threadA.join();
+        threadB.join();
+
+        outA.str("");
+        outB.str("");
+        a.log();
+        b.log();
+        check(contains(outA.str(), "add alpha4.txt") && !contains(outA.str(), "beta"), "log of a shows only a's commits");
+        check(contains(outB.str(), "add beta4.txt") && !contains(outB.str(), "alpha"), "log of b shows only b's commits");
+        outA.str("");
+        a.status();
+        check(contains(outA.str(), "=== Branches ===\n*master\n"), "status of a goes to a's stream");
+
+        //errors are exceptions, and the instance goes on working after one
+        check(errorOf([&](){ a.commit("nothing"); }) == "No changes added to the commit.", "empty commit throws");
+        check(errorOf([&](){ b.checkoutBranch("nope"); }) == "No such branch exists.", "checkout of a missing branch throws");
+        check(errorOf([&](){ a.init(); }) == "A Gitlite version-control system already exists in the current directory.", "second init throws");
+        check(errorOf([&](){ a.branch("topic"); }).empty(), "a works after an error");
+        outA.str("");
+        a.status();
+        check(contains(outA.str(), "*master\ntopic\n"), "status of a shows the new branch");
+        outB.str("");
+        b.status();
+        check(!contains(outB.str(), "topic"), "the branch of a is not in b");
+    }
+    std::cout.rdbuf(saved);
+    check(stray.str().empty(), "nothing is printed to std::cout, got: " + stray.str());
+
+    std::filesystem::remove_all(dir);
+    if(failures > 0) return 1;
+    std::printf("library_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,100 @@
+//Microbenchmark: std::map<std::string, std::string> file maps (the old Commit/Stage
+//representation) against the flat Manifest, on commits with many files.
+//Build with: cmake -S . -B build -DGITLITE_BENCH=ON && cmake --build build --target manifest_bench
+#include "../include/Manifest.h"
+#include "../include/Utils.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, std::string> FileMap;
+
+template <typename F>
+static double timeMs(F f, int reps){
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < reps; i++) f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / reps;
+}
+
+//the old compare(): count() and operator[] per file
+static void compareMaps(FileMap& lca, const FileMap& files, FileMap& modify, FileMap& same, FileMap& notin, FileMap& newin){
+    for(auto& file : files){
+        if(lca.count(file.first)){
+            if(file.second == lca[file.first]) same[file.first] = file.second;
+            else modify[file.first] = file.second;
+        }else{
+            newin[file.first] = file.second;
+        }
+    }
+    for(auto& file : lca){
+        if(!files.count(file.first)) notin[file.first] = file.second;
+    }
+}
+static void compareManifests(const Manifest& lca, const Manifest& files, Manifest& modify, Manifest& same, Manifest& notin, Manifest& newin){
+    Manifest::mergeJoin(lca, files, [&](const std::string* name, const ObjectId* a, const ObjectId* b){
+        if(a && b){
+            if(*a == *b) same.append(name, *b, lca.pathRefs());
+            else modify.append(name, *b, lca.pathRefs());
+        }else if(b){
+            newin.append(name, *b, files.pathRefs());
+        }else{
+            notin.append(name, *a, lca.pathRefs());
+        }
+    });
+}
+
+int main(int argc, char* argv[]){
+    size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+    int reps = argc > 2 ? std::atoi(argv[2]) : 20;
+
+    FileMap base, changed;
+    Manifest baseManifest, changedManifest;
+    std::vector<std::string> paths;
+    for(size_t i = 0; i < n; i++){
+        char name[64];
+        std::snprintf(name, sizeof(name), "dir%03zu/file%06zu.txt", i % 997, i);
+        paths.push_back(name);
+    }
+    std::sort(paths.begin(), paths.end());
+    for(size_t i = 0; i < n; i++){
+        std::string hash = Utils::sha1(paths[i]);
+        std::string other = i % 100 == 0 ? Utils::sha1(paths[i] + "v2") : hash;
+        base[paths[i]] = hash;
+        baseManifest.append(paths[i], ObjectId::fromHex(hash));
+        if(i % 333 == 7) continue;//deleted on the changed side
+        changed[paths[i]] = other;
+        changedManifest.append(paths[i], ObjectId::fromHex(other));
+    }
+
+    volatile size_t sink = 0;
+    double mapCopy = timeMs([&](){ FileMap copy = base; sink += copy.size(); }, reps);
+    double manifestCopy = timeMs([&](){ Manifest copy = baseManifest; sink += copy.size(); }, reps);
+    double mapLookup = timeMs([&](){
+        for(auto& p : paths) sink += base.count(p);
+    }, reps);
+    double manifestLookup = timeMs([&](){
+        for(auto& p : paths) sink += baseManifest.contains(p);
+    }, reps);
+    double mapCompare = timeMs([&](){
+        FileMap modify, same, notin, newin;
+        compareMaps(base, changed, modify, same, notin, newin);
+        sink += modify.size();
+    }, reps);
+    double manifestCompare = timeMs([&](){
+        Manifest modify, same, notin, newin;
+        compareManifests(baseManifest, changedManifest, modify, same, notin, newin);
+        sink += modify.size();
+    }, reps);
+
+    std::printf("%zu files, %d reps\n", n, reps);
+    std::printf("%-28s %12s %12s\n", "", "std::map", "Manifest");
+    std::printf("%-28s %9.3f ms %9.3f ms\n", "copy", mapCopy, manifestCopy);
+    std::printf("%-28s %9.3f ms %9.3f ms\n", "lookup every path", mapLookup, manifestLookup);
+    std::printf("%-28s %9.3f ms %9.3f ms\n", "compare with base", mapCompare, manifestCompare);
+    return 0;
+}
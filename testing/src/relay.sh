@@ -0,0 +1,5 @@
+# the remote side of a connection that breaks: runs the gitlite at $1 as service $2 on the
+# repository $3 and passes on at most $4 bytes of what it sends; first shows how many transfer
+# journals the repository fetching has
+echo "journals: $(ls .gitlite/transfers 2>/dev/null | grep -c .)" >&2
+"$1" "$2" "$3" | dd bs=1 count="$4" 2>/dev/null